@@ -0,0 +1,397 @@
+// panorama_bench: runs the full pipeline on synthetic capture sets and reports
+// per-stage wall time, CPU time and peak RSS as JSON and CSV.
+//
+// Frames are rendered by treating a wide source image (a bundled media/*.jpg
+// panorama, or a procedural texture) as a cylindrical panorama and reprojecting
+// overlapping rectilinear views out of it, so registration sees real parallax-free
+// camera rotations. Everything runs offline.
+
+#include <algorithm>
+#include <cmath>
+#include <filesystem>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <map>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+#include <opencv2/core.hpp>
+#include <opencv2/imgcodecs.hpp>
+#include <opencv2/imgproc.hpp>
+
+#include "cli.hpp"
+#include "image_io.hpp"
+#include "pipeline.hpp"
+#include "profiler.hpp"
+#include "utils.hpp"
+
+namespace fs = std::filesystem;
+
+#ifndef PANORAMA_MEDIA_DIR
+#define PANORAMA_MEDIA_DIR "media"
+#endif
+
+namespace {
+
+struct BenchOptions {
+    std::string source;              // image file, "procedural", or empty for the first bundled media image
+    double source_fov_deg{180.0};    // horizontal field of view the source panorama spans
+    std::vector<int> counts{4, 8};   // images per capture set
+    std::vector<int> widths{960, 1920}; // frame widths in pixels (4:3 frames)
+    double overlap{0.4};             // fraction of a frame shared with its neighbour
+    int repeat{1};
+    std::string pipeline{"explicit"}; // "explicit" exposes every stage; "default" runs cv::Stitcher
+    std::string mode{"panorama"};
+    fs::path work_dir{"bench_work"};
+    fs::path json_file;              // default: <work_dir>/bench.json
+    fs::path csv_file;               // default: <work_dir>/bench.csv
+    bool show_help{false};
+};
+
+struct StageStats {
+    int calls{0};
+    double wall_ms{0.0};
+    double cpu_ms{0.0};
+    std::size_t peak_rss_bytes{0};
+};
+
+struct CaseResult {
+    int images{0};
+    cv::Size frame;
+    int run{0};
+    int exit_code{0};
+    std::string message;
+    double wall_ms{0.0};
+    double cpu_ms{0.0};
+    std::size_t peak_rss_bytes{0};
+    std::vector<std::pair<std::string, StageStats>> stages; // in first-seen order
+};
+
+std::vector<int> parse_int_list(const std::string& s) {
+    std::vector<int> values;
+    std::stringstream ss(s);
+    std::string item;
+    while (std::getline(ss, item, ',')) {
+        if (!item.empty()) {
+            values.push_back(std::stoi(item));
+        }
+    }
+    return values;
+}
+
+BenchOptions parse_bench_cli(int argc, char** argv) {
+    BenchOptions o;
+    std::vector<std::string> args(argv + 1, argv + argc);
+    for (std::size_t i = 0; i < args.size(); ++i) {
+        const std::string& a = args[i];
+        auto value = [&]() -> std::string {
+            if (i + 1 >= args.size()) {
+                throw std::runtime_error("Missing value for " + a);
+            }
+            return args[++i];
+        };
+        if (a == "-h" || a == "--help") {
+            o.show_help = true;
+        } else if (a == "--source") {
+            o.source = value();
+        } else if (a == "--source-fov") {
+            o.source_fov_deg = std::stod(value());
+        } else if (a == "--counts") {
+            o.counts = parse_int_list(value());
+        } else if (a == "--widths") {
+            o.widths = parse_int_list(value());
+        } else if (a == "--overlap") {
+            o.overlap = std::stod(value());
+        } else if (a == "--repeat") {
+            o.repeat = std::max(1, std::stoi(value()));
+        } else if (a == "--pipeline") {
+            o.pipeline = value();
+        } else if (a == "--mode") {
+            o.mode = value();
+        } else if (a == "--work") {
+            o.work_dir = value();
+        } else if (a == "--json") {
+            o.json_file = value();
+        } else if (a == "--csv") {
+            o.csv_file = value();
+        } else {
+            throw std::runtime_error("Unknown argument: " + a);
+        }
+    }
+    return o;
+}
+
+void print_bench_help(const char* prog) {
+    std::cout << "Usage: " << (prog ? prog : "panorama_bench")
+              << " [--source IMG|procedural] [--source-fov DEG] [--counts 4,8] [--widths 960,1920] [--overlap F] [--repeat N] [--pipeline explicit|default] [--mode panorama|scans] [--work DIR] [--json FILE] [--csv FILE]\n"
+              << "\n"
+              << "Options:\n"
+              << "      --source     Wide image to render frames from (default: first media/*.jpg, else procedural)\n"
+              << "      --source-fov Horizontal field of view of the source in degrees (default: 180)\n"
+              << "      --counts     Images per synthetic capture set (default: 4,8)\n"
+              << "      --widths     Frame widths in pixels; frames are 4:3 (default: 960,1920)\n"
+              << "      --overlap    Fraction of a frame shared with its neighbour (default: 0.4)\n"
+              << "      --repeat     Runs per case (default: 1)\n"
+              << "      --pipeline   explicit: per-stage breakdown; default: the plain cv::Stitcher path\n"
+              << "      --work       Directory for generated frames and outputs (default: ./bench_work)\n"
+              << "      --json, --csv  Result files (default: <work>/bench.json, <work>/bench.csv)\n"
+              << "\n"
+              << "Peak RSS is a process-wide high-water mark; run one case per invocation for exact per-case peaks.\n"
+              << "Frames are written as JPEGs, so HEIC/HEIF decoding is not measured.\n"
+              << std::endl;
+}
+
+// Deterministic feature-rich texture: sky gradient, ground, scattered shapes and noise.
+cv::Mat procedural_source(cv::Size size) {
+    cv::Mat img(size, CV_8UC3);
+    for (int y = 0; y < size.height; ++y) {
+        const double t = static_cast<double>(y) / size.height;
+        const cv::Vec3b row_color = t < 0.55 ? cv::Vec3b(static_cast<uchar>(230 - 80 * t), static_cast<uchar>(180 - 60 * t), 120)
+                                             : cv::Vec3b(60, static_cast<uchar>(90 + 40 * t), 70);
+        img.row(y).setTo(cv::Scalar(row_color[0], row_color[1], row_color[2]));
+    }
+    cv::RNG rng(0x5eed);
+    const int shapes = size.area() / 4000;
+    for (int k = 0; k < shapes; ++k) {
+        cv::Point p(rng.uniform(0, size.width), rng.uniform(size.height / 4, size.height));
+        cv::Scalar color(rng.uniform(0, 256), rng.uniform(0, 256), rng.uniform(0, 256));
+        const int r = rng.uniform(4, 40);
+        switch (k % 3) {
+            case 0:
+                cv::circle(img, p, r, color, cv::FILLED, cv::LINE_AA);
+                break;
+            case 1:
+                cv::rectangle(img, p, p + cv::Point(r, r * 2), color, cv::FILLED);
+                break;
+            default:
+                cv::line(img, p, p + cv::Point(rng.uniform(-60, 60), rng.uniform(-60, 60)), color, 2, cv::LINE_AA);
+                break;
+        }
+    }
+    cv::Mat noise(size, CV_8UC3);
+    cv::randn(noise, cv::Scalar::all(8), cv::Scalar::all(6)); // 8U saturates, so centre the noise on +8
+    cv::add(img, noise, img);
+    cv::subtract(img, cv::Scalar::all(8), img);
+    return img;
+}
+
+cv::Mat load_source(const BenchOptions& o, std::string& description) {
+    fs::path path;
+    if (o.source.empty()) {
+        std::vector<fs::path> media = list_image_files(PANORAMA_MEDIA_DIR);
+        if (!media.empty()) {
+            path = media.front();
+        }
+    } else if (o.source != "procedural") {
+        path = o.source;
+    }
+    if (!path.empty()) {
+        cv::Mat img = cv::imread(path.string(), cv::IMREAD_COLOR);
+        if (!img.empty()) {
+            description = path.string();
+            return img;
+        }
+        std::cerr << "Warning: cannot read source " << path << "; using procedural source\n";
+    }
+    description = "procedural";
+    return procedural_source(cv::Size(8000, 2000));
+}
+
+// Render 'count' overlapping pinhole views of width 'width' out of a cylindrical source.
+std::vector<cv::Mat> render_frames(const cv::Mat& source, double source_fov_deg, int count, int width, double overlap) {
+    const double kPi = 3.14159265358979323846;
+    const double sweep = source_fov_deg * kPi / 180.0;
+    const double fs_cyl = source.cols / sweep; // cylinder radius in source pixels
+
+    // Frame field of view so that 'count' frames with 'overlap' fill the sweep, capped for a sane pinhole
+    double fov = sweep / (1.0 + (count - 1) * (1.0 - overlap));
+    fov = std::min(fov, 70.0 * kPi / 180.0);
+    const double step = fov * (1.0 - overlap);
+    const double span = fov + (count - 1) * step;
+    const double f = (width / 2.0) / std::tan(fov / 2.0);
+
+    // 4:3 frames, shortened if the source is not tall enough
+    int height = width * 3 / 4;
+    const int max_height = static_cast<int>(0.95 * source.rows * f / fs_cyl);
+    height = std::max(16, std::min(height, max_height)) & ~1;
+
+    std::vector<cv::Mat> frames;
+    cv::Mat map_x(height, width, CV_32F), map_y(height, width, CV_32F);
+    const double cx = width / 2.0, cy = height / 2.0;
+    for (int i = 0; i < count; ++i) {
+        const double yaw = -span / 2.0 + fov / 2.0 + i * step;
+        for (int y = 0; y < height; ++y) {
+            float* mx = map_x.ptr<float>(y);
+            float* my = map_y.ptr<float>(y);
+            for (int x = 0; x < width; ++x) {
+                const double dx = x - cx;
+                const double dy = y - cy;
+                const double angle = yaw + std::atan2(dx, f);
+                const double h = dy / std::sqrt(dx * dx + f * f);
+                mx[x] = static_cast<float>((angle + sweep / 2.0) * fs_cyl);
+                my[x] = static_cast<float>(source.rows / 2.0 + h * fs_cyl);
+            }
+        }
+        cv::Mat frame;
+        cv::remap(source, frame, map_x, map_y, cv::INTER_LINEAR, cv::BORDER_REFLECT);
+        // Small per-frame exposure change so exposure compensation has work to do
+        frame.convertTo(frame, -1, 1.0 + 0.04 * std::sin(i * 1.7), 0.0);
+        frames.push_back(frame);
+    }
+    return frames;
+}
+
+CaseResult run_case(const BenchOptions& o, const fs::path& case_dir, int count, cv::Size frame, int run) {
+    CaseResult r;
+    r.images = count;
+    r.frame = frame;
+    r.run = run;
+
+    CLIOptions opts;
+    opts.max_dim = 0; // keep the generated resolution
+    opts.mode = o.mode;
+
+    std::ostringstream log;
+    PipelineContext ctx;
+    ctx.out = &log;
+    ctx.err = &log;
+    // Separate register/compose stages, with frames in memory as on a plain CLI run
+    ctx.explicit_stages = o.pipeline == "explicit";
+    PipelineResult result;
+
+    const double cpu0 = utils::process_cpu_ms();
+    profiler::enable();
+    run_pipeline(opts, case_dir / "images", case_dir / "output", ctx, &result);
+    profiler::disable();
+    r.cpu_ms = utils::process_cpu_ms() - cpu0;
+    r.wall_ms = result.timings.total_ms;
+    r.exit_code = result.exit_code;
+    r.message = result.message;
+    r.peak_rss_bytes = utils::peak_rss_bytes();
+
+    std::map<std::string, std::size_t> slot;
+    for (const auto& e : profiler::take_events()) {
+        if (e.kind != profiler::Event::Kind::Scope) {
+            continue;
+        }
+        auto it = slot.find(e.name);
+        if (it == slot.end()) {
+            it = slot.emplace(e.name, r.stages.size()).first;
+            r.stages.emplace_back(e.name, StageStats());
+        }
+        StageStats& s = r.stages[it->second].second;
+        s.calls += 1;
+        s.wall_ms += e.wall_us / 1000.0;
+        s.cpu_ms += e.cpu_us / 1000.0;
+        s.peak_rss_bytes = std::max(s.peak_rss_bytes, e.peak_rss_bytes);
+    }
+    return r;
+}
+
+double to_mb(std::size_t bytes) {
+    return static_cast<double>(bytes) / (1024.0 * 1024.0);
+}
+
+void write_json(const fs::path& file, const BenchOptions& o, const std::string& source, const std::vector<CaseResult>& results) {
+    std::ofstream js(file);
+    js << std::fixed << std::setprecision(3);
+    js << "{\n  \"source\": " << utils::json_string(source) << ",\n  \"pipeline\": " << utils::json_string(o.pipeline)
+       << ",\n  \"mode\": " << utils::json_string(o.mode) << ",\n  \"cases\": [\n";
+    for (std::size_t c = 0; c < results.size(); ++c) {
+        const CaseResult& r = results[c];
+        js << "    {\"images\": " << r.images << ", \"width\": " << r.frame.width << ", \"height\": " << r.frame.height
+           << ", \"run\": " << r.run << ", \"exit_code\": " << r.exit_code
+           << ", \"wall_ms\": " << r.wall_ms << ", \"cpu_ms\": " << r.cpu_ms
+           << ", \"peak_rss_mb\": " << to_mb(r.peak_rss_bytes) << ",\n     \"stages\": [";
+        for (std::size_t k = 0; k < r.stages.size(); ++k) {
+            const StageStats& s = r.stages[k].second;
+            js << (k ? ",\n       " : "\n       ") << "{\"name\": " << utils::json_string(r.stages[k].first)
+               << ", \"calls\": " << s.calls << ", \"wall_ms\": " << s.wall_ms << ", \"cpu_ms\": " << s.cpu_ms
+               << ", \"peak_rss_mb\": " << to_mb(s.peak_rss_bytes) << "}";
+        }
+        js << "]}" << (c + 1 < results.size() ? "," : "") << "\n";
+    }
+    js << "  ]\n}\n";
+}
+
+void write_csv(const fs::path& file, const std::vector<CaseResult>& results) {
+    std::ofstream csv(file);
+    csv << std::fixed << std::setprecision(3);
+    csv << "images,width,height,run,exit_code,stage,calls,wall_ms,cpu_ms,peak_rss_mb\n";
+    for (const auto& r : results) {
+        const std::string prefix = std::to_string(r.images) + "," + std::to_string(r.frame.width) + "," +
+                                   std::to_string(r.frame.height) + "," + std::to_string(r.run) + "," +
+                                   std::to_string(r.exit_code) + ",";
+        for (const auto& st : r.stages) {
+            csv << prefix << st.first << "," << st.second.calls << "," << st.second.wall_ms << ","
+                << st.second.cpu_ms << "," << to_mb(st.second.peak_rss_bytes) << "\n";
+        }
+        csv << prefix << "total,1," << r.wall_ms << "," << r.cpu_ms << "," << to_mb(r.peak_rss_bytes) << "\n";
+    }
+}
+
+} // namespace
+
+int main(int argc, char** argv) {
+    try {
+        BenchOptions o = parse_bench_cli(argc, argv);
+        if (o.show_help) {
+            print_bench_help(argv[0]);
+            return 0;
+        }
+        if (o.counts.empty() || o.widths.empty() || o.overlap <= 0.0 || o.overlap >= 1.0) {
+            std::cerr << "Invalid --counts/--widths/--overlap\n";
+            return 1;
+        }
+        std::string source_name;
+        cv::Mat source = load_source(o, source_name);
+        std::cout << "Source: " << source_name << " (" << source.cols << "x" << source.rows << ")\n";
+
+        std::vector<CaseResult> results;
+        for (int width : o.widths) {
+            for (int count : o.counts) {
+                std::ostringstream name;
+                name << "n" << count << "_w" << width;
+                const fs::path case_dir = o.work_dir / name.str();
+                fs::remove_all(case_dir);
+                fs::create_directories(case_dir / "images");
+
+                std::vector<cv::Mat> frames = render_frames(source, o.source_fov_deg, std::max(2, count), width, o.overlap);
+                for (std::size_t i = 0; i < frames.size(); ++i) {
+                    std::ostringstream file;
+                    file << "frame_" << std::setw(3) << std::setfill('0') << i << ".jpg";
+                    cv::imwrite((case_dir / "images" / file.str()).string(), frames[i], {cv::IMWRITE_JPEG_QUALITY, 92});
+                }
+                const cv::Size frame = frames.front().size();
+                frames.clear();
+
+                for (int run = 0; run < o.repeat; ++run) {
+                    CaseResult r = run_case(o, case_dir, count, frame, run);
+                    std::cout << std::fixed << std::setprecision(1) << name.str() << " run " << run << ": "
+                              << (r.exit_code == 0 ? "ok" : "FAILED (" + r.message + ")") << ", wall " << r.wall_ms
+                              << " ms, cpu " << r.cpu_ms << " ms, peak RSS " << to_mb(r.peak_rss_bytes) << " MB\n";
+                    for (const auto& st : r.stages) {
+                        std::cout << "  " << std::left << std::setw(14) << st.first << std::right << std::setw(10)
+                                  << st.second.wall_ms << " ms wall " << std::setw(10) << st.second.cpu_ms
+                                  << " ms cpu  x" << st.second.calls << "\n";
+                    }
+                    results.push_back(std::move(r));
+                }
+            }
+        }
+
+        const fs::path json_file = o.json_file.empty() ? o.work_dir / "bench.json" : o.json_file;
+        const fs::path csv_file = o.csv_file.empty() ? o.work_dir / "bench.csv" : o.csv_file;
+        write_json(json_file, o, source_name, results);
+        write_csv(csv_file, results);
+        std::cout << "Results written to " << json_file.string() << " and " << csv_file.string() << "\n";
+
+        const bool failed = std::any_of(results.begin(), results.end(), [](const CaseResult& r) { return r.exit_code != 0; });
+        return failed ? 9 : 0;
+    } catch (const std::exception& ex) {
+        std::cerr << "Error: " << ex.what() << "\n";
+        return 100;
+    }
+}
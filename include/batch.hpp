@@ -0,0 +1,19 @@
+#pragma once
+
+#include <filesystem>
+#include <vector>
+
+#include "cli.hpp"
+
+// Every directory under 'root' (including 'root' itself) that directly
+// contains images, sorted by path.
+std::vector<std::filesystem::path> find_capture_dirs(const std::filesystem::path& root);
+
+// Stitch every capture directory under opts.batch_root into the matching
+// subdirectory of opts.output_dir within one process:
+// - at most opts.batch_jobs panoramas run at once,
+// - all jobs decode on one shared worker pool and share OpenCV's thread pool,
+// - jobs are admitted only while their estimated memory fits opts.batch_memory_mb,
+// - a per-job status/timing summary is written to <output_dir>/batch_summary.csv.
+// Returns 0 if every job succeeded, 9 if some failed, 4 if nothing was found.
+int run_batch(const CLIOptions& opts);
@@ -1,26 +1,112 @@
 #pragma once
 
+#include <cstddef>
 #include <string>
 
+// Per-stage thread budgets (--stage-threads); 0 falls back to --threads.
+struct StageThreads {
+    unsigned decode{0};   // image decoding (the project's worker pool)
+    unsigned features{0}; // keypoint detection (OpenCV's pool)
+    unsigned matching{0}; // pairwise matching (OpenCV's pool)
+    unsigned compose{0};  // exposure, seams, warping and blending (OpenCV's pool)
+    unsigned encode{0};   // output encoding and tiles (the project's worker pool)
+};
+
 struct CLIOptions {
     std::string input_dir;
+    std::string video;            // Stitch keyframes picked from this video instead of the images in input_dir
+    double video_overlap{0.5};    // Overlap (fraction of the frame) aimed for between video keyframes
     std::string output_dir;
     std::string output_filename; // default: panorama.jpg
     bool show_help{false};
     // Advanced options
     bool top_match_only{false};   // Match only top half when estimating/matching
+    std::string match_region{"full"}; // "full", "top", "horizon" or "x,y,w,h" (fractions of the frame)
+    std::string quality;          // Registration preset: "fast", "balanced", "best"; empty keeps cv::Stitcher's ORB
+    std::string features;         // "orb", "akaze" or "sift"; empty uses the preset's detector
+    int max_keypoints{-1};        // Keypoints kept per image; -1 uses the preset's budget, 0 the detector's own limit
     int max_dim{1000};            // Downscale inputs so max(width,height) <= max_dim; 0 to disable
     std::string mode{"panorama"}; // "panorama" or "scans" for translational captures
+    std::size_t memory_budget_mb{0}; // Composite one image at a time within this budget; 0 to disable
+    int register_dim{0};          // Register on proxies with max(width,height) <= register_dim, compose from originals; 0 to disable
+    double compose_scale{1.0};    // Output resolution relative to the original files (with --register-dim)
+    bool use_cache{false};        // Reuse features/matches/cameras from <output>/.panorama_cache
+    bool heic_cache{false};       // Decode HEIC/HEIF through JPEG copies kept in <output>/.panorama_cache/heic
+    bool partial{false};          // Stitch every connected group of frames into its own file instead of only the largest
+    bool retry{false};            // On registration failure, retry with an escalating list of fallback settings
+    double retry_budget_s{60.0};  // No retry starts once registration has taken this long (soft: checked between attempts)
+    bool preview{false};          // Fast low-resolution preview (<stem>_preview.jpg) plus a confidence/coverage report
+    bool incremental{false};      // Extend the previous run's panorama with new frames (state in <output>/.panorama_cache/incremental)
+    int match_window{0};          // Match each image only with the K images on either side in filename order; 0 matches all pairs
+    bool match_wrap{false};       // Also match across the first/last frame (360 degree sets)
+    std::string seam;             // Seam finder: "graphcut", "dp", "voronoi" or "none"; empty keeps cv::Stitcher's graph-cut
+    std::string exposure;         // Exposure compensation: "blocks", "gain", "channels" or "none"; empty keeps block gains
+    double seam_megapix{0.0};     // Resolution (megapixels) of seam finding and exposure estimation; 0 keeps 0.1
+    std::string crop{"heuristic"}; // "mask" (largest valid rectangle), "heuristic" (trim black bands) or "none"
+    std::string tiles_dir;        // Write a DeepZoom tile pyramid here (relative to the output dir) instead of one file
+    int thumbnail_dim{0};         // Also write <file stem>_thumb.jpg with max(width,height) <= N; 0 to disable
+    std::string profile_file;     // Write a Chrome trace of stage timings and counters here; empty to disable
+    // Threads and placement
+    unsigned threads{0};          // Worker threads for OpenCV and the project's pools; 0 = one per CPU the process may use
+    StageThreads stage_threads;   // Per-stage overrides of 'threads'
+    std::string cpus;             // Pin the process to these CPUs ("0-15,32-47"); empty to leave placement to the OS
+    int numa_node{-1};            // Pin the process to the CPUs of this NUMA node (Linux); -1 to disable
+    // Batch mode
+    std::string batch_root;       // Stitch every image directory under this root (output mirrors the tree)
+    int batch_jobs{2};            // Panoramas stitched concurrently
+    std::size_t batch_memory_mb{0}; // Admit jobs only while their estimated memory fits; 0 = unlimited
+    // Watch mode
+    std::string watch_root;       // Keep running and stitch capture sets as they appear under this root
+    double watch_settle_s{10.0};  // A set is stitched once its files have been unchanged this long
 };
 
 // Parse command line arguments. Supports:
 //   -i, --input <dir>
+//   --video <file> [--video-overlap <fraction>]
 //   -o, --output <dir>
 //   -f, --file <filename>
 //   -h, --help
 //   --top-match-only
+//   --match-region full|top|horizon|x,y,w,h
+//   --quality fast|balanced|best
+//   --features orb|akaze|sift
+//   --max-keypoints <int>
 //   --max-dim <int>
 //   --mode panorama|scans
+//   --memory-budget <MB>
+//   --register-dim <int>
+//   --compose-scale <float>
+//   --cache
+//   --heic-cache
+//   --incremental
+//   --partial
+//   --retry [--retry-budget <sec>]
+//   --preview
+//   --match-window <int>
+//   --match-wrap
+//   --seam graphcut|dp|voronoi|none
+//   --exposure blocks|gain|channels|none
+//   --seam-megapix <float>
+//   --crop mask|heuristic|none
+//   --thumbnail <int>
+//   --tiles <dir>
+//   --profile <file>
+//   --threads <int>
+//   --stage-threads decode=N,features=N,matching=N,compose=N,encode=N
+//   --cpus <list>
+//   --numa-node <int>
+//   --batch <root> [--jobs <int>] [--batch-memory <MB>]
+//   --watch <root> [--watch-settle <sec>] [--jobs <int>]
 CLIOptions parse_cli(int argc, char** argv);
 
+// Resolve a --match-region value to a rectangle in fractions of the frame.
+// Returns false if 'spec' is not a preset or four numbers describing a
+// non-empty rectangle inside [0, 1] x [0, 1].
+bool parse_match_region(const std::string& spec, double& x, double& y, double& w, double& h);
+
+// Parse a --stage-threads value: comma-separated stage=N pairs for the stages
+// decode, features, matching, compose and encode. Stages not listed keep their
+// value. Returns false on an unknown stage or a malformed count.
+bool parse_stage_threads(const std::string& spec, StageThreads& stages);
+
 void print_help(const char* prog);
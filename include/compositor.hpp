@@ -0,0 +1,107 @@
+#pragma once
+
+#include <cstddef>
+#include <filesystem>
+#include <functional>
+#include <string>
+#include <vector>
+#include <opencv2/core.hpp>
+#include <opencv2/stitching/warpers.hpp>
+#include <opencv2/stitching/detail/camera.hpp>
+#include <opencv2/stitching/detail/exposure_compensate.hpp>
+#include <opencv2/stitching/detail/seam_finders.hpp>
+
+// Returns frame 'index' resized by 'scale' relative to its full-resolution size.
+// Called once per frame for the seam pass and once for the compose pass, so
+// frames never need to be resident all at the same time. The returned image
+// only has to stay valid until the next call.
+using FrameLoader = std::function<cv::Mat(std::size_t index, double scale)>;
+
+// Seam finders, from most to least expensive. GraphCut and DpColorGrad run
+// independent frame pairs in parallel (see create_seam_finder()).
+enum class SeamMethod { GraphCut, DpColorGrad, Voronoi, None };
+
+// Exposure compensators; Channels falls back to Gain on OpenCV builds older than 4.1.
+enum class ExposureMethod { BlockGains, Gain, Channels, None };
+
+// "graphcut", "dp", "voronoi" or "none".
+bool parse_seam_method(const std::string& name, SeamMethod& method);
+
+// "blocks", "gain", "channels" or "none".
+bool parse_exposure_method(const std::string& name, ExposureMethod& method);
+
+// Seam finder for 'method' (null for None). Pairwise finders are wrapped so that
+// overlapping pairs are processed in rounds where no frame appears twice, with
+// the pairs of a round running concurrently on OpenCV's threads.
+cv::Ptr<cv::detail::SeamFinder> create_seam_finder(SeamMethod method);
+
+// Exposure compensator for 'method' (null for None).
+cv::Ptr<cv::detail::ExposureCompensator> create_exposure_compensator(ExposureMethod method);
+
+struct CompositeOptions {
+    std::size_t memory_budget_bytes{0}; // 0 = unlimited (always multiband in RAM)
+    double compose_scale{1.0};          // output resolution relative to full-resolution frames
+    double seam_megapix{0.1};           // resolution used for exposure/seam estimation
+    int max_blend_bands{5};             // multiband levels when the budget allows
+    bool feather_only{false};           // never multiband: feather-blend (on disk only if the budget demands)
+    std::filesystem::path scratch_dir;  // where a disk-backed canvas may be placed
+    float warped_scale{0.f};            // projection focal in full-resolution pixels; 0 = median camera focal
+};
+
+struct CompositeReport {
+    cv::Size canvas;                 // size of the composited canvas
+    cv::Point canvas_origin;         // top-left corner of the canvas in warped coordinates
+    float warped_scale{0.f};         // projection focal used (full-resolution pixels)
+    double compose_scale{1.0};       // scale actually used (may be lowered to fit the budget)
+    std::string blender;             // e.g. "multiband(5)", "feather", "feather(disk)"
+    bool disk_backed{false};         // accumulation canvas was memory-mapped from disk
+    std::size_t estimated_bytes{0};  // predicted compositing footprint
+    bool over_budget{false};         // even the smallest canvas tried exceeds the memory budget
+    std::size_t peak_rss_bytes{0};   // process peak RSS after blending
+    // Wall time of each compositing stage
+    double seam_warp_ms{0.0};        // loading and warping frames at seam resolution
+    double exposure_ms{0.0};         // exposure compensator feed
+    double seam_ms{0.0};             // seam finding
+    double blend_ms{0.0};            // compose pass: load, warp, compensate, blend
+};
+
+// Canvas rectangle obtained by warping frames of 'full_sizes' with 'cameras'
+// (expressed in full-resolution pixel units) at 'scale'. 'warped_scale' is the
+// projection focal; 0 uses the median camera focal like composite_streaming().
+cv::Rect estimate_canvas(const std::vector<cv::detail::CameraParams>& cameras,
+                         const std::vector<cv::Size>& full_sizes,
+                         const cv::Ptr<cv::WarperCreator>& warper_creator,
+                         double scale,
+                         float warped_scale = 0.f);
+
+// Warped footprint of each frame (a 255 mask of its full extent) at 'scale',
+// rasterised into 'area' (CV_8U, non-zero where at least one frame lands).
+// 'area_rect' is the region of warped coordinates 'area' covers.
+void render_footprints(const std::vector<cv::detail::CameraParams>& cameras,
+                       const std::vector<cv::Size>& full_sizes,
+                       const cv::Ptr<cv::WarperCreator>& warper_creator,
+                       double scale,
+                       float warped_scale,
+                       const cv::Rect& area_rect,
+                       cv::Mat& area);
+
+// Warp, seam and blend the frames one at a time into a single canvas.
+// - cameras are expressed in full-resolution pixel units (one per frame).
+// - The canvas size is estimated from the cameras before any warping; the
+//   blender (multiband, fewer bands, feather, disk-backed feather) and, if
+//   needed, a lower compose scale are picked so the estimate fits the budget.
+// - Without a seam finder and exposure compensator the seam pass is skipped and
+//   every frame is blended over its whole footprint.
+// - pano receives the CV_8UC3 result; pano_mask (if provided) the valid-pixel mask.
+// Returns false and sets error_message on failure.
+bool composite_streaming(const std::vector<cv::detail::CameraParams>& cameras,
+                         const std::vector<cv::Size>& full_sizes,
+                         const FrameLoader& load_frame,
+                         const cv::Ptr<cv::WarperCreator>& warper_creator,
+                         const cv::Ptr<cv::detail::SeamFinder>& seam_finder,
+                         const cv::Ptr<cv::detail::ExposureCompensator>& exposure,
+                         const CompositeOptions& options,
+                         cv::Mat& pano,
+                         cv::Mat* pano_mask,
+                         CompositeReport* report,
+                         std::string& error_message);
@@ -0,0 +1,23 @@
+#pragma once
+
+#include <string>
+#include <vector>
+
+// Parse a CPU list in the Linux cpulist syntax, e.g. "0-15,32-47" or "3".
+// Returns false on malformed input or an empty list; 'cpus' is sorted and unique.
+bool parse_cpu_list(const std::string& spec, std::vector<int>& cpus);
+
+// CPUs of NUMA node 'node', read from /sys/devices/system/node/node<N>/cpulist.
+// Linux only; returns false and sets 'error_message' elsewhere or if the node does not exist.
+bool numa_node_cpus(int node, std::vector<int>& cpus, std::string& error_message);
+
+// Restrict the calling thread, and every thread it starts afterwards, to 'cpus'.
+// Called at start-up before any worker exists, this pins the whole process; with
+// the default first-touch policy its memory then also comes from the nodes of
+// those CPUs. Linux (sched_setaffinity) and Windows (process affinity mask, CPUs
+// 0-63); returns false and sets 'error_message' elsewhere or if the OS refuses.
+bool pin_to_cpus(const std::vector<int>& cpus, std::string& error_message);
+
+// Number of CPUs the process may run on (its affinity mask where the platform
+// exposes one, std::thread::hardware_concurrency() otherwise); at least 1.
+unsigned available_cpus();
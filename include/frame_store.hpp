@@ -0,0 +1,59 @@
+#pragma once
+
+#include <cstddef>
+#include <filesystem>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+#include <opencv2/core.hpp>
+
+#include "mapped_file.hpp"
+
+// Decoded frames kept in memory-mapped scratch files (see MappedFile), so the
+// pixels of frames nobody is working on can be paged out instead of pinning RAM.
+// - put() copies a decoded frame into its own mapping; the heap copy can then
+//   be dropped. view() hands out zero-copy cv::Mat headers over the mapping.
+// - Each frame carries a count of pending uses. release() retires one: the
+//   frame's pages are evicted while uses remain, and the mapping is freed when
+//   the last use is gone. Views of a frame are valid until then.
+// All members are thread-safe.
+class FrameStore {
+public:
+    // Scratch files are created in 'scratch_dir' (the system temp dir when empty).
+    explicit FrameStore(std::filesystem::path scratch_dir = std::filesystem::path());
+
+    FrameStore(const FrameStore&) = delete;
+    FrameStore& operator=(const FrameStore&) = delete;
+
+    // Store 'image' as frame 'index' with 'uses' pending uses and return a view of
+    // the stored copy. Returns 'image' itself (unspilled) if no mapping could be made.
+    cv::Mat put(std::size_t index, const cv::Mat& image, int uses);
+
+    // Zero-copy view of frame 'index'; empty once the frame has been freed.
+    cv::Mat view(std::size_t index) const;
+
+    // Add 'uses' pending uses to frame 'index' (no effect once freed).
+    void retain(std::size_t index, int uses);
+
+    // One use of frame 'index' is done: evict its pages, or free it if it was the last.
+    void release(std::size_t index);
+
+    // Page out every stored frame; contents stay valid.
+    void evict_all();
+
+    // Bytes of frames currently stored (freed frames excluded).
+    std::size_t stored_bytes() const;
+
+private:
+    struct Slot {
+        std::unique_ptr<MappedFile> storage;
+        cv::Mat view;
+        int uses{0};
+    };
+
+    std::filesystem::path scratch_dir_;
+    mutable std::mutex mutex_;
+    std::vector<Slot> slots_;
+    std::size_t stored_bytes_{0};
+};
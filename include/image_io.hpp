@@ -1,9 +1,94 @@
 #pragma once
 
+#include <string>
 #include <vector>
 #include <filesystem>
 #include <opencv2/core.hpp>
 
+class FrameStore;
+class ThreadPool;
+
 // List image files in the directory, sorted by filename ascending.
-// Accepts common image extensions.
+// Accepts common image extensions, including HEIC/HEIF (decoded directly when
+// OpenCV has HEIF support).
 std::vector<std::filesystem::path> list_image_files(const std::filesystem::path& dir);
+
+// Read width/height from a JPEG header without decoding any pixels.
+// Returns false if the file is not a baseline/progressive JPEG.
+bool read_jpeg_size(const std::filesystem::path& p, cv::Size& size);
+// Same, for a JPEG held in memory.
+bool read_jpeg_size(const std::vector<unsigned char>& bytes, cv::Size& size);
+
+// Decode a single image so that max(width,height) <= max_dim (0 keeps full size).
+// JPEGs are decoded at 1/2, 1/4 or 1/8 scale in the DCT domain whenever the
+// target allows it; any remaining reduction uses INTER_AREA.
+// - original_size (if provided) receives the size of the image on disk.
+// - reduced (if provided) is set to true when a reduced-resolution decode was used.
+// Returns an empty Mat on failure.
+cv::Mat load_image(const std::filesystem::path& p,
+                   int max_dim,
+                   cv::Size* original_size = nullptr,
+                   bool* reduced = nullptr);
+
+// Same as load_image() for an encoded file held in memory (JPEG, PNG, TIFF,
+// HEIC/HEIF with OpenCV HEIF support, ...); the buffer is not copied.
+cv::Mat decode_image(const std::vector<unsigned char>& bytes,
+                     int max_dim,
+                     cv::Size* original_size = nullptr,
+                     bool* reduced = nullptr);
+
+// Decode a single image at 'scale' relative to its full-resolution size
+// 'full_size' (as reported by load_image/load_images). Used to stream
+// full-resolution frames from disk during compositing.
+cv::Mat load_image_scaled(const std::filesystem::path& p, const cv::Size& full_size, double scale);
+
+struct LoadedImage {
+    std::filesystem::path path;
+    cv::Mat image;          // empty if decoding failed
+    cv::Size original_size; // size on disk, before any downscale
+};
+
+struct LoadStats {
+    double wall_ms{0.0};            // elapsed time of the whole stage
+    double decode_ms{0.0};          // decode time summed across workers
+    double resize_ms{0.0};          // resize time summed across workers
+    std::size_t reduced_decodes{0}; // frames decoded with IMREAD_REDUCED_*
+    unsigned threads{0};
+};
+
+// Load all images on a bounded worker pool (num_threads == 0 uses all cores).
+// The result has one entry per input path, in the same order.
+// With a 'store', each frame is moved into it (with one pending use) as soon as
+// it is decoded and LoadedImage::image is a view of the stored copy, so at most
+// one decoded frame per worker is held on the heap.
+std::vector<LoadedImage> load_images(const std::vector<std::filesystem::path>& paths,
+                                     int max_dim,
+                                     unsigned num_threads = 0,
+                                     LoadStats* stats = nullptr,
+                                     FrameStore* store = nullptr);
+
+// Same as above, but decodes on a caller-owned pool shared with other work.
+std::vector<LoadedImage> load_images(const std::vector<std::filesystem::path>& paths,
+                                     int max_dim,
+                                     ThreadPool& pool,
+                                     LoadStats* stats = nullptr,
+                                     FrameStore* store = nullptr);
+
+struct HeicCacheStats {
+    std::size_t reused{0};  // copies already in the cache
+    std::size_t written{0}; // copies created by this call
+    std::size_t failed{0};  // HEIC files left as they were (see 'report')
+    double wall_ms{0.0};
+};
+
+// Opt-in, non-destructive HEIC/HEIF -> JPEG cache.
+// Every HEIC/HEIF entry of 'paths' is replaced by a JPEG copy in 'cache_dir',
+// keyed by the source's path, size and mtime. Missing copies are created in
+// parallel (on 'pool', or a private pool when null) and written atomically;
+// the input files are never modified. JPEG copies then take the reduced-resolution
+// decode path on later runs. Per-file results go to 'report' if provided.
+HeicCacheStats cache_heic_as_jpeg(std::vector<std::filesystem::path>& paths,
+                                  const std::filesystem::path& cache_dir,
+                                  ThreadPool* pool = nullptr,
+                                  int jpg_quality = 95,
+                                  std::string* report = nullptr);
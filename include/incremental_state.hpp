@@ -0,0 +1,44 @@
+#pragma once
+
+#include <filesystem>
+#include <string>
+#include <vector>
+#include <opencv2/core.hpp>
+
+#include "panorama_stitcher.hpp"
+
+// What an --incremental run leaves behind for the next one, stored under
+// <output>/.panorama_cache/incremental: the registration of every frame
+// stitched so far and the uncropped canvas with its valid-pixel mask.
+// Features and pairwise matches live in the regular RegistrationCache.
+struct IncrementalState {
+    std::string settings;                 // options the state was built with; a mismatch forces a full run
+    std::vector<std::string> frame_keys;  // RegistrationCache::file_key() of each registered frame
+    Registration registration;            // indices are only valid for the run that saved them
+    double compose_scale{1.0};            // canvas resolution relative to the registered frame sizes
+    float warped_scale{0.f};              // projection focal the canvas was warped with
+    cv::Point origin;                     // canvas top-left corner in warped coordinates
+    cv::Mat canvas;                       // CV_8UC3, uncropped
+    cv::Mat canvas_mask;                  // CV_8U, non-zero where composited
+};
+
+// Load the state saved in 'dir'. Returns false (and sets error_message if
+// provided) when there is none or it is unreadable.
+bool load_incremental_state(const std::filesystem::path& dir,
+                            IncrementalState& state,
+                            std::string* error_message = nullptr);
+
+// Save 'state' to 'dir'. The canvas is written first and the descriptor last,
+// each through a temporary file and a rename, so an interrupted save leaves a
+// state that fails to load rather than one that mixes two runs.
+bool save_incremental_state(const std::filesystem::path& dir,
+                            const IncrementalState& state,
+                            std::string* error_message = nullptr);
+
+// Express the state's registration in terms of the current input list.
+// 'frame_keys' and 'full_sizes' have one entry per current input frame.
+// Returns false if a previously registered frame is missing or has changed.
+bool resolve_incremental_frames(const IncrementalState& state,
+                                const std::vector<std::string>& frame_keys,
+                                const std::vector<cv::Size>& full_sizes,
+                                Registration& previous);
@@ -0,0 +1,41 @@
+#pragma once
+
+#include <cstddef>
+#include <filesystem>
+#include <memory>
+#include <string>
+
+// Zero-filled scratch buffer backed by a memory-mapped temporary file, so the
+// OS can page it out instead of holding it in RAM. The file is unlinked as
+// soon as it is mapped and disappears with the mapping. On platforms without
+// mmap the buffer falls back to a heap allocation.
+class MappedFile {
+public:
+    MappedFile() = default;
+    ~MappedFile();
+
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+
+    // Create a scratch file of 'bytes' in 'dir' and map it read/write.
+    // Returns false and sets error_message (if provided) on failure.
+    bool create(const std::filesystem::path& dir, std::size_t bytes, std::string* error_message = nullptr);
+
+    // Unmap and drop the buffer.
+    void release();
+
+    // Drop the buffer's pages from the process while keeping their contents:
+    // the next access pages them back in from the scratch file. No-op for the
+    // heap fallback.
+    void evict();
+
+    unsigned char* data() const { return data_; }
+    std::size_t size() const { return size_; }
+    bool disk_backed() const { return mapped_; }
+
+private:
+    unsigned char* data_{nullptr};
+    std::size_t size_{0};
+    bool mapped_{false};
+    std::unique_ptr<unsigned char[]> heap_;
+};
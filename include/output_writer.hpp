@@ -0,0 +1,58 @@
+#pragma once
+
+#include <cstddef>
+#include <filesystem>
+#include <string>
+#include <vector>
+#include <opencv2/core.hpp>
+
+class ThreadPool;
+
+struct OutputOptions {
+    int jpeg_quality{95};     // same default as cv::imwrite
+    int tiff_tile{256};       // TIFF tile edge in pixels (multiple of 16)
+    bool force_bigtiff{false}; // BigTIFF even when a classic TIFF would fit in 4 GB
+    int thumbnail_dim{0};     // also write <stem>_thumb.jpg with max(width,height) <= this; 0 disables
+    unsigned threads{0};      // workers of the private pool used when none is passed; 0 = resolve_thread_count(0)
+};
+
+struct OutputReport {
+    std::string format;         // "jpeg(rst, N strips)", "tiff(tiled)", "bigtiff(tiled)", "imwrite" or "imencode"
+    std::size_t bytes{0};       // size of the written file
+    std::filesystem::path thumbnail; // empty unless a thumbnail was written
+};
+
+// Write 'image' (typically a crop view into the composited canvas; it is never
+// copied as a whole) to 'file', choosing the encoder from the extension:
+// - .jpg/.jpeg: strips of whole MCU rows are JPEG-encoded in parallel with a
+//   restart marker after every MCU row, then spliced into one baseline JPEG.
+// - .tif/.tiff: uncompressed RGB tiled TIFF, switching to BigTIFF past 4 GB;
+//   each row of tiles is prepared in parallel and streamed to disk.
+// - anything else: cv::imwrite.
+// Work runs on 'pool' (a private pool when null). Returns false and sets
+// error_message on failure.
+bool write_panorama(const cv::Mat& image,
+                    const std::filesystem::path& file,
+                    const OutputOptions& options,
+                    ThreadPool* pool,
+                    OutputReport* report,
+                    std::string& error_message);
+
+// Write '<file stem>_thumb.jpg' next to 'file': 'image' downscaled so that
+// max(width,height) <= max_dim. 'thumbnail' (if given) receives its path.
+// write_panorama() calls this for OutputOptions::thumbnail_dim.
+bool write_thumbnail(const cv::Mat& image,
+                     const std::filesystem::path& file,
+                     int max_dim,
+                     std::filesystem::path* thumbnail,
+                     std::string& error_message);
+
+// Same encoders into memory: 'ext' (".jpg", ".tif", ".png", ...) picks the format
+// and 'bytes' receives the file contents. No thumbnail is made.
+bool encode_panorama(const cv::Mat& image,
+                     const std::string& ext,
+                     const OutputOptions& options,
+                     ThreadPool* pool,
+                     std::vector<unsigned char>& bytes,
+                     OutputReport* report,
+                     std::string& error_message);
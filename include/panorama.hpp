@@ -0,0 +1,77 @@
+#pragma once
+
+#include <cstddef>
+#include <functional>
+#include <string>
+#include <vector>
+#include <opencv2/core.hpp>
+
+#include "pipeline.hpp"
+
+class ThreadPool;
+
+// In-memory stitching API of libpanorama: frames in, panorama out, nothing on disk.
+namespace panorama {
+
+enum class Stage { Decode, Register, Compose, Crop, Encode };
+
+// "decode", "register", "compose", "crop" or "encode".
+const char* stage_name(Stage stage);
+
+// Called as a stitch advances with 'done' of 'total' units of 'stage': frames for
+// Decode and Compose, 0 of 1 when the other stages start and 1 of 1 when they end.
+// Calls never overlap, but may come from worker threads. Return false to cancel:
+// the stitch stops at the next frame boundary (registration itself runs to its
+// end) and stitch() returns false with StitchResult::cancelled set.
+using ProgressCallback = std::function<bool(Stage stage, std::size_t done, std::size_t total)>;
+
+// One input frame: either already decoded or still encoded.
+struct InputFrame {
+    cv::Mat image;                      // 8-bit gray, BGR or BGRA frame, used as is (downscaled to max_dim)
+    std::vector<unsigned char> encoded; // or an encoded file: JPEG (decoded at a reduced DCT scale when
+                                        // max_dim allows), PNG, TIFF, HEIC/HEIF with OpenCV HEIF support
+    std::string name;                   // label used in error messages (optional)
+};
+
+// The subset of the command line options that applies to one in-memory stitch;
+// each has the meaning of the flag of the same name.
+struct StitchOptions {
+    std::string mode{"panorama"};      // --mode
+    int max_dim{1000};                 // --max-dim
+    std::string quality;               // --quality
+    std::string features;              // --features
+    int max_keypoints{-1};             // --max-keypoints
+    std::string match_region{"full"};  // --match-region
+    int match_window{0};               // --match-window
+    bool match_wrap{false};            // --match-wrap
+    std::size_t memory_budget_mb{0};   // --memory-budget; a disk-backed canvas, if needed, goes to the temp directory
+    std::string seam;                  // --seam
+    std::string exposure;              // --exposure
+    double seam_megapix{0.0};          // --seam-megapix
+    std::string crop{"heuristic"};     // --crop
+    bool preview{false};               // --preview settings (frames decoded at 640 px), without its files
+    std::string encode;                // also encode the result: ".jpg", ".tif", ".png", ...; empty to skip
+    int jpeg_quality{95};
+};
+
+struct StitchResult {
+    cv::Mat panorama;                    // cropped result; a view into the uncropped canvas
+    cv::Mat mask;                        // its valid-pixel mask (CV_8U, non-zero where composited)
+    std::vector<unsigned char> encoded;  // the encoded file when StitchOptions::encode is set
+    std::vector<int> registered;         // inputs that made it into the panorama, in canvas order
+    std::vector<std::string> warnings;   // frames that failed to decode, ignored options, ...
+    bool cancelled{false};
+    PipelineTimings timings;
+};
+
+// Stitch 'frames' (in capture order) with 'options'. Decoding and encoding run on
+// 'pool' (a private pool when null); registration and blending use OpenCV's threads.
+// Returns false and sets 'error_message' on failure or cancellation.
+bool stitch(const std::vector<InputFrame>& frames,
+            const StitchOptions& options,
+            StitchResult& result,
+            std::string& error_message,
+            const ProgressCallback& progress = ProgressCallback(),
+            ThreadPool* pool = nullptr);
+
+} // namespace panorama
@@ -1,9 +1,64 @@
 #pragma once
 
+#include <cstddef>
+#include <filesystem>
 #include <string>
 #include <vector>
 #include <opencv2/core.hpp>
 #include <opencv2/stitching.hpp>
+#include <opencv2/stitching/detail/camera.hpp>
+
+#include "compositor.hpp"
+#include "registration_cache.hpp"
+
+// Optional diagnostics filled in by OpenCVStitcher::stitch()/compose().
+struct StitchReport {
+    bool low_memory{false};     // the streaming compositor was used
+    CompositeReport composite;  // canvas/blender details (streaming compositor only)
+    cv::Mat result_mask;        // CV_8U valid-pixel mask of the output (non-zero where composited)
+};
+
+// Camera registration produced by OpenCVStitcher::estimate().
+struct Registration {
+    cv::Stitcher::Mode mode{cv::Stitcher::PANORAMA};
+    std::vector<int> indices;                      // input frames kept in the panorama
+    std::vector<cv::Size> full_sizes;              // full-resolution size of each kept frame
+    std::vector<cv::detail::CameraParams> cameras; // one per kept frame, in full-resolution pixel units
+};
+
+// Pairwise match graph of an input set, filled in by OpenCVStitcher::estimate_components().
+struct MatchGraph {
+    struct Edge {
+        int i;
+        int j;
+        double confidence;
+        int inliers;
+    };
+    float confidence_threshold{0.f}; // edges above this connect their frames
+    std::vector<Edge> edges;         // every matched pair (i < j) with a non-zero confidence
+    std::vector<int> component;      // per input frame: its registration, or -1 if left out
+};
+
+struct RegistrationPipeline;
+
+// Keypoint detector used for registration.
+enum class FeatureBackend { ORB, AKAZE, SIFT };
+
+// Registration features. The defaults are what cv::Stitcher uses (ORB at 0.6 MP).
+struct FeatureOptions {
+    FeatureBackend backend{FeatureBackend::ORB};
+    int max_keypoints{0};              // per image; 0 keeps the detector's own limit
+    int grid_cols{1};                  // the budget is shared out over a grid_cols x grid_rows grid
+    int grid_rows{1};
+    double registration_megapix{0.6};  // registration resolution, like cv::Stitcher::registrationResol()
+};
+
+// Feature settings for a --quality preset ("fast", "balanced" or "best").
+// Returns false and leaves 'options' alone for any other name.
+bool feature_preset(const std::string& quality, FeatureOptions& options);
+
+// "orb", "akaze" or "sift". SIFT falls back to AKAZE on OpenCV builds older than 4.4.
+bool parse_feature_backend(const std::string& name, FeatureBackend& backend);
 
 // Simple wrapper around OpenCV's Stitcher.
 class OpenCVStitcher {
@@ -17,17 +72,186 @@ public:
     bool stitch(const std::vector<cv::Mat>& images,
                 cv::Mat& output,
                 std::string& error_message,
-                cv::Stitcher::Mode mode = cv::Stitcher::PANORAMA) const;
+                cv::Stitcher::Mode mode = cv::Stitcher::PANORAMA,
+                StitchReport* report = nullptr) const;
+
+    // Two-phase API: register on low-resolution proxies, composite from full-resolution frames.
+    //
+    // estimate() runs features, matching and bundle adjustment on 'proxies'
+    // with the same components cv::Stitcher uses for 'mode'.
+    // full_sizes[i] is the full-resolution size proxies[i] was derived from; the
+    // resulting cameras are expressed in full-resolution pixel units.
+    // If 'sources' (the file each proxy was decoded from) is given and a cache
+    // directory is set, features, matches and cameras are reused across runs.
+    // 'graph' (if given) receives the pairwise confidences, with component 0 for
+    // the kept frames; it has no edges when the cameras come from the cache.
+    bool estimate(const std::vector<cv::Mat>& proxies,
+                  const std::vector<cv::Size>& full_sizes,
+                  Registration& registration,
+                  std::string& error_message,
+                  cv::Stitcher::Mode mode = cv::Stitcher::PANORAMA,
+                  const std::vector<std::filesystem::path>* sources = nullptr,
+                  MatchGraph* graph = nullptr) const;
+
+    // Partial registration: like estimate(), but every connected component of the
+    // match graph with at least two frames is registered on its own, in parallel,
+    // instead of keeping only the largest. 'components' is ordered by size, largest
+    // first; 'graph' receives the pairwise confidences and which component each
+    // frame ended up in. Returns false only if no component could be registered.
+    bool estimate_components(const std::vector<cv::Mat>& proxies,
+                             const std::vector<cv::Size>& full_sizes,
+                             std::vector<Registration>& components,
+                             MatchGraph& graph,
+                             std::string& error_message,
+                             cv::Stitcher::Mode mode = cv::Stitcher::PANORAMA,
+                             const std::vector<std::filesystem::path>* sources = nullptr) const;
+
+    // Incremental registration. 'previous' holds the cameras of frames stitched
+    // earlier, with indices referring to 'proxies'. Every other frame is matched
+    // only against its match-window neighbours; frames that connect to the
+    // panorama are solved by a local bundle adjustment together with the
+    // registered frames they overlap, then mapped into the existing panorama's
+    // frame so earlier cameras stay unchanged. 'registration' receives
+    // 'previous' with the new frames appended and 'added' their positions in it;
+    // frames that connect to nothing are left out.
+    bool extend(const std::vector<cv::Mat>& proxies,
+                const std::vector<cv::Size>& full_sizes,
+                const Registration& previous,
+                Registration& registration,
+                std::vector<std::size_t>& added,
+                std::string& error_message,
+                const std::vector<std::filesystem::path>* sources = nullptr) const;
+
+    // compose() streams the kept frames through 'load_frame' (indexed like
+    // registration.indices) and composites them at 'compose_scale' relative to
+    // full resolution, within the configured memory budget.
+    bool compose(const Registration& registration,
+                 const FrameLoader& load_frame,
+                 double compose_scale,
+                 cv::Mat& output,
+                 std::string& error_message,
+                 StitchReport* report = nullptr) const;
+
+    // Re-composite only the part of an existing canvas that the 'added' frames
+    // of 'registration' cover. 'canvas'/'canvas_mask' were composited at
+    // 'compose_scale' with projection focal 'warped_scale', and 'origin' is their
+    // top-left corner in warped coordinates. The new frames and the earlier
+    // frames overlapping them are composited again, spliced in with a feathered
+    // edge, and the canvas grows (moving 'origin') when the new frames extend it.
+    bool compose_region(const Registration& registration,
+                        const std::vector<std::size_t>& added,
+                        const FrameLoader& load_frame,
+                        double compose_scale,
+                        float warped_scale,
+                        cv::Mat& canvas,
+                        cv::Mat& canvas_mask,
+                        cv::Point& origin,
+                        std::string& error_message,
+                        StitchReport* report = nullptr) const;
 
     // Optional tuning knobs
     void set_confidence_threshold(float thresh) { confidence_thresh_ = thresh; }
     void set_wave_correction(bool enable) { do_wave_correct_ = enable; }
+    // Detect keypoints only inside 'region', given as fractions of each frame's
+    // width/height ((0, 0, 1, 1) searches the whole frame). Detection runs on a
+    // view of that region; no per-image masks are allocated.
+    void set_match_region(const cv::Rect2d& region) { match_region_ = region; }
     // Limit keypoint/search area to top half of the images
-    void set_top_match_only(bool enable) { top_match_only_ = enable; }
+    void set_top_match_only(bool enable) {
+        match_region_ = enable ? cv::Rect2d(0.0, 0.0, 1.0, 0.5) : cv::Rect2d(0.0, 0.0, 1.0, 1.0);
+    }
+    // Detector, per-image keypoint budget, grid and resolution used for registration.
+    // Binary descriptors (ORB, AKAZE) are matched by brute-force Hamming distance.
+    void set_features(const FeatureOptions& options) { features_ = options; }
+    // Fixed configuration tuned for latency rather than quality: registration on
+    // 0.1 MP proxies with a small ORB budget (replacing set_features()), and
+    // compositing without seam finding or exposure compensation, feather-blended.
+    void set_preview(bool enable);
+    // Seam finder, exposure compensator, and the resolution (megapixels) both run
+    // at. The defaults are cv::Stitcher's (graph-cut, block gains, 0.1 MP); setting
+    // any of them composites through the streaming compositor, which reports the
+    // time spent in each stage.
+    void set_seam_method(SeamMethod method) { seam_method_ = method; custom_compositing_ = true; }
+    void set_exposure_method(ExposureMethod method) { exposure_method_ = method; custom_compositing_ = true; }
+    void set_seam_megapix(double megapix) { seam_megapix_ = megapix; custom_compositing_ = true; }
+    // If bundle adjustment fails, drop up to 'n' weakly connected frames one by one and solve again
+    void set_max_dropped_frames(int n) { max_dropped_frames_ = n; }
+    // Composite one image at a time within this budget (0 keeps cv::Stitcher's in-RAM compositing)
+    void set_memory_budget_mb(std::size_t mb) { memory_budget_mb_ = mb; }
+    // Directory for the disk-backed canvas used when even a feather canvas exceeds the budget
+    void set_scratch_dir(const std::filesystem::path& dir) { scratch_dir_ = dir; }
+    // Match each image only against the 'k' images on either side of it in input
+    // (filename) order, i.e. pairs with |i-j| <= k. This is one step wider than
+    // cv::detail::BestOf2NearestRangeMatcher's range_width (j-i < k). 'wrap' also
+    // pairs the first and last frames of a 360 degree set. k <= 0 matches all pairs.
+    void set_match_window(int k, bool wrap = false) { match_window_ = k; match_wrap_ = wrap; }
+    // Size OpenCV's pool for feature detection, matching and compositing; 0 keeps
+    // the size in force. The pool is process-wide, so this suits one stitch at a time.
+    void set_stage_threads(unsigned features, unsigned matching, unsigned compose) {
+        features_threads_ = features;
+        matching_threads_ = matching;
+        compose_threads_ = compose;
+    }
+    // Persist registration work (features, matches, cameras) under 'dir'
+    void set_cache_dir(const std::filesystem::path& dir) { cache_ = RegistrationCache(dir); }
+    // Calls compose() makes to its FrameLoader per frame: two with a seam finder or
+    // exposure compensator (seam pass, then compose pass), one when the seam pass is skipped.
+    int frame_loads() const {
+        return seam_method_ != SeamMethod::None || exposure_method_ != ExposureMethod::None ? 2 : 1;
+    }
 
 private:
+    cv::Ptr<cv::Stitcher> create_stitcher(cv::Stitcher::Mode mode) const;
+    cv::Rect match_roi(const cv::Size& size) const;
+    bool full_match_region() const;
+    bool default_features() const;
+    bool binary_descriptors() const;
+    // Cache key parts: what the features depend on, and what the matches depend on as well
+    std::string feature_settings() const;
+    std::string registration_settings(cv::Stitcher::Mode mode) const;
+    bool uses_default_pipeline() const;
+    bool in_match_window(int i, int j, int n) const;
+    std::vector<std::string> feature_keys(const std::vector<cv::Mat>& proxies,
+                                          const std::vector<std::filesystem::path>* sources) const;
+    // Features at registration resolution inside the match region, one image per
+    // parallel task, reused from the cache when 'keys' is not empty; frames not
+    // flagged in 'wanted' (if given) are left without keypoints.
+    std::vector<cv::detail::ImageFeatures> find_features(const std::vector<cv::Mat>& proxies,
+                                                         double work_scale,
+                                                         const std::vector<std::string>& keys,
+                                                         const std::vector<char>* wanted = nullptr) const;
+    // Match the pairs flagged in the upper triangle of 'candidates', reusing cached pairs.
+    void match_pairs(const std::vector<cv::detail::ImageFeatures>& features,
+                     const cv::Ptr<cv::detail::FeaturesMatcher>& matcher,
+                     const cv::Mat_<uchar>& candidates,
+                     const std::vector<std::string>& keys,
+                     const std::string& settings,
+                     std::vector<cv::detail::MatchesInfo>& pairwise) const;
+    // Initial cameras and bundle adjustment for the frames 'local' (indices into 'features').
+    bool solve_local(const std::vector<int>& local,
+                     const std::vector<int>& known,
+                     const std::vector<cv::detail::ImageFeatures>& features,
+                     const std::vector<cv::detail::MatchesInfo>& pairwise,
+                     const RegistrationPipeline& pipe,
+                     std::vector<cv::detail::CameraParams>& cameras,
+                     std::string& error_message) const;
+
     float confidence_thresh_ = 0.6f; // default confidence for seam finder/matcher
     bool do_wave_correct_ = true;
-    bool top_match_only_ = false;
+    cv::Rect2d match_region_{0.0, 0.0, 1.0, 1.0}; // fractions of the frame searched for keypoints
+    std::size_t memory_budget_mb_ = 0;
+    std::filesystem::path scratch_dir_;
+    FeatureOptions features_;
+    int max_dropped_frames_ = 0;
+    bool preview_ = false;
+    SeamMethod seam_method_ = SeamMethod::GraphCut;
+    ExposureMethod exposure_method_ = ExposureMethod::BlockGains;
+    double seam_megapix_ = 0.1;
+    bool custom_compositing_ = false;
+    unsigned features_threads_ = 0;
+    unsigned matching_threads_ = 0;
+    unsigned compose_threads_ = 0;
+    int match_window_ = 0;
+    bool match_wrap_ = false;
+    RegistrationCache cache_;
 };
-
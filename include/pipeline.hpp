@@ -0,0 +1,55 @@
+#pragma once
+
+#include <cstddef>
+#include <filesystem>
+#include <iosfwd>
+#include <string>
+
+#include "cli.hpp"
+
+class ThreadPool;
+
+// --preview frames are loaded with this longest side (JPEGs decode at a reduced DCT scale)
+constexpr int kPreviewDim = 640;
+
+// Per-stage wall times of one pipeline run, in milliseconds.
+struct PipelineTimings {
+    double load_ms{0.0};
+    double register_ms{0.0}; // features, matching, bundle adjustment (the whole stitch when cv::Stitcher runs it)
+    double compose_ms{0.0};  // warp, seam, blend
+    double write_ms{0.0};    // trim + encode
+    double total_ms{0.0};
+};
+
+struct PipelineResult {
+    int exit_code{0};
+    std::string message;     // error text on failure, output path on success
+    std::size_t images{0};   // images loaded
+    std::string registration_attempt; // --retry: the fallback configuration that registered the set (empty if none was needed)
+    PipelineTimings timings;
+};
+
+// Shared resources and log sinks for a pipeline run.
+struct PipelineContext {
+    std::ostream* out{nullptr}; // progress messages (std::cout when null)
+    std::ostream* err{nullptr}; // warnings and errors (std::cerr when null)
+    ThreadPool* pool{nullptr};  // decode workers shared between runs (a private pool when null)
+    bool explicit_stages{false}; // register and compose as separate, profiled stages even when
+                                 // cv::Stitcher::stitch() would do (used by panorama_bench)
+};
+
+// Apply --numa-node/--cpus and --threads to the process. Call once at start-up,
+// before any worker thread exists: pinning the main thread then pins every pool
+// started later. --threads (or the number of CPUs pinned to) becomes the default
+// size of the project's pools and of OpenCV's. Returns false after printing the
+// reason to 'err_out' if the requested placement cannot be applied.
+bool configure_threads(const CLIOptions& opts, std::ostream& err_out);
+
+// Stitch every image in 'input_dir' into '<output_dir>/<opts.output_filename>':
+// HEIC conversion, loading, registration, compositing, trimming and writing.
+// Returns the process exit code main() reports (0 on success).
+int run_pipeline(const CLIOptions& opts,
+                 const std::filesystem::path& input_dir,
+                 const std::filesystem::path& output_dir,
+                 const PipelineContext& ctx = PipelineContext(),
+                 PipelineResult* result = nullptr);
@@ -0,0 +1,88 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <filesystem>
+#include <string>
+#include <vector>
+
+// Stage-level instrumentation for the pipeline.
+// Wrap a stage in PROFILE_SCOPE("name") and report quantities with
+// profiler::count("name", value); while the profiler is disabled (the default)
+// either costs one relaxed atomic load and records nothing.
+namespace profiler {
+
+// One completed scope, or one counter sample.
+struct Event {
+    enum class Kind { Scope, Counter };
+    Kind kind{Kind::Scope};
+    std::string name;
+    double start_us{0.0};          // since profiler::enable()
+    double wall_us{0.0};
+    double cpu_us{0.0};            // process CPU time (all threads) spent while the scope was open
+    std::size_t peak_rss_bytes{0}; // process peak RSS when the scope closed
+    unsigned thread{0};            // small sequential id of the recording thread
+    double value{0.0};             // counter value (Kind::Counter only)
+};
+
+namespace detail {
+extern std::atomic<bool> enabled;
+} // namespace detail
+
+inline bool enabled() { return detail::enabled.load(std::memory_order_relaxed); }
+
+// Start recording: drops previous events and resets the time origin.
+void enable();
+void disable();
+
+// Return the events recorded so far and clear them.
+std::vector<Event> take_events();
+
+// Write events as Chrome trace-event JSON (chrome://tracing, Perfetto).
+// Scopes become complete ("X") events, counters become counter ("C") tracks.
+bool write_chrome_trace(const std::filesystem::path& file,
+                        const std::vector<Event>& events,
+                        std::string* error_message = nullptr);
+
+void record_counter(const char* name, double value);
+
+// Record a counter sample (images, keypoints, matched pairs, bytes...).
+inline void count(const char* name, double value) {
+    if (enabled()) {
+        record_counter(name, value);
+    }
+}
+
+// Records the enclosing block as an Event when the profiler is enabled.
+class Scope {
+public:
+    explicit Scope(const char* name) : name_(name), active_(enabled()) {
+        if (active_) {
+            begin();
+        }
+    }
+    ~Scope() {
+        if (active_) {
+            end();
+        }
+    }
+
+    Scope(const Scope&) = delete;
+    Scope& operator=(const Scope&) = delete;
+
+private:
+    void begin();
+    void end();
+
+    const char* name_;
+    bool active_;
+    std::int64_t start_ns_{0};
+    double cpu_start_ms_{0.0};
+};
+
+} // namespace profiler
+
+#define PROFILE_CONCAT_INNER(a, b) a##b
+#define PROFILE_CONCAT(a, b) PROFILE_CONCAT_INNER(a, b)
+#define PROFILE_SCOPE(name) profiler::Scope PROFILE_CONCAT(profile_scope_, __LINE__)(name)
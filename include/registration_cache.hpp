@@ -0,0 +1,53 @@
+#pragma once
+
+#include <cstdint>
+#include <filesystem>
+#include <string>
+#include <vector>
+#include <opencv2/core.hpp>
+#include <opencv2/stitching/detail/camera.hpp>
+#include <opencv2/stitching/detail/matchers.hpp>
+
+// On-disk cache of registration work, stored under <dir>/features,
+// <dir>/matches and <dir>/cameras as compressed OpenCV FileStorage files.
+// - Features are keyed per image (file path, size, mtime, proxy size, settings).
+// - Matches are keyed per image pair, so changing one image only invalidates
+//   its own features and the pairs it takes part in.
+// - Cameras are keyed by the whole input set.
+// All writes go through a temporary file and a rename, so concurrent runs
+// sharing a cache never observe partial entries.
+class RegistrationCache {
+public:
+    RegistrationCache() = default;
+    explicit RegistrationCache(const std::filesystem::path& dir);
+
+    bool enabled() const { return !dir_.empty(); }
+    const std::filesystem::path& dir() const { return dir_; }
+
+    // Key identifying an input file's current contents: path, byte size and mtime,
+    // combined with 'settings' (anything else that changes the cached result).
+    static std::string file_key(const std::filesystem::path& p, const std::string& settings);
+    // Order-sensitive combination of several keys.
+    static std::string combine(const std::vector<std::string>& keys);
+
+    bool load_features(const std::string& key, cv::detail::ImageFeatures& features) const;
+    void save_features(const std::string& key, const cv::detail::ImageFeatures& features) const;
+
+    bool load_matches(const std::string& key, cv::detail::MatchesInfo& matches) const;
+    void save_matches(const std::string& key, const cv::detail::MatchesInfo& matches) const;
+
+    bool load_cameras(const std::string& key,
+                      std::vector<int>& indices,
+                      std::vector<cv::detail::CameraParams>& cameras) const;
+    void save_cameras(const std::string& key,
+                      const std::vector<int>& indices,
+                      const std::vector<cv::detail::CameraParams>& cameras) const;
+
+private:
+    std::filesystem::path entry_path(const char* kind, const std::string& key) const;
+
+    std::filesystem::path dir_;
+};
+
+// 64-bit FNV-1a hash of a string, used to build cache keys.
+std::uint64_t fnv1a64(const std::string& s);
@@ -0,0 +1,59 @@
+#pragma once
+
+#include <condition_variable>
+#include <cstddef>
+#include <functional>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <queue>
+#include <thread>
+#include <vector>
+
+// Resolve a requested worker count; 0 means the default set below, or one per
+// CPU the process may run on (see available_cpus()) when there is none.
+unsigned resolve_thread_count(unsigned requested);
+
+// Process-wide default for resolve_thread_count(0), e.g. from --threads; 0 clears it.
+void set_default_thread_count(unsigned count);
+
+// Fixed-size pool of worker threads fed from a FIFO task queue.
+class ThreadPool {
+public:
+    // num_threads == 0 uses resolve_thread_count(0).
+    explicit ThreadPool(unsigned num_threads = 0);
+    ~ThreadPool();
+
+    ThreadPool(const ThreadPool&) = delete;
+    ThreadPool& operator=(const ThreadPool&) = delete;
+
+    unsigned size() const { return static_cast<unsigned>(workers_.size()); }
+
+    // Queue a task; the returned future yields its result (or rethrows its exception).
+    template <typename F>
+    auto submit(F&& fn) -> std::future<decltype(fn())> {
+        using R = decltype(fn());
+        auto task = std::make_shared<std::packaged_task<R()>>(std::forward<F>(fn));
+        std::future<R> fut = task->get_future();
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            tasks_.emplace([task]() { (*task)(); });
+        }
+        cv_.notify_one();
+        return fut;
+    }
+
+    // Run fn(i) for every i in [0, count) and block until all calls finish.
+    // The calling thread takes part in the work. Must not be called from a
+    // task running on this pool. The first exception thrown is rethrown.
+    void parallel_for(std::size_t count, const std::function<void(std::size_t)>& fn);
+
+private:
+    void worker_loop();
+
+    std::vector<std::thread> workers_;
+    std::queue<std::function<void()>> tasks_;
+    std::mutex mutex_;
+    std::condition_variable cv_;
+    bool stopping_{false};
+};
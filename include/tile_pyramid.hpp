@@ -0,0 +1,35 @@
+#pragma once
+
+#include <cstddef>
+#include <filesystem>
+#include <string>
+#include <opencv2/core.hpp>
+
+class ThreadPool;
+
+struct TilePyramidOptions {
+    int tile_size{254};   // DeepZoom default: 254 + 2 * overlap = 256 px tiles
+    int overlap{1};
+    int jpeg_quality{90};
+    unsigned threads{0};  // workers of the private pool used when none is passed; 0 = resolve_thread_count(0)
+};
+
+struct TilePyramidReport {
+    int levels{0};
+    std::size_t tiles{0};
+    std::filesystem::path descriptor; // the .dzi file
+};
+
+// Write 'image' as a DeepZoom pyramid: '<dir>/<name>.dzi' plus
+// '<dir>/<name>_files/<level>/<column>_<row>.jpg'. The full-resolution level is
+// tiled straight from 'image' (no copy); each lower level is derived from the
+// one above by 2x INTER_AREA downsampling. Tiles of a level are encoded in
+// parallel on 'pool' (a private pool when null). Returns false and sets
+// error_message on failure.
+bool write_deepzoom(const cv::Mat& image,
+                    const std::filesystem::path& dir,
+                    const std::string& name,
+                    const TilePyramidOptions& options,
+                    ThreadPool* pool,
+                    TilePyramidReport* report,
+                    std::string& error_message);
@@ -1,5 +1,6 @@
 #pragma once
 
+#include <cstddef>
 #include <filesystem>
 #include <string>
 #include <opencv2/core.hpp>
@@ -9,33 +10,52 @@ namespace utils {
 // Returns true if the path has a HEIC/HEIF extension (case-insensitive).
 bool is_heic_file(const std::filesystem::path& p);
 
-// Convert a single .HEIC/.HEIF file to .jpg in the same directory.
-// - Writes <basename>.jpg next to the source.
-// - On success, removes the original HEIC file.
-// - Returns true on success; false on failure and sets error_message (if provided).
-// - On success, out_jpg_path (if provided) is set to the resulting file path.
-bool convert_heic_to_jpg(const std::filesystem::path& heic_path,
-                         std::filesystem::path* out_jpg_path = nullptr,
-                         int jpg_quality = 95,
-                         std::string* error_message = nullptr);
-
-// Convert all HEIC/HEIF files in a directory (non-recursive by default).
-// - Returns the number of files successfully converted.
-// - If recursive is true, it will traverse subdirectories.
-// - Aggregates a brief report into 'report' if provided.
-std::size_t convert_heic_to_jpg_in_dir(const std::filesystem::path& dir,
-                                       int jpg_quality = 95,
-                                       bool recursive = false,
-                                       std::string* report = nullptr);
-
-// Trim nearly-black horizontal bands from the top and bottom of an image.
+// Bounds of the image content left after trimming nearly-black bands from all four borders.
 // - black_threshold: pixel intensity (0-255) below/eq which a pixel is considered black.
-// - black_pixel_ratio_threshold: if >= this fraction of pixels in a row are black, the row is treated as black.
+// - black_pixel_ratio_threshold: if >= this fraction of pixels in a row/column are black, it is treated as black.
 // - extra_crop: additional pixels to crop inside the detected bounds for safety.
-// Returns a cropped copy if trimming was applied; otherwise returns a copy of the input.
+// - valid_mask: optional CV_8UC1 mask of 'input' (e.g. the stitcher's result mask);
+//   when given, pixels where it is 0 count as black instead of testing intensity.
+// Works directly on 8-bit gray/BGR/BGRA input in a single pass. Returns the full
+// image rectangle if nothing (or everything) would be trimmed.
+cv::Rect find_content_rect(const cv::Mat& input,
+                           int black_threshold = 20,
+                           double black_pixel_ratio_threshold = 0.10,
+                           int extra_crop = 1,
+                           const cv::Mat& valid_mask = cv::Mat());
+
+// Trim nearly-black bands from the borders of an image (see find_content_rect).
+// Returns a cropped copy, or a view into 'input' when 'copy' is false.
 cv::Mat trim_black_bands(const cv::Mat& input,
                                     int black_threshold = 20,
                                     double black_pixel_ratio_threshold = 0.10,
-                                    int extra_crop = 1);
+                                    int extra_crop = 1,
+                                    const cv::Mat& valid_mask = cv::Mat(),
+                                    bool copy = true);
+
+// Largest axis-aligned rectangle containing only non-zero pixels of a CV_8UC1 mask
+// (e.g. the stitcher's valid-pixel mask). O(rows*cols) time, O(cols) extra memory.
+// Returns an empty rectangle if the mask has no non-zero pixel.
+cv::Rect largest_inscribed_rect(const cv::Mat& mask);
+
+// Rectangle of 'pano' kept by a --crop mode:
+// - "mask": largest rectangle fully covered by 'result_mask' (the stitcher's valid-pixel
+//   mask); falls back to "heuristic" and sets 'warning' when there is no such mask
+// - "heuristic": trim bands that are mostly black; pixels outside 'result_mask' count as black
+// - anything else ("none"): the whole canvas
+cv::Rect crop_rect(const cv::Mat& pano,
+                   const cv::Mat& result_mask,
+                   const std::string& crop,
+                   std::string* warning = nullptr);
+
+// 's' as a quoted JSON string: quotes and backslashes are escaped, and so are
+// control characters (below 0x20, as \u00XX), e.g. in file names.
+std::string json_string(const std::string& s);
+
+// Peak resident set size of the current process in bytes (0 if unavailable).
+std::size_t peak_rss_bytes();
+
+// User + system CPU time consumed by all threads of the current process, in milliseconds.
+double process_cpu_ms();
 
 } // namespace utils
@@ -0,0 +1,46 @@
+#pragma once
+
+#include <cstddef>
+#include <filesystem>
+#include <string>
+#include <vector>
+#include <opencv2/core.hpp>
+
+struct KeyframeOptions {
+    int max_dim{1000};        // selected frames are downscaled so max(width,height) <= max_dim (0 keeps full size)
+    int proxy_dim{320};       // motion and sharpness are measured on grayscale proxies this large
+    double overlap{0.5};      // aim for this overlap (fraction of the frame) between consecutive keyframes
+    double blur_ratio{0.6};   // a frame is blurry below this fraction of the running sharpness average
+};
+
+struct Keyframe {
+    cv::Mat image;            // downscaled to KeyframeOptions::max_dim
+    cv::Size original_size;   // size in the video stream
+    int frame_index{0};
+    double timestamp_ms{0.0};
+    double sharpness{0.0};    // variance of the Laplacian of the proxy
+};
+
+struct VideoStats {
+    std::size_t frames{0};          // frames decoded
+    std::size_t blurry_rejected{0}; // frames passed over as keyframes because they were blurry
+    double fps{0.0};                // as reported by the container (0 if unknown)
+    double wall_ms{0.0};
+};
+
+// Stream 'video' through cv::VideoCapture and keep only the frames worth stitching.
+// - Motion is tracked frame to frame by phase correlation on small proxies; a
+//   keyframe is taken once the view has moved by (1 - overlap) of the frame since
+//   the previous one.
+// - Blurry frames (variance of the Laplacian well below the running average) are
+//   skipped; if the view moves on too far while waiting for a sharp frame, the
+//   sharpest frame seen meanwhile is taken instead.
+// - The first frame is always kept, and the end of the sweep is covered by a last
+//   keyframe if needed.
+// Only the keyframes (downscaled) and one pending candidate are held in memory.
+// Returns false and sets 'error_message' if the video cannot be opened or has no frames.
+bool extract_keyframes(const std::filesystem::path& video,
+                       const KeyframeOptions& options,
+                       std::vector<Keyframe>& keyframes,
+                       VideoStats* stats,
+                       std::string& error_message);
@@ -0,0 +1,18 @@
+#pragma once
+
+#include "cli.hpp"
+
+// Long-running watch mode: stitch capture sets as they land under opts.watch_root.
+// - A capture set is any directory under the root that contains images (see
+//   find_capture_dirs); its output goes to the matching subdirectory of
+//   opts.output_dir, as in batch mode.
+// - A new or changed set is queued once none of its images has changed for
+//   opts.watch_settle_s seconds. On Linux inotify wakes the scanner as soon as
+//   files are written; elsewhere the tree is polled once per second.
+// - opts.batch_jobs runners take queued sets in arrival order. Every job runs in
+//   this process on one shared decode pool, so OpenCV initialisation and the
+//   worker threads are paid once instead of once per set.
+// - <output>/watch_status.json is rewritten (atomically) whenever the queue
+//   changes: queue depth, running jobs, totals and the latency of recent jobs.
+// Runs until SIGINT/SIGTERM, lets running jobs finish, and returns 0.
+int run_watch(const CLIOptions& opts);
@@ -1,14 +1,12 @@
 #include <iostream>
 #include <string>
-#include <vector>
 #include <filesystem>
-#include <opencv2/imgcodecs.hpp>
-#include <opencv2/imgproc.hpp>
 
+#include "batch.hpp"
 #include "cli.hpp"
-#include "image_io.hpp"
-#include "panorama_stitcher.hpp"
-#include "utils.hpp"
+#include "pipeline.hpp"
+#include "profiler.hpp"
+#include "watch.hpp"
 
 namespace fs = std::filesystem;
 
@@ -21,106 +19,38 @@ int main(int argc, char** argv) {
     }
 
     try {
-        // Resolve and validate paths
-        fs::path inputDir = opts.input_dir.empty() ? fs::path("images") : fs::path(opts.input_dir);
-        fs::path outputDir = opts.output_dir.empty() ? fs::path("output") : fs::path(opts.output_dir);
-
-        // Check input directory exists
-        if (!fs::exists(inputDir) || !fs::is_directory(inputDir)) {
-            std::cerr << "Input directory does not exist or is not a directory: " << inputDir << "\n";
-            return 2;
-        }
-
-        // Create output directory if it doesn't exist
-        if (!fs::exists(outputDir)) {
-            std::error_code ec;
-            fs::create_directories(outputDir, ec);
-            if (ec) {
-                std::cerr << "Failed to create output directory: " << outputDir << " (" << ec.message() << ")\n";
-                return 3;
-            }
-        }
-
-        // Convert any HEIC/HEIF images to JPG first (non-recursive)
-        int jpgQuality = 95;
-        std::string report;
-        std::size_t converted = utils::convert_heic_to_jpg_in_dir(inputDir, jpgQuality, false, &report);
-        if (converted > 0) {
-            std::cout << "Converted " << converted << " HEIC image(s) to JPG in '" << inputDir << "'\n";
-        }
-        if (!report.empty()) {
-            std::cout << report; // include per-file results
-        }
-
-        // Gather images
-        std::vector<fs::path> imagePaths = list_image_files(inputDir);
-        if (imagePaths.empty()) {
-            std::cerr << "No images found in: " << inputDir << "\n";
-            return 4;
-        }
-
-        // Load images
-        std::vector<cv::Mat> images;
-        images.reserve(imagePaths.size());
-        for (const auto& p : imagePaths) {
-            cv::Mat img = cv::imread(p.string(), cv::IMREAD_COLOR);
-            if (img.empty()) {
-                std::cerr << "Warning: failed to load image: " << p << "\n";
-                continue;
+        // Placement and thread counts first, before any pool starts a thread
+        if (!configure_threads(opts, std::cerr)) {
+            return 1;
+        }
+        if (!opts.profile_file.empty()) {
+            profiler::enable();
+        }
+
+        int code;
+        if (!opts.batch_root.empty()) {
+            // Batch mode: every capture directory under the root, in one process
+            code = run_batch(opts);
+        } else if (!opts.watch_root.empty()) {
+            // Watch mode: stay resident and stitch capture sets as they arrive
+            code = run_watch(opts);
+        } else {
+            // Resolve paths and run the single-set pipeline
+            fs::path inputDir = opts.input_dir.empty() ? fs::path("images") : fs::path(opts.input_dir);
+            fs::path outputDir = opts.output_dir.empty() ? fs::path("output") : fs::path(opts.output_dir);
+            code = run_pipeline(opts, inputDir, outputDir);
+        }
+
+        if (!opts.profile_file.empty()) {
+            profiler::disable();
+            std::string err;
+            if (profiler::write_chrome_trace(opts.profile_file, profiler::take_events(), &err)) {
+                std::cout << "Profile written to: " << opts.profile_file << "\n";
+            } else {
+                std::cerr << "Failed to write profile: " << err << "\n";
             }
-            // Optional downscale to limit memory and speed up
-            if (opts.max_dim > 0) {
-                int w = img.cols, h = img.rows;
-                int m = std::max(w, h);
-                if (m > opts.max_dim) {
-                    double scale = static_cast<double>(opts.max_dim) / static_cast<double>(m);
-                    cv::resize(img, img, cv::Size(), scale, scale, cv::INTER_AREA);
-                }
-            }
-            images.emplace_back(std::move(img));
-        }
-        if (images.empty()) {
-            std::cerr << "Failed to load any images from: " << inputDir << "\n";
-            return 5;
-        }
-
-        // If only one image provided, save it directly as the panorama
-        fs::path outFile = outputDir / (opts.output_filename.empty() ? fs::path("panorama.jpg") : fs::path(opts.output_filename));
-        if (images.size() == 1) {
-            if (!cv::imwrite(outFile.string(), images.front())) {
-                std::cerr << "Failed to save output image to: " << outFile << "\n";
-                return 6;
-            }
-            std::cout << "Only one image provided; copied to output: " << outFile << "\n";
-            return 0;
         }
-
-        // Stitch panorama
-        cv::Mat pano;
-        std::string err;
-        OpenCVStitcher stitcher;
-        stitcher.set_top_match_only(opts.top_match_only);
-        cv::Stitcher::Mode mode = (opts.mode == "scans") ? cv::Stitcher::SCANS : cv::Stitcher::PANORAMA;
-        if (!stitcher.stitch(images, pano, err, mode)) {
-            std::cerr << "Stitching failed: " << err << "\n";
-            return 7;
-        }
-
-        // Trim black bands from result
-        int blackThresh = 5;                // Threshold for black pixel detection
-        double blackPixelRatio = 0.05;   // % of black pixels in the row/col to trim it
-        int trimExtra = 1;                  // Safety trim
-        cv::Mat trimmed = utils::trim_black_bands(pano, blackThresh, blackPixelRatio, trimExtra);
-
-        // Save result
-        if (!cv::imwrite(outFile.string(), trimmed)) {
-            std::cerr << "Failed to save panorama to: " << outFile << "\n";
-            return 8;
-        }
-        
-        // Success
-        std::cout << "Panorama saved to: " << outFile << "\n";
-        return 0;
+        return code;
     } catch (const std::exception& ex) {
         std::cerr << "Unhandled exception: " << ex.what() << "\n";
         return 100;
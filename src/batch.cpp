@@ -0,0 +1,237 @@
+#include "batch.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <fstream>
+#include <iostream>
+#include <mutex>
+#include <sstream>
+#include <string>
+#include <thread>
+
+#include "image_io.hpp"
+#include "pipeline.hpp"
+#include "thread_pool.hpp"
+#include "utils.hpp"
+
+namespace fs = std::filesystem;
+
+namespace {
+
+// Rough multiple of the decoded input size a stitch holds at its peak
+// (registration copies, warped frames, canvas) when no memory budget caps compositing.
+constexpr double kStitchOverhead = 4.0;
+
+// Counting gate over megabytes: a job waits until its estimate fits next to the
+// jobs already running. A job larger than the whole limit runs alone.
+class MemoryGate {
+public:
+    explicit MemoryGate(std::size_t limit_mb) : limit_mb_(limit_mb) {}
+
+    void acquire(std::size_t mb) {
+        if (limit_mb_ == 0) {
+            return;
+        }
+        std::unique_lock<std::mutex> lock(mutex_);
+        cv_.wait(lock, [&]() { return used_mb_ == 0 || used_mb_ + mb <= limit_mb_; });
+        used_mb_ += mb;
+    }
+
+    void release(std::size_t mb) {
+        if (limit_mb_ == 0) {
+            return;
+        }
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            used_mb_ -= std::min(mb, used_mb_);
+        }
+        cv_.notify_all();
+    }
+
+private:
+    std::size_t limit_mb_;
+    std::size_t used_mb_{0};
+    std::mutex mutex_;
+    std::condition_variable cv_;
+};
+
+struct BatchJob {
+    fs::path input;
+    fs::path output;
+    std::size_t estimated_mb{0};
+    PipelineResult result;
+};
+
+std::size_t estimate_job_mb(const CLIOptions& opts, const fs::path& dir) {
+    const int dim = opts.register_dim > 0 ? opts.register_dim : opts.max_dim;
+    double decoded_bytes = 0.0;
+    for (const auto& p : list_image_files(dir)) {
+        cv::Size sz;
+        double px;
+        if (read_jpeg_size(p, sz)) {
+            px = static_cast<double>(sz.area());
+            const int m = std::max(sz.width, sz.height);
+            if (dim > 0 && m > dim) {
+                px *= (static_cast<double>(dim) / m) * (static_cast<double>(dim) / m);
+            }
+        } else {
+            // Lossless formats decode to roughly a few times their file size;
+            // HEIC/HEIF compresses to about a third of a byte per pixel
+            std::error_code ec;
+            px = static_cast<double>(fs::file_size(p, ec)) * (utils::is_heic_file(p) ? 6.0 : 4.0 / 3.0);
+            if (dim > 0) {
+                px = std::min(px, static_cast<double>(dim) * dim);
+            }
+        }
+        decoded_bytes += px * 3.0;
+    }
+    double total = decoded_bytes * kStitchOverhead;
+    if (opts.memory_budget_mb > 0) {
+        total = decoded_bytes * 2.0 + static_cast<double>(opts.memory_budget_mb) * 1024.0 * 1024.0;
+    }
+    return static_cast<std::size_t>(total / (1024.0 * 1024.0)) + 1;
+}
+
+std::string csv_field(const std::string& s) {
+    std::string out = "\"";
+    for (char c : s) {
+        if (c == '"') {
+            out += '"';
+        }
+        out += c;
+    }
+    out += '"';
+    return out;
+}
+
+void write_summary(const fs::path& file, const std::vector<BatchJob>& jobs) {
+    std::ofstream csv(file);
+    csv << "input,output,status,exit_code,images,estimated_mb,load_ms,register_ms,compose_ms,write_ms,total_ms,retry,message\n";
+    for (const auto& j : jobs) {
+        const PipelineTimings& t = j.result.timings;
+        csv << csv_field(j.input.string()) << ',' << csv_field(j.output.string()) << ','
+            << (j.result.exit_code == 0 ? "ok" : "failed") << ',' << j.result.exit_code << ','
+            << j.result.images << ',' << j.estimated_mb << ','
+            << t.load_ms << ',' << t.register_ms << ',' << t.compose_ms << ',' << t.write_ms << ','
+            << t.total_ms << ',' << csv_field(j.result.registration_attempt) << ','
+            << csv_field(j.result.message) << '\n';
+    }
+}
+
+} // namespace
+
+std::vector<fs::path> find_capture_dirs(const fs::path& root) {
+    std::vector<fs::path> dirs;
+    if (!fs::exists(root) || !fs::is_directory(root)) {
+        return dirs;
+    }
+    if (!list_image_files(root).empty()) {
+        dirs.push_back(root);
+    }
+    std::error_code ec;
+    for (auto it = fs::recursive_directory_iterator(root, fs::directory_options::skip_permission_denied, ec);
+         it != fs::recursive_directory_iterator(); it.increment(ec)) {
+        if (ec) {
+            break;
+        }
+        if (it->is_directory() && !list_image_files(it->path()).empty()) {
+            dirs.push_back(it->path());
+        }
+    }
+    std::sort(dirs.begin(), dirs.end());
+    return dirs;
+}
+
+int run_batch(const CLIOptions& opts) {
+    const fs::path root(opts.batch_root);
+    const fs::path outRoot = opts.output_dir.empty() ? fs::path("output") : fs::path(opts.output_dir);
+
+    std::vector<fs::path> dirs = find_capture_dirs(root);
+    // Never treat our own outputs as capture sets when the output root sits inside the batch root
+    const fs::path outCanon = fs::weakly_canonical(outRoot);
+    dirs.erase(std::remove_if(dirs.begin(), dirs.end(), [&](const fs::path& d) {
+        fs::path rel = fs::weakly_canonical(d).lexically_relative(outCanon);
+        return !rel.empty() && *rel.begin() != "..";
+    }), dirs.end());
+    if (dirs.empty()) {
+        std::cerr << "No image directories found under: " << root << "\n";
+        return 4;
+    }
+
+    // Split the memory limit between concurrent jobs for compositing unless a budget was given
+    const unsigned jobLimit = static_cast<unsigned>(std::max(1, opts.batch_jobs));
+    CLIOptions jobOpts = opts;
+    if (opts.batch_memory_mb > 0 && opts.memory_budget_mb == 0) {
+        jobOpts.memory_budget_mb = std::max<std::size_t>(1, opts.batch_memory_mb / jobLimit);
+    }
+
+    std::vector<BatchJob> jobs(dirs.size());
+    for (std::size_t i = 0; i < dirs.size(); ++i) {
+        jobs[i].input = dirs[i];
+        fs::path rel = fs::relative(dirs[i], root);
+        jobs[i].output = (rel.empty() || rel == ".") ? outRoot : outRoot / rel;
+        jobs[i].estimated_mb = estimate_job_mb(jobOpts, dirs[i]);
+    }
+    std::cout << "Batch: " << jobs.size() << " capture set(s), up to " << jobLimit << " concurrent job(s)";
+    if (opts.batch_memory_mb > 0) {
+        std::cout << ", memory limit " << opts.batch_memory_mb << " MB";
+    }
+    std::cout << "\n";
+
+    // One decode pool (sized by the decode budget) and one OpenCV thread pool for every job in the process
+    ThreadPool pool(opts.stage_threads.decode);
+    MemoryGate gate(opts.batch_memory_mb);
+    std::mutex logMutex;
+    std::atomic<std::size_t> next{0};
+
+    auto worker = [&]() {
+        for (;;) {
+            std::size_t i = next.fetch_add(1);
+            if (i >= jobs.size()) {
+                return;
+            }
+            BatchJob& job = jobs[i];
+            gate.acquire(job.estimated_mb);
+
+            std::ostringstream log;
+            PipelineContext ctx;
+            ctx.out = &log;
+            ctx.err = &log;
+            ctx.pool = &pool;
+            run_pipeline(jobOpts, job.input, job.output, ctx, &job.result);
+            gate.release(job.estimated_mb);
+
+            // Print the job's log in one piece so concurrent jobs do not interleave
+            std::lock_guard<std::mutex> lock(logMutex);
+            std::istringstream lines(log.str());
+            std::string line;
+            const std::string tag = "[" + job.input.string() + "] ";
+            while (std::getline(lines, line)) {
+                std::cout << tag << line << "\n";
+            }
+            std::cout << tag << (job.result.exit_code == 0 ? "done" : "FAILED") << " in "
+                      << job.result.timings.total_ms << " ms\n";
+        }
+    };
+
+    std::vector<std::thread> runners;
+    const unsigned runnerCount = std::min<unsigned>(jobLimit, static_cast<unsigned>(jobs.size()));
+    for (unsigned r = 0; r < runnerCount; ++r) {
+        runners.emplace_back(worker);
+    }
+    for (auto& t : runners) {
+        t.join();
+    }
+
+    std::error_code ec;
+    fs::create_directories(outRoot, ec);
+    fs::path summary = outRoot / "batch_summary.csv";
+    write_summary(summary, jobs);
+
+    std::size_t failed = std::count_if(jobs.begin(), jobs.end(),
+                                       [](const BatchJob& j) { return j.result.exit_code != 0; });
+    std::cout << "Batch finished: " << (jobs.size() - failed) << " succeeded, " << failed
+              << " failed. Summary: " << summary << "\n";
+    return failed == 0 ? 0 : 9;
+}
@@ -1,12 +1,75 @@
 #include "cli.hpp"
+#include "cpu_affinity.hpp"
 
 #include <iostream>
+#include <sstream>
 #include <vector>
 
 static bool is_flag(const std::string& s, const char* shortf, const char* longf) {
     return s == shortf || s == longf;
 }
 
+bool parse_match_region(const std::string& spec, double& x, double& y, double& w, double& h) {
+    if (spec == "full") {
+        x = 0.0, y = 0.0, w = 1.0, h = 1.0;
+        return true;
+    }
+    if (spec == "top") {
+        x = 0.0, y = 0.0, w = 1.0, h = 0.5;
+        return true;
+    }
+    if (spec == "horizon") {
+        // Middle band: the horizon in a level sweep, away from sky and foreground
+        x = 0.0, y = 0.25, w = 1.0, h = 0.5;
+        return true;
+    }
+    std::istringstream in(spec);
+    char c1 = 0, c2 = 0, c3 = 0;
+    if (!(in >> x >> c1 >> y >> c2 >> w >> c3 >> h) || c1 != ',' || c2 != ',' || c3 != ',' || !in.eof()) {
+        return false;
+    }
+    const double eps = 1e-9;
+    return x >= 0.0 && y >= 0.0 && w > 0.0 && h > 0.0 && x + w <= 1.0 + eps && y + h <= 1.0 + eps;
+}
+
+bool parse_stage_threads(const std::string& spec, StageThreads& stages) {
+    StageThreads parsed = stages;
+    std::istringstream in(spec);
+    std::string item;
+    bool any = false;
+    while (std::getline(in, item, ',')) {
+        const std::size_t eq = item.find('=');
+        if (eq == std::string::npos) {
+            return false;
+        }
+        const std::string stage = item.substr(0, eq);
+        const std::string count = item.substr(eq + 1);
+        if (count.empty() || count.find_first_not_of("0123456789") != std::string::npos || count.size() > 4) {
+            return false;
+        }
+        const unsigned n = static_cast<unsigned>(std::stoul(count));
+        if (stage == "decode") {
+            parsed.decode = n;
+        } else if (stage == "features") {
+            parsed.features = n;
+        } else if (stage == "matching") {
+            parsed.matching = n;
+        } else if (stage == "compose") {
+            parsed.compose = n;
+        } else if (stage == "encode") {
+            parsed.encode = n;
+        } else {
+            return false;
+        }
+        any = true;
+    }
+    if (!any) {
+        return false;
+    }
+    stages = parsed;
+    return true;
+}
+
 CLIOptions parse_cli(int argc, char** argv) {
     CLIOptions opts;
     std::vector<std::string> args(argv + 1, argv + argc);
@@ -35,6 +98,256 @@ CLIOptions parse_cli(int argc, char** argv) {
             }
         } else if (a == "--top-match-only") {
             opts.top_match_only = true;
+            opts.match_region = "top";
+        } else if (a == "--match-region") {
+            if (i + 1 < args.size()) {
+                opts.match_region = args[++i];
+                double x, y, w, h;
+                if (!parse_match_region(opts.match_region, x, y, w, h)) {
+                    std::cerr << "Invalid value for --match-region (use 'full', 'top', 'horizon' or x,y,w,h in [0,1])\n";
+                    opts.match_region = "full";
+                }
+            } else {
+                std::cerr << "Missing value for --match-region\n";
+            }
+        } else if (a == "--video") {
+            if (i + 1 < args.size()) {
+                opts.video = args[++i];
+            } else {
+                std::cerr << "Missing value for --video\n";
+            }
+        } else if (a == "--video-overlap") {
+            if (i + 1 < args.size()) {
+                try {
+                    opts.video_overlap = std::stod(args[++i]);
+                } catch (...) {
+                    std::cerr << "Invalid number for --video-overlap\n";
+                }
+                if (opts.video_overlap <= 0.0 || opts.video_overlap >= 1.0) {
+                    std::cerr << "Invalid value for --video-overlap (use a fraction between 0 and 1)\n";
+                    opts.video_overlap = 0.5;
+                }
+            } else {
+                std::cerr << "Missing value for --video-overlap\n";
+            }
+        } else if (a == "--quality") {
+            if (i + 1 < args.size()) {
+                opts.quality = args[++i];
+                if (opts.quality != "fast" && opts.quality != "balanced" && opts.quality != "best") {
+                    std::cerr << "Invalid value for --quality (use 'fast', 'balanced' or 'best')\n";
+                    opts.quality.clear();
+                }
+            } else {
+                std::cerr << "Missing value for --quality\n";
+            }
+        } else if (a == "--features") {
+            if (i + 1 < args.size()) {
+                opts.features = args[++i];
+                if (opts.features != "orb" && opts.features != "akaze" && opts.features != "sift") {
+                    std::cerr << "Invalid value for --features (use 'orb', 'akaze' or 'sift')\n";
+                    opts.features.clear();
+                }
+            } else {
+                std::cerr << "Missing value for --features\n";
+            }
+        } else if (a == "--max-keypoints") {
+            if (i + 1 < args.size()) {
+                try {
+                    opts.max_keypoints = std::stoi(args[++i]);
+                } catch (...) {
+                    std::cerr << "Invalid integer for --max-keypoints\n";
+                }
+            } else {
+                std::cerr << "Missing value for --max-keypoints\n";
+            }
+        } else if (a == "--partial") {
+            opts.partial = true;
+        } else if (a == "--retry") {
+            opts.retry = true;
+        } else if (a == "--preview") {
+            opts.preview = true;
+        } else if (a == "--retry-budget") {
+            if (i + 1 < args.size()) {
+                try {
+                    opts.retry_budget_s = std::stod(args[++i]);
+                } catch (...) {
+                    std::cerr << "Invalid number for --retry-budget\n";
+                }
+            } else {
+                std::cerr << "Missing value for --retry-budget\n";
+            }
+        } else if (a == "--cache") {
+            opts.use_cache = true;
+        } else if (a == "--heic-cache") {
+            opts.heic_cache = true;
+        } else if (a == "--incremental") {
+            opts.incremental = true;
+        } else if (a == "--match-wrap") {
+            opts.match_wrap = true;
+        } else if (a == "--match-window") {
+            if (i + 1 < args.size()) {
+                try {
+                    opts.match_window = std::stoi(args[++i]);
+                } catch (...) {
+                    std::cerr << "Invalid integer for --match-window\n";
+                }
+            } else {
+                std::cerr << "Missing value for --match-window\n";
+            }
+        } else if (a == "--seam") {
+            if (i + 1 < args.size()) {
+                opts.seam = args[++i];
+                if (opts.seam != "graphcut" && opts.seam != "dp" && opts.seam != "voronoi" && opts.seam != "none") {
+                    std::cerr << "Invalid value for --seam (use 'graphcut', 'dp', 'voronoi' or 'none')\n";
+                    opts.seam.clear();
+                }
+            } else {
+                std::cerr << "Missing value for --seam\n";
+            }
+        } else if (a == "--exposure") {
+            if (i + 1 < args.size()) {
+                opts.exposure = args[++i];
+                if (opts.exposure != "blocks" && opts.exposure != "gain" && opts.exposure != "channels" &&
+                    opts.exposure != "none") {
+                    std::cerr << "Invalid value for --exposure (use 'blocks', 'gain', 'channels' or 'none')\n";
+                    opts.exposure.clear();
+                }
+            } else {
+                std::cerr << "Missing value for --exposure\n";
+            }
+        } else if (a == "--seam-megapix") {
+            if (i + 1 < args.size()) {
+                try {
+                    opts.seam_megapix = std::stod(args[++i]);
+                } catch (...) {
+                    std::cerr << "Invalid number for --seam-megapix\n";
+                }
+                if (opts.seam_megapix < 0.0) {
+                    std::cerr << "Invalid value for --seam-megapix (use a positive number of megapixels)\n";
+                    opts.seam_megapix = 0.0;
+                }
+            } else {
+                std::cerr << "Missing value for --seam-megapix\n";
+            }
+        } else if (a == "--crop") {
+            if (i + 1 < args.size()) {
+                opts.crop = args[++i];
+                if (opts.crop != "mask" && opts.crop != "heuristic" && opts.crop != "none") {
+                    std::cerr << "Invalid value for --crop (use 'mask', 'heuristic' or 'none')\n";
+                    opts.crop = "heuristic";
+                }
+            } else {
+                std::cerr << "Missing value for --crop\n";
+            }
+        } else if (a == "--thumbnail") {
+            if (i + 1 < args.size()) {
+                try {
+                    opts.thumbnail_dim = std::stoi(args[++i]);
+                } catch (...) {
+                    std::cerr << "Invalid integer for --thumbnail\n";
+                }
+            } else {
+                std::cerr << "Missing value for --thumbnail\n";
+            }
+        } else if (a == "--tiles") {
+            if (i + 1 < args.size()) {
+                opts.tiles_dir = args[++i];
+            } else {
+                std::cerr << "Missing value for --tiles\n";
+            }
+        } else if (a == "--profile") {
+            if (i + 1 < args.size()) {
+                opts.profile_file = args[++i];
+            } else {
+                std::cerr << "Missing value for --profile\n";
+            }
+        } else if (a == "--batch") {
+            if (i + 1 < args.size()) {
+                opts.batch_root = args[++i];
+            } else {
+                std::cerr << "Missing value for --batch\n";
+            }
+        } else if (a == "--threads") {
+            if (i + 1 < args.size()) {
+                try {
+                    const int n = std::stoi(args[++i]);
+                    if (n < 0) {
+                        std::cerr << "Invalid value for --threads (use 0 or more)\n";
+                    } else {
+                        opts.threads = static_cast<unsigned>(n);
+                    }
+                } catch (...) {
+                    std::cerr << "Invalid integer for --threads\n";
+                }
+            } else {
+                std::cerr << "Missing value for --threads\n";
+            }
+        } else if (a == "--stage-threads") {
+            if (i + 1 < args.size()) {
+                if (!parse_stage_threads(args[++i], opts.stage_threads)) {
+                    std::cerr << "Invalid value for --stage-threads (use stage=N pairs, e.g. "
+                                 "decode=4,features=8,matching=8,compose=16,encode=4)\n";
+                }
+            } else {
+                std::cerr << "Missing value for --stage-threads\n";
+            }
+        } else if (a == "--cpus") {
+            if (i + 1 < args.size()) {
+                opts.cpus = args[++i];
+                std::vector<int> cpus;
+                if (!parse_cpu_list(opts.cpus, cpus)) {
+                    std::cerr << "Invalid value for --cpus (use a CPU list such as 0-15,32-47)\n";
+                    opts.cpus.clear();
+                }
+            } else {
+                std::cerr << "Missing value for --cpus\n";
+            }
+        } else if (a == "--numa-node") {
+            if (i + 1 < args.size()) {
+                try {
+                    opts.numa_node = std::stoi(args[++i]);
+                } catch (...) {
+                    std::cerr << "Invalid integer for --numa-node\n";
+                }
+            } else {
+                std::cerr << "Missing value for --numa-node\n";
+            }
+        } else if (a == "--jobs") {
+            if (i + 1 < args.size()) {
+                try {
+                    opts.batch_jobs = std::stoi(args[++i]);
+                } catch (...) {
+                    std::cerr << "Invalid integer for --jobs\n";
+                }
+            } else {
+                std::cerr << "Missing value for --jobs\n";
+            }
+        } else if (a == "--batch-memory") {
+            if (i + 1 < args.size()) {
+                try {
+                    opts.batch_memory_mb = static_cast<std::size_t>(std::stoul(args[++i]));
+                } catch (...) {
+                    std::cerr << "Invalid integer for --batch-memory\n";
+                }
+            } else {
+                std::cerr << "Missing value for --batch-memory\n";
+            }
+        } else if (a == "--watch") {
+            if (i + 1 < args.size()) {
+                opts.watch_root = args[++i];
+            } else {
+                std::cerr << "Missing value for --watch\n";
+            }
+        } else if (a == "--watch-settle") {
+            if (i + 1 < args.size()) {
+                try {
+                    opts.watch_settle_s = std::stod(args[++i]);
+                } catch (...) {
+                    std::cerr << "Invalid number for --watch-settle\n";
+                }
+            } else {
+                std::cerr << "Missing value for --watch-settle\n";
+            }
         } else if (a == "--max-dim") {
             if (i + 1 < args.size()) {
                 try {
@@ -55,6 +368,40 @@ CLIOptions parse_cli(int argc, char** argv) {
             } else {
                 std::cerr << "Missing value for --mode\n";
             }
+        } else if (a == "--memory-budget") {
+            if (i + 1 < args.size()) {
+                try {
+                    opts.memory_budget_mb = static_cast<std::size_t>(std::stoul(args[++i]));
+                } catch (...) {
+                    std::cerr << "Invalid integer for --memory-budget\n";
+                }
+            } else {
+                std::cerr << "Missing value for --memory-budget\n";
+            }
+        } else if (a == "--register-dim") {
+            if (i + 1 < args.size()) {
+                try {
+                    opts.register_dim = std::stoi(args[++i]);
+                } catch (...) {
+                    std::cerr << "Invalid integer for --register-dim\n";
+                }
+            } else {
+                std::cerr << "Missing value for --register-dim\n";
+            }
+        } else if (a == "--compose-scale") {
+            if (i + 1 < args.size()) {
+                try {
+                    opts.compose_scale = std::stod(args[++i]);
+                } catch (...) {
+                    std::cerr << "Invalid number for --compose-scale\n";
+                }
+                if (opts.compose_scale <= 0.0 || opts.compose_scale > 1.0) {
+                    std::cerr << "Invalid value for --compose-scale (use 0 < S <= 1)\n";
+                    opts.compose_scale = 1.0;
+                }
+            } else {
+                std::cerr << "Missing value for --compose-scale\n";
+            }
         } else {
             std::cerr << "Unknown argument: " << a << "\n";
         }
@@ -64,15 +411,49 @@ CLIOptions parse_cli(int argc, char** argv) {
 
 void print_help(const char* prog) {
     std::cout << "Usage: " << (prog ? prog : "panorama")
-              << " [-i|--input <images_dir>] [-o|--output <out_dir>] [-f|--file <out_file>] [--top-match-only] [--max-dim N] [--mode panorama|scans]" << '\n'
+              << " [-i|--input <images_dir> | --video <file> [--video-overlap F]] [-o|--output <out_dir>] [-f|--file <out_file>] [--top-match-only] [--match-region full|top|horizon|x,y,w,h] [--quality fast|balanced|best] [--features orb|akaze|sift] [--max-keypoints N] [--max-dim N] [--mode panorama|scans] [--memory-budget MB] [--register-dim N] [--compose-scale S] [--cache] [--heic-cache] [--incremental] [--partial] [--retry [--retry-budget SEC]] [--preview] [--match-window K [--match-wrap]] [--seam graphcut|dp|voronoi|none] [--exposure blocks|gain|channels|none] [--seam-megapix MP] [--crop mask|heuristic|none] [--thumbnail N] [--tiles <dir>] [--profile <trace.json>] [--threads N] [--stage-threads STAGE=N,...] [--cpus LIST] [--numa-node N] [--batch <root> [--jobs N] [--batch-memory MB]] [--watch <root> [--watch-settle SEC]]" << '\n'
               << "\n"
               << "Options:\n"
               << "  -i, --input   Directory containing input images (default: ./images)\n"
+              << "      --video FILE  Stitch keyframes selected while decoding FILE (sharp frames, about --video-overlap apart) instead of --input\n"
+              << "      --video-overlap F  Overlap between consecutive video keyframes as a fraction of the frame (default: 0.5)\n"
               << "  -o, --output  Directory to write panorama (default: ./output)\n"
               << "  -f, --file    Output filename, e.g. panorama.jpg (default: panorama.jpg)\n"
               << "      --top-match-only  Match only the top half (helps moving crowds/cars)\n"
+              << "      --match-region R  Detect keypoints only in R: full, top, horizon (middle band) or x,y,w,h as fractions of the frame\n"
+              << "      --quality Q  Registration preset: fast (ORB, 800 keypoints, 0.3 MP), balanced (ORB, 2000, 0.6 MP) or best (SIFT, 4000, 1 MP)\n"
+              << "      --features F  Keypoint detector: orb, akaze or sift (overrides the preset)\n"
+              << "      --max-keypoints N  Keep at most N keypoints per image, spread over a 4x3 grid with --quality (0 = detector default)\n"
               << "      --max-dim N  Downscale inputs so max(width,height) <= N (0 disables; default: 2000)\n"
               << "      --mode panorama|scans  Use SCANS for translational captures (mosaics)\n"
+              << "      --memory-budget MB  Composite one image at a time within MB of RAM (0 disables; default: 0)\n"
+              << "      --register-dim N  Register on proxies with max(width,height) <= N, then compose from the originals (0 disables)\n"
+              << "      --compose-scale S  Output resolution relative to the originals with --register-dim (default: 1.0)\n"
+              << "      --cache      Reuse features, matches and cameras from <out_dir>/.panorama_cache\n"
+              << "      --heic-cache  Keep JPEG copies of HEIC/HEIF inputs in <out_dir>/.panorama_cache/heic (inputs are not modified)\n"
+              << "      --incremental  Add new images to the panorama of the previous run instead of restitching all of them\n"
+              << "      --partial    Stitch every connected group of images: the largest to --file, the others to <file>_part<k>, plus <file>_graph.json\n"
+              << "      --retry      If registration fails, retry with lower confidence, more features, scans mode, then dropping outlier frames\n"
+              << "      --retry-budget SEC  With --retry, start no new attempt once registration has taken SEC seconds; checked between attempts (default: 60)\n"
+              << "      --preview    Quick check: stitch small frames without seams or exposure compensation into <file>_preview.jpg plus <file>_preview.json\n"
+              << "      --match-window K  Match each image only with the K images on either side in filename order (0 = all pairs)\n"
+              << "      --match-wrap  With --match-window, also match across the first/last image (360 degree sets)\n"
+              << "      --seam S     Seam finder, slowest to fastest: graphcut, dp, voronoi or none (default: graphcut)\n"
+              << "      --exposure E  Exposure compensation: blocks, gain, channels or none (default: blocks)\n"
+              << "      --seam-megapix MP  Resolution of seam finding and exposure estimation in megapixels (default: 0.1)\n"
+              << "      --crop mask|heuristic|none  Crop to the largest fully covered rectangle, trim dark borders, or keep the canvas (default: heuristic)\n"
+              << "      --thumbnail N  Also write <file>_thumb.jpg with max(width,height) <= N\n"
+              << "      --tiles DIR  Write a DeepZoom pyramid (<file stem>.dzi + tiles) under DIR instead of a single image\n"
+              << "      --profile FILE  Write per-stage timings and counters as a Chrome trace (chrome://tracing, Perfetto)\n"
+              << "      --threads N  Worker threads for OpenCV and the decode/encode pools (0 = one per usable CPU; default: 0)\n"
+              << "      --stage-threads SPEC  Per-stage threads overriding --threads, e.g. decode=4,features=8,matching=8,compose=16,encode=4\n"
+              << "      --cpus LIST  Run only on these CPUs, e.g. 0-15,32-47 (Linux, Windows)\n"
+              << "      --numa-node N  Run only on the CPUs of NUMA node N, and so allocate from its memory (Linux; combines with --cpus)\n"
+              << "      --batch DIR  Stitch every image directory under DIR; outputs mirror the tree under --output\n"
+              << "      --jobs N     Batch/watch mode: panoramas stitched concurrently (default: 2)\n"
+              << "      --batch-memory MB  Batch mode: admit jobs only while their estimated memory fits (0 = unlimited)\n"
+              << "      --watch DIR  Keep running and stitch each image directory under DIR once its files stop changing\n"
+              << "      --watch-settle SEC  Watch mode: seconds a directory must stay unchanged before it is stitched (default: 10)\n"
               << "  -h, --help    Show this help and exit\n"
               << std::endl;
 }
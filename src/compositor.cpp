@@ -0,0 +1,648 @@
+#include "compositor.hpp"
+#include "mapped_file.hpp"
+#include "profiler.hpp"
+#include "utils.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <functional>
+#include <sstream>
+#include <utility>
+#include <opencv2/core/utility.hpp>
+#include <opencv2/imgproc.hpp>
+#include <opencv2/stitching/detail/blenders.hpp>
+#include <opencv2/stitching/detail/util.hpp>
+
+using Clock = std::chrono::steady_clock;
+
+static double ms_since(Clock::time_point t0) {
+    return std::chrono::duration<double, std::milli>(Clock::now() - t0).count();
+}
+
+// ChannelsCompensator was added in OpenCV 4.1
+#if CV_VERSION_MAJOR > 4 || (CV_VERSION_MAJOR == 4 && CV_VERSION_MINOR >= 1)
+#define PANORAMA_HAVE_CHANNELS_COMPENSATOR 1
+#else
+#define PANORAMA_HAVE_CHANNELS_COMPENSATOR 0
+#endif
+
+namespace {
+
+// Approximate bytes held per canvas pixel while blending (excluding the 8-bit output).
+constexpr double kFeatherCanvasBytes = 6.0 + 4.0 + 1.0;   // CV_16SC3 sum, CV_32F weights, CV_8U mask
+constexpr double kMultiBandLevelBytes = 6.0 + 4.0;        // CV_16SC3 Laplacian + CV_32F weight per level
+constexpr double kOutputBytes = 3.0 + 1.0;                // CV_8UC3 panorama + CV_8U mask
+// Approximate bytes per warped-frame pixel for the frame currently being fed.
+constexpr double kFeatherFrameBytes = 3.0 + 6.0 + 1.0 + 1.0 + 4.0;
+constexpr double kMultiBandFrameBytes = kFeatherFrameBytes + kMultiBandLevelBytes * 4.0 / 3.0;
+// Per seam-scale pixel: 8UC3 warped image, 32FC3 copy, mask.
+constexpr double kSeamBytes = 3.0 + 12.0 + 1.0;
+
+enum class BlendKind { MultiBand, Feather, DiskFeather };
+
+struct CompositePlan {
+    double scale{1.0};
+    BlendKind kind{BlendKind::MultiBand};
+    int bands{5};
+    cv::Rect canvas;
+    std::size_t estimated_bytes{0};
+    bool fits{true}; // false if even the smallest canvas tried exceeds the budget
+};
+
+struct CanvasLayout {
+    std::vector<cv::Point> corners;
+    std::vector<cv::Size> sizes;
+    cv::Rect canvas;
+    double max_frame_px{0.0};
+};
+
+float median_focal(const std::vector<cv::detail::CameraParams>& cameras) {
+    std::vector<double> focals;
+    focals.reserve(cameras.size());
+    for (const auto& c : cameras) {
+        focals.push_back(c.focal);
+    }
+    std::sort(focals.begin(), focals.end());
+    const std::size_t n = focals.size();
+    if (n % 2 == 1) {
+        return static_cast<float>(focals[n / 2]);
+    }
+    return static_cast<float>(0.5 * (focals[n / 2 - 1] + focals[n / 2]));
+}
+
+cv::Mat scaled_K(const cv::detail::CameraParams& cam, double scale) {
+    cv::detail::CameraParams c = cam;
+    c.focal *= scale;
+    c.ppx *= scale;
+    c.ppy *= scale;
+    cv::Mat K;
+    c.K().convertTo(K, CV_32F);
+    return K;
+}
+
+cv::Mat rotation32f(const cv::detail::CameraParams& cam) {
+    cv::Mat R;
+    cam.R.convertTo(R, CV_32F);
+    return R;
+}
+
+cv::Size scaled_size(const cv::Size& full, double scale) {
+    return cv::Size(std::max(1, cvRound(full.width * scale)), std::max(1, cvRound(full.height * scale)));
+}
+
+CanvasLayout layout_canvas(const std::vector<cv::detail::CameraParams>& cameras,
+                           const std::vector<cv::Size>& full_sizes,
+                           const cv::Ptr<cv::WarperCreator>& warper_creator,
+                           double scale,
+                           float warped_scale) {
+    CanvasLayout layout;
+    cv::Ptr<cv::detail::RotationWarper> warper = warper_creator->create(static_cast<float>(warped_scale * scale));
+    layout.corners.reserve(cameras.size());
+    layout.sizes.reserve(cameras.size());
+    for (std::size_t i = 0; i < cameras.size(); ++i) {
+        cv::Rect roi = warper->warpRoi(scaled_size(full_sizes[i], scale), scaled_K(cameras[i], scale),
+                                       rotation32f(cameras[i]));
+        layout.corners.push_back(roi.tl());
+        layout.sizes.push_back(roi.size());
+        layout.max_frame_px = std::max(layout.max_frame_px, static_cast<double>(roi.area()));
+    }
+    layout.canvas = cv::detail::resultRoi(layout.corners, layout.sizes);
+    return layout;
+}
+
+// Canvas pixels once MultiBandBlender has padded the ROI to a multiple of 2^bands.
+double multiband_canvas_px(const cv::Rect& canvas, int bands) {
+    const int step = 1 << bands;
+    const double w = canvas.width + (step - canvas.width % step) % step;
+    const double h = canvas.height + (step - canvas.height % step) % step;
+    return w * h;
+}
+
+double pyramid_factor(int bands) {
+    double f = 0.0, level = 1.0;
+    for (int b = 0; b <= bands; ++b) {
+        f += level;
+        level *= 0.25;
+    }
+    return f;
+}
+
+CompositePlan plan_composite(const std::vector<cv::detail::CameraParams>& cameras,
+                             const std::vector<cv::Size>& full_sizes,
+                             const cv::Ptr<cv::WarperCreator>& warper_creator,
+                             const CompositeOptions& options,
+                             float warped_scale,
+                             double seam_px) {
+    CompositePlan plan;
+    plan.scale = options.compose_scale;
+    const double budget = static_cast<double>(options.memory_budget_bytes);
+    const int max_bands = options.feather_only ? 0 : std::max(1, options.max_blend_bands);
+    const int attempts = 8;
+
+    for (int attempt = 0; attempt < attempts; ++attempt) {
+        CanvasLayout layout = layout_canvas(cameras, full_sizes, warper_creator, plan.scale, warped_scale);
+        plan.canvas = layout.canvas;
+        const double canvas_px = static_cast<double>(layout.canvas.area());
+        const double fixed = seam_px * kSeamBytes + canvas_px * kOutputBytes;
+
+        auto multiband_bytes = [&](int bands) {
+            return fixed + multiband_canvas_px(layout.canvas, bands) *
+                               (kMultiBandLevelBytes * pyramid_factor(bands) + 1.0) +
+                   layout.max_frame_px * kMultiBandFrameBytes;
+        };
+
+        const double feather = fixed + canvas_px * kFeatherCanvasBytes + layout.max_frame_px * kFeatherFrameBytes;
+        if (budget <= 0.0) {
+            if (options.feather_only) {
+                plan.kind = BlendKind::Feather;
+                plan.estimated_bytes = static_cast<std::size_t>(feather);
+            } else {
+                plan.kind = BlendKind::MultiBand;
+                plan.bands = max_bands;
+                plan.estimated_bytes = static_cast<std::size_t>(multiband_bytes(max_bands));
+            }
+            break;
+        }
+
+        // Best quality that fits: full multiband, fewer bands, feather, feather on disk.
+        bool fits = false;
+        for (int bands = max_bands; bands >= 1 && !fits; --bands) {
+            double est = multiband_bytes(bands);
+            if (est <= budget) {
+                plan.kind = BlendKind::MultiBand;
+                plan.bands = bands;
+                plan.estimated_bytes = static_cast<std::size_t>(est);
+                fits = true;
+            }
+        }
+        if (!fits && feather <= budget) {
+            plan.kind = BlendKind::Feather;
+            plan.estimated_bytes = static_cast<std::size_t>(feather);
+            fits = true;
+        }
+        if (!fits) {
+            double disk = fixed + layout.max_frame_px * kFeatherFrameBytes;
+            plan.kind = BlendKind::DiskFeather;
+            plan.estimated_bytes = static_cast<std::size_t>(disk);
+            fits = disk <= budget;
+            if (!fits && attempt + 1 < attempts) {
+                // Even the output does not fit: shrink the canvas and try again. The last
+                // attempt keeps its scale, so canvas and estimate describe the plan returned.
+                plan.scale *= 0.95 * std::sqrt(budget / disk);
+            }
+        }
+        plan.fits = fits;
+        if (fits) {
+            break;
+        }
+    }
+    // Record the plan actually chosen, not the attempts leading to it
+    profiler::count("canvas_px", static_cast<double>(plan.canvas.area()));
+    profiler::count("estimated_bytes", static_cast<double>(plan.estimated_bytes));
+    return plan;
+}
+
+// Crop a warped frame and its mask to the part that lies inside 'canvas'.
+bool clip_to_canvas(cv::Mat& img, cv::Mat& mask, cv::Point& corner, const cv::Rect& canvas) {
+    cv::Rect frame(corner, img.size());
+    cv::Rect inside = frame & canvas;
+    if (inside.empty()) {
+        return false;
+    }
+    if (inside != frame) {
+        cv::Rect local(inside.tl() - corner, inside.size());
+        img = img(local);
+        mask = mask(local);
+        corner = inside.tl();
+    }
+    return true;
+}
+
+// Feather blender whose accumulation canvas lives in a memory-mapped scratch
+// file. Same weighting as cv::detail::FeatherBlender.
+class DiskFeatherBlender {
+public:
+    explicit DiskFeatherBlender(float sharpness = 0.02f) : sharpness_(sharpness) {}
+
+    bool prepare(const cv::Rect& dst_roi, const std::filesystem::path& scratch_dir, std::string& error_message) {
+        roi_ = dst_roi;
+        const std::size_t px = static_cast<std::size_t>(dst_roi.area());
+        const std::size_t weight_bytes = px * sizeof(float);
+        if (!storage_.create(scratch_dir, weight_bytes + px * 3 * sizeof(short), &error_message)) {
+            return false;
+        }
+        // The scratch buffer is zero-filled, so no explicit clear is needed.
+        // Weights go first so both planes stay naturally aligned.
+        weight_ = cv::Mat(roi_.size(), CV_32F, storage_.data());
+        sum_ = cv::Mat(roi_.size(), CV_16SC3, storage_.data() + weight_bytes);
+        return true;
+    }
+
+    void feed(const cv::Mat& img, const cv::Mat& mask, cv::Point tl) {
+        CV_Assert(img.type() == CV_16SC3 && mask.type() == CV_8U);
+        cv::Mat w;
+        cv::detail::createWeightMap(mask, sharpness_, w);
+        const int dx = tl.x - roi_.x;
+        const int dy = tl.y - roi_.y;
+        for (int y = 0; y < img.rows; ++y) {
+            const cv::Vec3s* src = img.ptr<cv::Vec3s>(y);
+            const float* wrow = w.ptr<float>(y);
+            cv::Vec3s* dst = sum_.ptr<cv::Vec3s>(dy + y) + dx;
+            float* dst_w = weight_.ptr<float>(dy + y) + dx;
+            for (int x = 0; x < img.cols; ++x) {
+                const float wt = wrow[x];
+                dst[x][0] = static_cast<short>(dst[x][0] + src[x][0] * wt);
+                dst[x][1] = static_cast<short>(dst[x][1] + src[x][1] * wt);
+                dst[x][2] = static_cast<short>(dst[x][2] + src[x][2] * wt);
+                dst_w[x] += wt;
+            }
+        }
+    }
+
+    void blend(cv::Mat& pano, cv::Mat& pano_mask) {
+        constexpr float kWeightEps = 1e-5f;
+        pano.create(roi_.size(), CV_8UC3);
+        pano_mask.create(roi_.size(), CV_8U);
+        for (int y = 0; y < roi_.height; ++y) {
+            const cv::Vec3s* src = sum_.ptr<cv::Vec3s>(y);
+            const float* wrow = weight_.ptr<float>(y);
+            cv::Vec3b* dst = pano.ptr<cv::Vec3b>(y);
+            uchar* m = pano_mask.ptr<uchar>(y);
+            for (int x = 0; x < roi_.width; ++x) {
+                const float wt = wrow[x];
+                if (wt > kWeightEps) {
+                    const float inv = 1.f / (wt + kWeightEps);
+                    dst[x] = cv::Vec3b(cv::saturate_cast<uchar>(src[x][0] * inv),
+                                       cv::saturate_cast<uchar>(src[x][1] * inv),
+                                       cv::saturate_cast<uchar>(src[x][2] * inv));
+                    m[x] = 255;
+                } else {
+                    dst[x] = cv::Vec3b(0, 0, 0);
+                    m[x] = 0;
+                }
+            }
+        }
+        sum_.release();
+        weight_.release();
+        storage_.release();
+    }
+
+private:
+    float sharpness_;
+    cv::Rect roi_;
+    MappedFile storage_;
+    cv::Mat sum_;
+    cv::Mat weight_;
+};
+
+// Pairwise seam finder that runs independent pairs concurrently. Like
+// cv::detail::PairwiseSeamFinder it visits every pair of frames whose warped
+// rectangles overlap, but the pairs are grouped into rounds (greedily, in the
+// order OpenCV visits them) in which no frame appears twice. The pairs of a round
+// run in parallel, each through a fresh finder given only those two frames, so
+// each pair still cuts the masks left by the rounds before it.
+class ParallelPairSeamFinder : public cv::detail::SeamFinder {
+public:
+    explicit ParallelPairSeamFinder(std::function<cv::Ptr<cv::detail::SeamFinder>()> create)
+        : create_(std::move(create)) {}
+
+    void find(const std::vector<cv::UMat>& src,
+              const std::vector<cv::Point>& corners,
+              std::vector<cv::UMat>& masks) override {
+        const int n = static_cast<int>(src.size());
+        std::vector<std::vector<std::pair<int, int>>> rounds;
+        std::vector<std::vector<char>> busy; // per round: frames already paired in it
+        std::size_t pairs = 0;
+        for (int i = 0; i < n - 1; ++i) {
+            for (int j = i + 1; j < n; ++j) {
+                const cv::Rect a(corners[i], src[i].size());
+                const cv::Rect b(corners[j], src[j].size());
+                if ((a & b).empty()) {
+                    continue;
+                }
+                std::size_t r = 0;
+                while (r < rounds.size() && (busy[r][i] || busy[r][j])) {
+                    ++r;
+                }
+                if (r == rounds.size()) {
+                    rounds.emplace_back();
+                    busy.emplace_back(n, 0);
+                }
+                rounds[r].emplace_back(i, j);
+                busy[r][i] = busy[r][j] = 1;
+                ++pairs;
+            }
+        }
+        profiler::count("seam_pairs", static_cast<double>(pairs));
+        profiler::count("seam_rounds", static_cast<double>(rounds.size()));
+
+        for (const auto& round : rounds) {
+            cv::parallel_for_(cv::Range(0, static_cast<int>(round.size())), [&](const cv::Range& range) {
+                for (int k = range.start; k < range.end; ++k) {
+                    const int i = round[k].first;
+                    const int j = round[k].second;
+                    std::vector<cv::UMat> pair_src{src[i], src[j]};
+                    std::vector<cv::Point> pair_corners{corners[i], corners[j]};
+                    std::vector<cv::UMat> pair_masks{masks[i], masks[j]};
+                    create_()->find(pair_src, pair_corners, pair_masks);
+                    // Each frame belongs to one pair of the round, so these writes never collide
+                    masks[i] = pair_masks[0];
+                    masks[j] = pair_masks[1];
+                }
+            });
+        }
+    }
+
+private:
+    std::function<cv::Ptr<cv::detail::SeamFinder>()> create_;
+};
+
+} // namespace
+
+bool parse_seam_method(const std::string& name, SeamMethod& method) {
+    if (name == "graphcut") {
+        method = SeamMethod::GraphCut;
+    } else if (name == "dp") {
+        method = SeamMethod::DpColorGrad;
+    } else if (name == "voronoi") {
+        method = SeamMethod::Voronoi;
+    } else if (name == "none") {
+        method = SeamMethod::None;
+    } else {
+        return false;
+    }
+    return true;
+}
+
+bool parse_exposure_method(const std::string& name, ExposureMethod& method) {
+    if (name == "blocks") {
+        method = ExposureMethod::BlockGains;
+    } else if (name == "gain") {
+        method = ExposureMethod::Gain;
+    } else if (name == "channels") {
+        method = ExposureMethod::Channels;
+    } else if (name == "none") {
+        method = ExposureMethod::None;
+    } else {
+        return false;
+    }
+    return true;
+}
+
+cv::Ptr<cv::detail::SeamFinder> create_seam_finder(SeamMethod method) {
+    switch (method) {
+        case SeamMethod::GraphCut:
+            // cv::Stitcher's default seam finder
+            return cv::makePtr<ParallelPairSeamFinder>([]() -> cv::Ptr<cv::detail::SeamFinder> {
+                return cv::makePtr<cv::detail::GraphCutSeamFinder>(cv::detail::GraphCutSeamFinderBase::COST_COLOR);
+            });
+        case SeamMethod::DpColorGrad:
+            return cv::makePtr<ParallelPairSeamFinder>([]() -> cv::Ptr<cv::detail::SeamFinder> {
+                return cv::makePtr<cv::detail::DpSeamFinder>(cv::detail::DpSeamFinder::COLOR_GRAD);
+            });
+        case SeamMethod::Voronoi:
+            // Masks only: cheap enough to run as is
+            return cv::makePtr<cv::detail::VoronoiSeamFinder>();
+        case SeamMethod::None:
+            break;
+    }
+    return cv::Ptr<cv::detail::SeamFinder>();
+}
+
+cv::Ptr<cv::detail::ExposureCompensator> create_exposure_compensator(ExposureMethod method) {
+    switch (method) {
+        case ExposureMethod::BlockGains:
+            // cv::Stitcher's default compensator
+            return cv::makePtr<cv::detail::BlocksGainCompensator>();
+        case ExposureMethod::Gain:
+            return cv::makePtr<cv::detail::GainCompensator>();
+        case ExposureMethod::Channels:
+#if PANORAMA_HAVE_CHANNELS_COMPENSATOR
+            return cv::makePtr<cv::detail::ChannelsCompensator>();
+#else
+            return cv::makePtr<cv::detail::GainCompensator>();
+#endif
+        case ExposureMethod::None:
+            break;
+    }
+    return cv::Ptr<cv::detail::ExposureCompensator>();
+}
+
+cv::Rect estimate_canvas(const std::vector<cv::detail::CameraParams>& cameras,
+                         const std::vector<cv::Size>& full_sizes,
+                         const cv::Ptr<cv::WarperCreator>& warper_creator,
+                         double scale,
+                         float warped_scale) {
+    if (cameras.empty()) {
+        return cv::Rect();
+    }
+    if (warped_scale <= 0.f) {
+        warped_scale = median_focal(cameras);
+    }
+    return layout_canvas(cameras, full_sizes, warper_creator, scale, warped_scale).canvas;
+}
+
+void render_footprints(const std::vector<cv::detail::CameraParams>& cameras,
+                       const std::vector<cv::Size>& full_sizes,
+                       const cv::Ptr<cv::WarperCreator>& warper_creator,
+                       double scale,
+                       float warped_scale,
+                       const cv::Rect& area_rect,
+                       cv::Mat& area) {
+    area.create(area_rect.size(), CV_8U);
+    area.setTo(cv::Scalar::all(0));
+    cv::Ptr<cv::detail::RotationWarper> warper = warper_creator->create(static_cast<float>(warped_scale * scale));
+    for (std::size_t i = 0; i < cameras.size(); ++i) {
+        cv::Mat mask(scaled_size(full_sizes[i], scale), CV_8U, cv::Scalar::all(255));
+        cv::Mat warped;
+        cv::Point corner = warper->warp(mask, scaled_K(cameras[i], scale), rotation32f(cameras[i]),
+                                        cv::INTER_NEAREST, cv::BORDER_CONSTANT, warped);
+        cv::Rect frame(corner, warped.size());
+        cv::Rect inside = frame & area_rect;
+        if (inside.empty()) {
+            continue;
+        }
+        cv::Mat dst = area(cv::Rect(inside.tl() - area_rect.tl(), inside.size()));
+        cv::bitwise_or(dst, warped(cv::Rect(inside.tl() - corner, inside.size())), dst);
+    }
+}
+
+bool composite_streaming(const std::vector<cv::detail::CameraParams>& cameras,
+                         const std::vector<cv::Size>& full_sizes,
+                         const FrameLoader& load_frame,
+                         const cv::Ptr<cv::WarperCreator>& warper_creator,
+                         const cv::Ptr<cv::detail::SeamFinder>& seam_finder,
+                         const cv::Ptr<cv::detail::ExposureCompensator>& exposure,
+                         const CompositeOptions& options,
+                         cv::Mat& pano,
+                         cv::Mat* pano_mask,
+                         CompositeReport* report,
+                         std::string& error_message) {
+    const std::size_t n = cameras.size();
+    if (n == 0 || full_sizes.size() != n || !load_frame || !warper_creator) {
+        error_message = "Compositor called with inconsistent inputs";
+        return false;
+    }
+
+    try {
+        const float warped_scale = options.warped_scale > 0.f ? options.warped_scale : median_focal(cameras);
+
+        // Seam pass: all frames at seam resolution (small) for exposure and seam estimation, if either is done
+        const double seam_scale = std::min(1.0, std::sqrt(options.seam_megapix * 1e6 / full_sizes[0].area()));
+        cv::Ptr<cv::detail::RotationWarper> seam_warper =
+            warper_creator->create(static_cast<float>(warped_scale * seam_scale));
+        std::vector<cv::UMat> seam_images(n), seam_masks(n);
+        std::vector<cv::Point> seam_corners(n);
+        double seam_px = 0.0;
+        const bool seam_pass = seam_finder || exposure;
+        double seam_warp_ms = 0.0, exposure_ms = 0.0, seam_ms = 0.0;
+        auto tStage = Clock::now();
+        for (std::size_t i = 0; i < n && seam_pass; ++i) {
+            PROFILE_SCOPE("seam_warp");
+            cv::Mat img = load_frame(i, seam_scale);
+            if (img.empty()) {
+                error_message = "Failed to load frame " + std::to_string(i) + " for seam estimation";
+                return false;
+            }
+            const double s = static_cast<double>(img.cols) / full_sizes[i].width;
+            cv::Mat K = scaled_K(cameras[i], s);
+            cv::Mat R = rotation32f(cameras[i]);
+            seam_corners[i] = seam_warper->warp(img, K, R, cv::INTER_LINEAR, cv::BORDER_REFLECT, seam_images[i]);
+            cv::Mat mask(img.size(), CV_8U, cv::Scalar::all(255));
+            seam_warper->warp(mask, K, R, cv::INTER_NEAREST, cv::BORDER_CONSTANT, seam_masks[i]);
+            seam_px += static_cast<double>(seam_images[i].total());
+        }
+        seam_warp_ms = ms_since(tStage);
+        if (exposure) {
+            PROFILE_SCOPE("exposure");
+            tStage = Clock::now();
+            exposure->feed(seam_corners, seam_images, seam_masks);
+            exposure_ms = ms_since(tStage);
+        }
+        if (seam_finder) {
+            PROFILE_SCOPE("seam");
+            tStage = Clock::now();
+            std::vector<cv::UMat> seam_images_f(n);
+            for (std::size_t i = 0; i < n; ++i) {
+                seam_images[i].convertTo(seam_images_f[i], CV_32F);
+                seam_images[i].release();
+            }
+            seam_finder->find(seam_images_f, seam_corners, seam_masks);
+            seam_ms = ms_since(tStage);
+        }
+        seam_images.clear();
+
+        // Size the canvas from the cameras and pick a blender that fits the budget
+        CompositePlan plan = plan_composite(cameras, full_sizes, warper_creator, options, warped_scale, seam_px);
+        CanvasLayout layout = layout_canvas(cameras, full_sizes, warper_creator, plan.scale, warped_scale);
+        cv::Ptr<cv::detail::RotationWarper> warper =
+            warper_creator->create(static_cast<float>(warped_scale * plan.scale));
+
+        cv::Ptr<cv::detail::Blender> blender;
+        DiskFeatherBlender disk_blender;
+        std::ostringstream blender_name;
+        if (plan.kind == BlendKind::MultiBand) {
+            blender = cv::makePtr<cv::detail::MultiBandBlender>(false, plan.bands);
+            blender_name << "multiband(" << plan.bands << ")";
+        } else if (plan.kind == BlendKind::Feather) {
+            blender = cv::makePtr<cv::detail::FeatherBlender>();
+            blender_name << "feather";
+        } else {
+            blender_name << "feather(disk)";
+        }
+        if (blender) {
+            blender->prepare(layout.corners, layout.sizes);
+        } else if (!disk_blender.prepare(layout.canvas, options.scratch_dir, error_message)) {
+            return false;
+        }
+
+        // Compose pass: one frame in memory at a time
+        const auto tBlend = Clock::now();
+        for (std::size_t i = 0; i < n; ++i) {
+            cv::Mat img;
+            {
+                PROFILE_SCOPE("load_frame");
+                img = load_frame(i, plan.scale);
+            }
+            if (img.empty()) {
+                error_message = "Failed to load frame " + std::to_string(i) + " for compositing";
+                return false;
+            }
+
+            cv::Mat img_warped_s, mask_warped;
+            cv::Point corner;
+            {
+                PROFILE_SCOPE("warp");
+                const double s = static_cast<double>(img.cols) / full_sizes[i].width;
+                cv::Mat K = scaled_K(cameras[i], s);
+                cv::Mat R = rotation32f(cameras[i]);
+
+                cv::Mat img_warped;
+                corner = warper->warp(img, K, R, cv::INTER_LINEAR, cv::BORDER_REFLECT, img_warped);
+                cv::Mat mask(img.size(), CV_8U, cv::Scalar::all(255));
+                warper->warp(mask, K, R, cv::INTER_NEAREST, cv::BORDER_CONSTANT, mask_warped);
+                img.release();
+                mask.release();
+
+                if (exposure) {
+                    exposure->apply(static_cast<int>(i), corner, img_warped, mask_warped);
+                }
+                img_warped.convertTo(img_warped_s, CV_16S);
+                img_warped.release();
+
+                // Restrict the frame to its seam region
+                if (!seam_masks[i].empty()) {
+                    cv::Mat dilated_mask, seam_mask;
+                    cv::dilate(seam_masks[i], dilated_mask, cv::Mat());
+                    cv::resize(dilated_mask, seam_mask, mask_warped.size(), 0, 0, cv::INTER_LINEAR_EXACT);
+                    mask_warped = seam_mask & mask_warped;
+                }
+            }
+
+            if (!clip_to_canvas(img_warped_s, mask_warped, corner, layout.canvas)) {
+                continue;
+            }
+            PROFILE_SCOPE("blend");
+            if (blender) {
+                blender->feed(img_warped_s, mask_warped, corner);
+            } else {
+                disk_blender.feed(img_warped_s, mask_warped, corner);
+            }
+        }
+
+        PROFILE_SCOPE("blend");
+        cv::Mat result_mask;
+        if (blender) {
+            cv::Mat result;
+            blender->blend(result, result_mask);
+            blender.release();
+            result.convertTo(pano, CV_8U);
+        } else {
+            disk_blender.blend(pano, result_mask);
+        }
+        if (pano_mask) {
+            *pano_mask = result_mask;
+        }
+
+        if (report) {
+            report->canvas = pano.size();
+            report->canvas_origin = layout.canvas.tl();
+            report->warped_scale = warped_scale;
+            report->compose_scale = plan.scale;
+            report->blender = blender_name.str();
+            report->disk_backed = plan.kind == BlendKind::DiskFeather;
+            report->estimated_bytes = plan.estimated_bytes;
+            report->over_budget = !plan.fits;
+            report->peak_rss_bytes = utils::peak_rss_bytes();
+            report->seam_warp_ms = seam_warp_ms;
+            report->exposure_ms = exposure_ms;
+            report->seam_ms = seam_ms;
+            report->blend_ms = ms_since(tBlend);
+        }
+        return true;
+    } catch (const std::exception& ex) {
+        error_message = ex.what();
+        return false;
+    }
+}
@@ -0,0 +1,150 @@
+#include "cpu_affinity.hpp"
+
+#include <algorithm>
+#include <cctype>
+#include <fstream>
+#include <thread>
+
+#if defined(__linux__)
+#include <sched.h>
+#elif defined(_WIN32)
+#define NOMINMAX
+#include <windows.h>
+#endif
+
+bool parse_cpu_list(const std::string& spec, std::vector<int>& cpus) {
+    std::vector<int> out;
+    std::size_t pos = 0;
+    auto read_number = [&](int& value) {
+        const std::size_t start = pos;
+        long v = 0;
+        while (pos < spec.size() && std::isdigit(static_cast<unsigned char>(spec[pos]))) {
+            v = v * 10 + (spec[pos] - '0');
+            if (v > 65535) {
+                return false;
+            }
+            ++pos;
+        }
+        value = static_cast<int>(v);
+        return pos > start;
+    };
+    while (pos < spec.size()) {
+        int first = 0, last = 0;
+        if (!read_number(first)) {
+            return false;
+        }
+        last = first;
+        if (pos < spec.size() && spec[pos] == '-') {
+            ++pos;
+            if (!read_number(last) || last < first) {
+                return false;
+            }
+        }
+        for (int c = first; c <= last; ++c) {
+            out.push_back(c);
+        }
+        if (pos < spec.size()) {
+            // Separator; sysfs lists end with a newline
+            if (spec[pos] == '\n' && pos + 1 == spec.size()) {
+                break;
+            }
+            if (spec[pos] != ',' || pos + 1 == spec.size()) {
+                return false;
+            }
+            ++pos;
+        }
+    }
+    if (out.empty()) {
+        return false;
+    }
+    std::sort(out.begin(), out.end());
+    out.erase(std::unique(out.begin(), out.end()), out.end());
+    cpus = std::move(out);
+    return true;
+}
+
+bool numa_node_cpus(int node, std::vector<int>& cpus, std::string& error_message) {
+#if defined(__linux__)
+    const std::string file = "/sys/devices/system/node/node" + std::to_string(node) + "/cpulist";
+    std::ifstream in(file);
+    std::string list;
+    if (node < 0 || !in || !std::getline(in, list)) {
+        error_message = "NUMA node " + std::to_string(node) + " not found (" + file + ")";
+        return false;
+    }
+    if (!parse_cpu_list(list, cpus)) {
+        error_message = "NUMA node " + std::to_string(node) + " has no CPUs";
+        return false;
+    }
+    return true;
+#else
+    (void)node;
+    (void)cpus;
+    error_message = "NUMA node selection is only supported on Linux";
+    return false;
+#endif
+}
+
+bool pin_to_cpus(const std::vector<int>& cpus, std::string& error_message) {
+    if (cpus.empty()) {
+        error_message = "No CPU to pin to";
+        return false;
+    }
+#if defined(__linux__)
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    for (int c : cpus) {
+        if (c >= CPU_SETSIZE) {
+            error_message = "CPU " + std::to_string(c) + " is out of range";
+            return false;
+        }
+        CPU_SET(c, &set);
+    }
+    if (sched_setaffinity(0, sizeof(set), &set) != 0) {
+        error_message = "sched_setaffinity failed (are the CPUs online and allowed?)";
+        return false;
+    }
+    return true;
+#elif defined(_WIN32)
+    DWORD_PTR mask = 0;
+    for (int c : cpus) {
+        if (c >= static_cast<int>(sizeof(DWORD_PTR) * 8)) {
+            error_message = "CPU " + std::to_string(c) + " is outside the first processor group";
+            return false;
+        }
+        mask |= static_cast<DWORD_PTR>(1) << c;
+    }
+    if (!SetProcessAffinityMask(GetCurrentProcess(), mask)) {
+        error_message = "SetProcessAffinityMask failed";
+        return false;
+    }
+    return true;
+#else
+    error_message = "CPU pinning is not supported on this platform";
+    return false;
+#endif
+}
+
+unsigned available_cpus() {
+#if defined(__linux__)
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    if (sched_getaffinity(0, sizeof(set), &set) == 0) {
+        const int n = CPU_COUNT(&set);
+        if (n > 0) {
+            return static_cast<unsigned>(n);
+        }
+    }
+#elif defined(_WIN32)
+    DWORD_PTR process_mask = 0, system_mask = 0;
+    if (GetProcessAffinityMask(GetCurrentProcess(), &process_mask, &system_mask) && process_mask != 0) {
+        unsigned n = 0;
+        for (; process_mask; process_mask &= process_mask - 1) {
+            ++n;
+        }
+        return n;
+    }
+#endif
+    const unsigned hw = std::thread::hardware_concurrency();
+    return hw > 0 ? hw : 1;
+}
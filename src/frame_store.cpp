@@ -0,0 +1,78 @@
+#include "frame_store.hpp"
+
+#include <utility>
+
+FrameStore::FrameStore(std::filesystem::path scratch_dir) : scratch_dir_(std::move(scratch_dir)) {}
+
+cv::Mat FrameStore::put(std::size_t index, const cv::Mat& image, int uses) {
+    if (image.empty() || uses <= 0) {
+        return image;
+    }
+    // Map and copy outside the lock; only the slot bookkeeping is serialised.
+    auto storage = std::make_unique<MappedFile>();
+    const std::size_t row_bytes = image.cols * image.elemSize();
+    if (!storage->create(scratch_dir_, row_bytes * image.rows)) {
+        return image;
+    }
+    cv::Mat stored(image.size(), image.type(), storage->data(), row_bytes);
+    image.copyTo(stored);
+
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (slots_.size() <= index) {
+        slots_.resize(index + 1);
+    }
+    Slot& slot = slots_[index];
+    if (slot.storage) {
+        stored_bytes_ -= slot.storage->size();
+    }
+    stored_bytes_ += storage->size();
+    slot.storage = std::move(storage);
+    slot.view = stored;
+    slot.uses = uses;
+    return stored;
+}
+
+cv::Mat FrameStore::view(std::size_t index) const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return index < slots_.size() ? slots_[index].view : cv::Mat();
+}
+
+void FrameStore::retain(std::size_t index, int uses) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (index < slots_.size() && slots_[index].storage) {
+        slots_[index].uses += uses;
+    }
+}
+
+void FrameStore::release(std::size_t index) {
+    std::unique_ptr<MappedFile> freed;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (index >= slots_.size() || !slots_[index].storage) {
+            return;
+        }
+        Slot& slot = slots_[index];
+        if (--slot.uses > 0) {
+            slot.storage->evict();
+            return;
+        }
+        stored_bytes_ -= slot.storage->size();
+        slot.view.release();
+        freed = std::move(slot.storage);
+    }
+    // Unmap outside the lock
+}
+
+void FrameStore::evict_all() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    for (auto& slot : slots_) {
+        if (slot.storage) {
+            slot.storage->evict();
+        }
+    }
+}
+
+std::size_t FrameStore::stored_bytes() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return stored_bytes_;
+}
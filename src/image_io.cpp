@@ -1,12 +1,29 @@
 #include "image_io.hpp"
+#include "frame_store.hpp"
+#include "registration_cache.hpp"
+#include "thread_pool.hpp"
+#include "utils.hpp"
 
 #include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <fstream>
+#include <functional>
+#include <mutex>
+#include <sstream>
 #include <string>
+#include <opencv2/imgcodecs.hpp>
+#include <opencv2/imgproc.hpp>
 
 using std::filesystem::path;
+using Clock = std::chrono::steady_clock;
+
+static double ms_since(Clock::time_point t0) {
+    return std::chrono::duration<double, std::milli>(Clock::now() - t0).count();
+}
 
 static bool has_image_ext(const path& p) {
-    static const char* exts[] = {".jpg", ".jpeg", ".png", ".bmp", ".tif", ".tiff"};
+    static const char* exts[] = {".jpg", ".jpeg", ".png", ".bmp", ".tif", ".tiff", ".heic", ".heif"};
     std::string ext = p.extension().string();
     std::transform(ext.begin(), ext.end(), ext.begin(), [](unsigned char c){ return std::tolower(c); });
     for (auto e : exts) {
@@ -34,3 +51,359 @@ std::vector<path> list_image_files(const path& dir) {
     std::sort(files.begin(), files.end());
     return files;
 }
+
+// Walk the JPEG markers up to the first SOF. 'get' returns the next byte (-1 at
+// the end) and 'skip' moves past n bytes.
+template <typename GetFn, typename SkipFn>
+static bool parse_jpeg_size(GetFn&& get, SkipFn&& skip, cv::Size& size) {
+    if (get() != 0xFF || get() != 0xD8) {
+        return false;
+    }
+    for (;;) {
+        int c = get();
+        if (c < 0) {
+            return false;
+        }
+        if (c != 0xFF) {
+            continue; // not at a marker; resync
+        }
+        int marker = get();
+        while (marker == 0xFF) {
+            marker = get(); // fill bytes
+        }
+        if (marker < 0 || marker == 0xD9 || marker == 0xDA) {
+            return false; // EOI or start of scan before any SOF
+        }
+        if (marker == 0x01 || (marker >= 0xD0 && marker <= 0xD7)) {
+            continue; // standalone markers carry no length
+        }
+        int hi = get(), lo = get();
+        if (hi < 0 || lo < 0) {
+            return false;
+        }
+        int len = (hi << 8) | lo;
+        if (len < 2) {
+            return false;
+        }
+        bool is_sof = marker >= 0xC0 && marker <= 0xCF &&
+                      marker != 0xC4 && marker != 0xC8 && marker != 0xCC;
+        if (is_sof) {
+            get(); // sample precision
+            int h_hi = get(), h_lo = get(), w_hi = get(), w_lo = get();
+            if (h_hi < 0 || h_lo < 0 || w_hi < 0 || w_lo < 0) {
+                return false; // truncated SOF
+            }
+            int h = (h_hi << 8) | h_lo, w = (w_hi << 8) | w_lo;
+            if (w == 0 || h == 0) {
+                return false;
+            }
+            size = cv::Size(w, h);
+            return true;
+        }
+        skip(len - 2);
+    }
+}
+
+bool read_jpeg_size(const path& p, cv::Size& size) {
+    std::ifstream in(p, std::ios::binary);
+    if (!in) {
+        return false;
+    }
+    auto get = [&in]() -> int {
+        char ch;
+        return in.get(ch) ? static_cast<unsigned char>(ch) : -1;
+    };
+    auto skip = [&in](int n) { in.seekg(n, std::ios::cur); };
+    return parse_jpeg_size(get, skip, size);
+}
+
+bool read_jpeg_size(const std::vector<unsigned char>& bytes, cv::Size& size) {
+    std::size_t pos = 0;
+    auto get = [&]() -> int { return pos < bytes.size() ? bytes[pos++] : -1; };
+    auto skip = [&](int n) { pos += static_cast<std::size_t>(n); };
+    return parse_jpeg_size(get, skip, size);
+}
+
+// Largest libjpeg scale denominator that still leaves max(w,h) >= max_dim.
+static int reduced_decode_factor(const cv::Size& full, int max_dim) {
+    if (max_dim <= 0) {
+        return 1;
+    }
+    const int m = std::max(full.width, full.height);
+    for (int f : {8, 4, 2}) {
+        if (m / f >= max_dim) {
+            return f;
+        }
+    }
+    return 1;
+}
+
+static int reduced_flag(int factor) {
+    switch (factor) {
+        case 8: return cv::IMREAD_REDUCED_COLOR_8;
+        case 4: return cv::IMREAD_REDUCED_COLOR_4;
+        case 2: return cv::IMREAD_REDUCED_COLOR_2;
+        default: return cv::IMREAD_COLOR;
+    }
+}
+
+// Sizes and final INTER_AREA downscale of a frame decoded at 1/'factor' of 'header_size'.
+static cv::Mat finish_decode(cv::Mat img,
+                             const cv::Size& header_size,
+                             int factor,
+                             int max_dim,
+                             cv::Size* original_size,
+                             bool* reduced,
+                             double* resize_ms) {
+    if (original_size) {
+        if (factor > 1) {
+            // EXIF orientation may have rotated the decoded image relative to the header.
+            bool header_landscape = header_size.width >= header_size.height;
+            bool decoded_landscape = img.cols >= img.rows;
+            *original_size = (header_landscape == decoded_landscape)
+                ? header_size
+                : cv::Size(header_size.height, header_size.width);
+        } else {
+            *original_size = img.size();
+        }
+    }
+    if (reduced) {
+        *reduced = factor > 1;
+    }
+
+    // Finish the downscale with INTER_AREA
+    auto t1 = Clock::now();
+    if (max_dim > 0) {
+        int m = std::max(img.cols, img.rows);
+        if (m > max_dim) {
+            double scale = static_cast<double>(max_dim) / static_cast<double>(m);
+            cv::resize(img, img, cv::Size(), scale, scale, cv::INTER_AREA);
+        }
+    }
+    if (resize_ms) {
+        *resize_ms = ms_since(t1);
+    }
+    return img;
+}
+
+static cv::Mat load_image_timed(const path& p,
+                                int max_dim,
+                                cv::Size* original_size,
+                                bool* reduced,
+                                double* decode_ms,
+                                double* resize_ms) {
+    auto t0 = Clock::now();
+
+    cv::Size header_size;
+    int factor = 1;
+    if (read_jpeg_size(p, header_size)) {
+        factor = reduced_decode_factor(header_size, max_dim);
+    }
+
+    cv::Mat img = cv::imread(p.string(), reduced_flag(factor));
+    if (decode_ms) {
+        *decode_ms = ms_since(t0);
+    }
+    if (img.empty()) {
+        return img;
+    }
+    return finish_decode(img, header_size, factor, max_dim, original_size, reduced, resize_ms);
+}
+
+cv::Mat load_image(const path& p, int max_dim, cv::Size* original_size, bool* reduced) {
+    return load_image_timed(p, max_dim, original_size, reduced, nullptr, nullptr);
+}
+
+cv::Mat decode_image(const std::vector<unsigned char>& bytes,
+                     int max_dim,
+                     cv::Size* original_size,
+                     bool* reduced) {
+    cv::Size header_size;
+    int factor = 1;
+    if (read_jpeg_size(bytes, header_size)) {
+        factor = reduced_decode_factor(header_size, max_dim);
+    }
+    // imdecode only reads the buffer; wrapping it avoids a copy
+    const cv::Mat buf(1, static_cast<int>(bytes.size()), CV_8U, const_cast<unsigned char*>(bytes.data()));
+    cv::Mat img = bytes.empty() ? cv::Mat() : cv::imdecode(buf, reduced_flag(factor));
+    if (img.empty()) {
+        return img;
+    }
+    return finish_decode(img, header_size, factor, max_dim, original_size, reduced, nullptr);
+}
+
+cv::Mat load_image_scaled(const path& p, const cv::Size& full_size, double scale) {
+    const int full_max = std::max(full_size.width, full_size.height);
+    const int target = std::max(1, cvRound(full_max * scale));
+    cv::Mat img = load_image(p, target >= full_max ? 0 : target);
+    if (!img.empty() && target > full_max) {
+        cv::resize(img, img, cv::Size(), scale, scale, cv::INTER_LINEAR);
+    }
+    return img;
+}
+
+// Decode 'paths' into slots of the result, one call per index; 'run' decides
+// how those calls are spread across threads.
+template <typename RunFn>
+static std::vector<LoadedImage> load_images_with(const std::vector<path>& paths,
+                                                 int max_dim,
+                                                 unsigned threads,
+                                                 LoadStats* stats,
+                                                 FrameStore* store,
+                                                 RunFn&& run) {
+    auto t0 = Clock::now();
+    std::vector<LoadedImage> out(paths.size());
+
+    std::mutex stats_mutex;
+    double decode_total = 0.0, resize_total = 0.0;
+    std::size_t reduced_total = 0;
+
+    // Each worker writes only its own slot, so output order matches 'paths'.
+    auto load_one = [&](std::size_t i) {
+        double decode_ms = 0.0, resize_ms = 0.0;
+        bool reduced = false;
+        out[i].path = paths[i];
+        out[i].image = load_image_timed(paths[i], max_dim, &out[i].original_size, &reduced,
+                                        &decode_ms, &resize_ms);
+        if (store && !out[i].image.empty()) {
+            out[i].image = store->put(i, out[i].image, 1);
+        }
+        std::lock_guard<std::mutex> lock(stats_mutex);
+        decode_total += decode_ms;
+        resize_total += resize_ms;
+        reduced_total += reduced ? 1 : 0;
+    };
+    run(paths.size(), std::function<void(std::size_t)>(load_one));
+
+    if (stats) {
+        stats->wall_ms = ms_since(t0);
+        stats->decode_ms = decode_total;
+        stats->resize_ms = resize_total;
+        stats->reduced_decodes = reduced_total;
+        stats->threads = threads;
+    }
+    return out;
+}
+
+std::vector<LoadedImage> load_images(const std::vector<path>& paths,
+                                     int max_dim,
+                                     unsigned num_threads,
+                                     LoadStats* stats,
+                                     FrameStore* store) {
+    unsigned threads = std::min<unsigned>(resolve_thread_count(num_threads),
+                                          static_cast<unsigned>(std::max<std::size_t>(paths.size(), 1)));
+    return load_images_with(paths, max_dim, threads, stats, store,
+                            [threads](std::size_t count, const std::function<void(std::size_t)>& fn) {
+        if (threads <= 1) {
+            for (std::size_t i = 0; i < count; ++i) {
+                fn(i);
+            }
+            return;
+        }
+        // The caller participates in parallel_for, so threads - 1 helpers suffice.
+        ThreadPool pool(threads - 1);
+        pool.parallel_for(count, fn);
+    });
+}
+
+std::vector<LoadedImage> load_images(const std::vector<path>& paths,
+                                     int max_dim,
+                                     ThreadPool& pool,
+                                     LoadStats* stats,
+                                     FrameStore* store) {
+    return load_images_with(paths, max_dim, pool.size() + 1, stats, store,
+                            [&pool](std::size_t count, const std::function<void(std::size_t)>& fn) {
+        pool.parallel_for(count, fn);
+    });
+}
+
+HeicCacheStats cache_heic_as_jpeg(std::vector<path>& paths,
+                                  const path& cache_dir,
+                                  ThreadPool* pool,
+                                  int jpg_quality,
+                                  std::string* report) {
+    auto t0 = Clock::now();
+    HeicCacheStats stats;
+
+    // Copies are named after the source and keyed by its path, size and mtime,
+    // so an edited or replaced original gets a fresh copy.
+    std::vector<std::size_t> todo;
+    std::vector<path> targets(paths.size());
+    for (std::size_t i = 0; i < paths.size(); ++i) {
+        if (!utils::is_heic_file(paths[i])) {
+            continue;
+        }
+        std::ostringstream settings;
+        settings << "heic-jpeg|q=" << jpg_quality;
+        targets[i] = cache_dir / (paths[i].stem().string() + "_" +
+                                  RegistrationCache::file_key(paths[i], settings.str()) + ".jpg");
+        std::error_code ec;
+        if (std::filesystem::exists(targets[i], ec)) {
+            paths[i] = targets[i];
+            ++stats.reused;
+        } else {
+            todo.push_back(i);
+        }
+    }
+    if (todo.empty()) {
+        stats.wall_ms = ms_since(t0);
+        return stats;
+    }
+
+    std::error_code ec;
+    std::filesystem::create_directories(cache_dir, ec);
+    std::vector<std::string> errors(todo.size());
+    auto convert_one = [&](std::size_t k) {
+        const path& src = paths[todo[k]];
+        const path& target = targets[todo[k]];
+        cv::Mat img = cv::imread(src.string(), cv::IMREAD_COLOR);
+        if (img.empty()) {
+            errors[k] = "failed to decode (check OpenCV HEIF support)";
+            return;
+        }
+        // Encode under a temporary name (keeping the .jpg extension for the encoder), then rename into place
+        path tmp = target;
+        tmp.replace_extension(".tmp" + std::to_string(k) + ".jpg");
+        if (!cv::imwrite(tmp.string(), img, {cv::IMWRITE_JPEG_QUALITY, std::clamp(jpg_quality, 1, 100)})) {
+            errors[k] = "failed to write " + tmp.string();
+            return;
+        }
+        std::error_code rename_ec;
+        std::filesystem::rename(tmp, target, rename_ec);
+        if (rename_ec) {
+            std::filesystem::remove(tmp, rename_ec);
+            errors[k] = "failed to move into cache: " + rename_ec.message();
+        }
+    };
+    if (pool) {
+        pool->parallel_for(todo.size(), convert_one);
+    } else {
+        unsigned threads = std::min<unsigned>(resolve_thread_count(0), static_cast<unsigned>(todo.size()));
+        if (threads <= 1) {
+            for (std::size_t k = 0; k < todo.size(); ++k) {
+                convert_one(k);
+            }
+        } else {
+            ThreadPool local(threads - 1);
+            local.parallel_for(todo.size(), convert_one);
+        }
+    }
+
+    std::ostringstream oss;
+    for (std::size_t k = 0; k < todo.size(); ++k) {
+        const std::size_t i = todo[k];
+        if (errors[k].empty()) {
+            oss << "Cached: " << paths[i].filename().string() << " -> " << targets[i].filename().string() << "\n";
+            paths[i] = targets[i];
+            ++stats.written;
+        } else {
+            oss << "Failed: " << paths[i].filename().string() << " (" << errors[k] << ")\n";
+            ++stats.failed;
+        }
+    }
+    if (report) {
+        *report = oss.str();
+    }
+    stats.wall_ms = ms_since(t0);
+    return stats;
+}
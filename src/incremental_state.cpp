@@ -0,0 +1,183 @@
+#include "incremental_state.hpp"
+
+#include <unordered_map>
+#include <opencv2/imgcodecs.hpp>
+
+namespace fs = std::filesystem;
+
+namespace {
+
+constexpr const char* kStateFile = "state.yml.gz";
+constexpr const char* kCanvasFile = "canvas.png";
+constexpr const char* kMaskFile = "canvas_mask.png";
+
+// cv::imwrite picks the encoder from the extension, so the temporary name keeps it.
+bool write_image_atomically(const fs::path& target, const cv::Mat& image, std::string* error_message) {
+    const fs::path tmp = target.parent_path() / ("tmp_" + target.filename().string());
+    const std::vector<int> params = {cv::IMWRITE_PNG_COMPRESSION, 1};
+    std::error_code ec;
+    if (!cv::imwrite(tmp.string(), image, params)) {
+        fs::remove(tmp, ec);
+        if (error_message) {
+            *error_message = "Failed to write " + tmp.string();
+        }
+        return false;
+    }
+    fs::rename(tmp, target, ec);
+    if (ec) {
+        fs::remove(tmp, ec);
+        if (error_message) {
+            *error_message = "Failed to replace " + target.string() + " (" + ec.message() + ")";
+        }
+        return false;
+    }
+    return true;
+}
+
+} // namespace
+
+bool load_incremental_state(const fs::path& dir, IncrementalState& state, std::string* error_message) {
+    auto fail = [&](const std::string& message) {
+        if (error_message) {
+            *error_message = message;
+        }
+        return false;
+    };
+
+    const fs::path descriptor = dir / kStateFile;
+    std::error_code ec;
+    if (!fs::exists(descriptor, ec)) {
+        return fail("No incremental state in " + dir.string());
+    }
+    try {
+        cv::FileStorage in(descriptor.string(), cv::FileStorage::READ);
+        if (!in.isOpened()) {
+            return fail("Failed to open " + descriptor.string());
+        }
+        int mode = 0;
+        cv::Size canvas_size;
+        in["settings"] >> state.settings;
+        in["mode"] >> mode;
+        in["compose_scale"] >> state.compose_scale;
+        in["warped_scale"] >> state.warped_scale;
+        in["origin"] >> state.origin;
+        in["canvas_size"] >> canvas_size;
+        in["frame_keys"] >> state.frame_keys;
+        state.registration = Registration();
+        state.registration.mode = static_cast<cv::Stitcher::Mode>(mode);
+        cv::FileNode frames = in["frames"];
+        for (auto it = frames.begin(); it != frames.end(); ++it) {
+            cv::Size full_size;
+            cv::detail::CameraParams c;
+            (*it)["size"] >> full_size;
+            (*it)["focal"] >> c.focal;
+            (*it)["aspect"] >> c.aspect;
+            (*it)["ppx"] >> c.ppx;
+            (*it)["ppy"] >> c.ppy;
+            (*it)["R"] >> c.R;
+            (*it)["t"] >> c.t;
+            state.registration.full_sizes.push_back(full_size);
+            state.registration.cameras.push_back(c);
+        }
+        in.release();
+
+        const std::size_t n = state.registration.cameras.size();
+        if (n == 0 || state.frame_keys.size() != n || state.warped_scale <= 0.f) {
+            return fail("Incomplete incremental state in " + descriptor.string());
+        }
+        state.registration.indices.resize(n);
+        for (std::size_t k = 0; k < n; ++k) {
+            state.registration.indices[k] = static_cast<int>(k);
+        }
+
+        state.canvas = cv::imread((dir / kCanvasFile).string(), cv::IMREAD_COLOR);
+        state.canvas_mask = cv::imread((dir / kMaskFile).string(), cv::IMREAD_GRAYSCALE);
+        if (cv::Size(state.canvas.cols, state.canvas.rows) != canvas_size ||
+            cv::Size(state.canvas_mask.cols, state.canvas_mask.rows) != canvas_size) {
+            return fail("Incremental canvas in " + dir.string() + " is missing or does not match its state");
+        }
+        return true;
+    } catch (const cv::Exception& ex) {
+        return fail(ex.what());
+    }
+}
+
+bool save_incremental_state(const fs::path& dir, const IncrementalState& state, std::string* error_message) {
+    std::error_code ec;
+    fs::create_directories(dir, ec);
+    if (ec) {
+        if (error_message) {
+            *error_message = "Failed to create " + dir.string() + " (" + ec.message() + ")";
+        }
+        return false;
+    }
+    if (!write_image_atomically(dir / kCanvasFile, state.canvas, error_message) ||
+        !write_image_atomically(dir / kMaskFile, state.canvas_mask, error_message)) {
+        return false;
+    }
+
+    const fs::path descriptor = dir / kStateFile;
+    const fs::path tmp = dir / (std::string("tmp_") + kStateFile);
+    try {
+        cv::FileStorage out(tmp.string(), cv::FileStorage::WRITE);
+        if (!out.isOpened()) {
+            if (error_message) {
+                *error_message = "Failed to write " + tmp.string();
+            }
+            return false;
+        }
+        const Registration& reg = state.registration;
+        out << "settings" << state.settings;
+        out << "mode" << static_cast<int>(reg.mode);
+        out << "compose_scale" << state.compose_scale;
+        out << "warped_scale" << state.warped_scale;
+        out << "origin" << state.origin;
+        out << "canvas_size" << cv::Size(state.canvas.cols, state.canvas.rows);
+        out << "frame_keys" << state.frame_keys;
+        out << "frames" << "[";
+        for (std::size_t k = 0; k < reg.cameras.size(); ++k) {
+            const cv::detail::CameraParams& c = reg.cameras[k];
+            out << "{";
+            out << "size" << reg.full_sizes[k];
+            out << "focal" << c.focal << "aspect" << c.aspect << "ppx" << c.ppx << "ppy" << c.ppy;
+            out << "R" << c.R << "t" << c.t;
+            out << "}";
+        }
+        out << "]";
+        out.release();
+    } catch (const cv::Exception& ex) {
+        fs::remove(tmp, ec);
+        if (error_message) {
+            *error_message = ex.what();
+        }
+        return false;
+    }
+    fs::rename(tmp, descriptor, ec);
+    if (ec) {
+        fs::remove(tmp, ec);
+        if (error_message) {
+            *error_message = "Failed to replace " + descriptor.string() + " (" + ec.message() + ")";
+        }
+        return false;
+    }
+    return true;
+}
+
+bool resolve_incremental_frames(const IncrementalState& state,
+                                const std::vector<std::string>& frame_keys,
+                                const std::vector<cv::Size>& full_sizes,
+                                Registration& previous) {
+    std::unordered_map<std::string, int> current;
+    for (std::size_t i = 0; i < frame_keys.size(); ++i) {
+        current.emplace(frame_keys[i], static_cast<int>(i));
+    }
+    previous = state.registration;
+    for (std::size_t k = 0; k < state.frame_keys.size(); ++k) {
+        auto it = current.find(state.frame_keys[k]);
+        if (it == current.end() || full_sizes[it->second] != state.registration.full_sizes[k]) {
+            return false;
+        }
+        previous.indices[k] = it->second;
+    }
+    return true;
+}
@@ -0,0 +1,100 @@
+#include "mapped_file.hpp"
+
+#include <cerrno>
+#include <cstring>
+#include <new>
+#include <vector>
+
+#if !defined(_WIN32)
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
+
+MappedFile::~MappedFile() {
+    release();
+}
+
+void MappedFile::release() {
+#if !defined(_WIN32)
+    if (mapped_ && data_) {
+        munmap(data_, size_);
+    }
+#endif
+    heap_.reset();
+    data_ = nullptr;
+    size_ = 0;
+    mapped_ = false;
+}
+
+void MappedFile::evict() {
+#if !defined(_WIN32)
+    // Shared file mappings keep dirty pages in the page cache, so nothing is lost;
+    // the kernel writes them back and reclaims them as it sees fit.
+    if (mapped_ && data_) {
+        madvise(data_, size_, MADV_DONTNEED);
+    }
+#endif
+}
+
+bool MappedFile::create(const std::filesystem::path& dir, std::size_t bytes, std::string* error_message) {
+    release();
+    if (bytes == 0) {
+        if (error_message) {
+            *error_message = "Requested an empty scratch buffer";
+        }
+        return false;
+    }
+
+#if !defined(_WIN32)
+    std::filesystem::path base = dir.empty() ? std::filesystem::temp_directory_path() : dir;
+    std::string tmpl = (base / "panorama_scratch_XXXXXX").string();
+    std::vector<char> name(tmpl.begin(), tmpl.end());
+    name.push_back('\0');
+
+    int fd = mkstemp(name.data());
+    if (fd < 0) {
+        if (error_message) {
+            *error_message = std::string("Failed to create scratch file: ") + std::strerror(errno);
+        }
+        return false;
+    }
+    // Unlink right away: the mapping keeps the storage alive and nothing is left behind on exit.
+    unlink(name.data());
+
+    // ftruncate extends the file with zeros without touching any pages.
+    if (ftruncate(fd, static_cast<off_t>(bytes)) != 0) {
+        if (error_message) {
+            *error_message = std::string("Failed to size scratch file: ") + std::strerror(errno);
+        }
+        close(fd);
+        return false;
+    }
+
+    void* p = mmap(nullptr, bytes, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (p == MAP_FAILED) {
+        if (error_message) {
+            *error_message = std::string("Failed to map scratch file: ") + std::strerror(errno);
+        }
+        return false;
+    }
+    data_ = static_cast<unsigned char*>(p);
+    size_ = bytes;
+    mapped_ = true;
+    return true;
+#else
+    (void)dir;
+    heap_.reset(new (std::nothrow) unsigned char[bytes]());
+    if (!heap_) {
+        if (error_message) {
+            *error_message = "Failed to allocate scratch buffer";
+        }
+        return false;
+    }
+    data_ = heap_.get();
+    size_ = bytes;
+    mapped_ = false;
+    return true;
+#endif
+}
@@ -0,0 +1,587 @@
+#include "output_writer.hpp"
+#include "profiler.hpp"
+#include "thread_pool.hpp"
+
+#include <algorithm>
+#include <cctype>
+#include <cstdint>
+#include <fstream>
+#include <functional>
+#include <memory>
+#include <string>
+#include <vector>
+#include <opencv2/imgcodecs.hpp>
+#include <opencv2/imgproc.hpp>
+
+namespace fs = std::filesystem;
+
+namespace {
+
+std::string lower_ext(const fs::path& p) {
+    std::string ext = p.extension().string();
+    std::transform(ext.begin(), ext.end(), ext.begin(), [](unsigned char c) { return std::tolower(c); });
+    return ext;
+}
+
+// Run fn(i) for i in [0, count) on 'pool', or on the calling thread when null.
+void run_parallel(ThreadPool* pool, std::size_t count, const std::function<void(std::size_t)>& fn) {
+    if (pool && count > 1) {
+        pool->parallel_for(count, fn);
+        return;
+    }
+    for (std::size_t i = 0; i < count; ++i) {
+        fn(i);
+    }
+}
+
+// ---------------------------------------------------------------------------
+// Restart-marker JPEG
+//
+// Every strip is a complete baseline JPEG of whole MCU rows, encoded with the
+// same quality and therefore the same (standard) quantisation and Huffman
+// tables, and with a restart interval of one MCU row. Restart markers reset
+// the DC predictors, so the entropy-coded segments of consecutive strips can
+// be concatenated: the first strip's headers are kept (with the frame height
+// patched), every strip's scan data is appended, and all RSTn markers are
+// renumbered so they keep cycling 0..7 across the joins.
+
+struct JpegLayout {
+    std::size_t sof_height{0}; // offset of the 2-byte frame height
+    std::size_t scan_begin{0}; // first byte of entropy-coded data
+    std::size_t scan_end{0};   // offset of the EOI marker
+    int mcu_width{8};
+    int mcu_height{8};
+};
+
+bool parse_jpeg(const std::vector<uchar>& buf, JpegLayout& layout) {
+    const std::size_t n = buf.size();
+    if (n < 4 || buf[0] != 0xFF || buf[1] != 0xD8 || buf[n - 2] != 0xFF || buf[n - 1] != 0xD9) {
+        return false;
+    }
+    bool have_sof = false;
+    std::size_t pos = 2;
+    while (pos + 4 <= n) {
+        if (buf[pos] != 0xFF) {
+            return false;
+        }
+        const uchar marker = buf[pos + 1];
+        pos += 2;
+        if (marker == 0xFF) {
+            pos -= 1; // fill byte
+            continue;
+        }
+        const std::size_t len = (static_cast<std::size_t>(buf[pos]) << 8) | buf[pos + 1];
+        if (len < 2 || pos + len > n) {
+            return false;
+        }
+        if (marker == 0xC0 || marker == 0xC1) {
+            // length(2) precision(1) height(2) width(2) components(1) then id/sampling/table per component
+            const int components = buf[pos + 7];
+            int hmax = 1, vmax = 1;
+            for (int c = 0; c < components; ++c) {
+                const uchar sampling = buf[pos + 9 + 3 * c];
+                hmax = std::max(hmax, sampling >> 4);
+                vmax = std::max(vmax, sampling & 0x0F);
+            }
+            layout.sof_height = pos + 3;
+            layout.mcu_width = 8 * hmax;
+            layout.mcu_height = 8 * vmax;
+            have_sof = true;
+        } else if ((marker >= 0xC2 && marker <= 0xCF && marker != 0xC4 && marker != 0xC8 && marker != 0xCC)) {
+            return false; // progressive/lossless/arithmetic: not spliceable
+        } else if (marker == 0xDA) {
+            layout.scan_begin = pos + len;
+            layout.scan_end = n - 2;
+            return have_sof;
+        }
+        pos += len;
+    }
+    return false;
+}
+
+// Headers of two strips must be identical apart from the frame height.
+bool same_headers(const std::vector<uchar>& a, const JpegLayout& la, const std::vector<uchar>& b, const JpegLayout& lb) {
+    if (la.scan_begin != lb.scan_begin || la.sof_height != lb.sof_height) {
+        return false;
+    }
+    for (std::size_t i = 0; i < la.scan_begin; ++i) {
+        if (i == la.sof_height || i == la.sof_height + 1) {
+            continue;
+        }
+        if (a[i] != b[i]) {
+            return false;
+        }
+    }
+    return true;
+}
+
+// Append a strip's scan data to 'out', renumbering its restart markers from 'next_rst'.
+void append_scan(std::ostream& out, const std::vector<uchar>& buf, const JpegLayout& layout, int& next_rst) {
+    std::vector<uchar> scan;
+    scan.reserve(layout.scan_end - layout.scan_begin);
+    for (std::size_t i = layout.scan_begin; i < layout.scan_end; ++i) {
+        const uchar b = buf[i];
+        scan.push_back(b);
+        if (b == 0xFF && i + 1 < layout.scan_end) {
+            const uchar next = buf[++i];
+            if (next >= 0xD0 && next <= 0xD7) {
+                scan.push_back(static_cast<uchar>(0xD0 + next_rst));
+                next_rst = (next_rst + 1) & 7;
+            } else {
+                scan.push_back(next); // stuffed zero
+            }
+        }
+    }
+    out.write(reinterpret_cast<const char*>(scan.data()), static_cast<std::streamsize>(scan.size()));
+}
+
+bool write_rst_jpeg(const cv::Mat& image, std::ostream& out, const std::string& target, const OutputOptions& options,
+                    ThreadPool* pool, OutputReport* report, std::string& error_message) {
+    if (image.cols > 65535 || image.rows > 65535) {
+        error_message = "JPEG is limited to 65535x65535 pixels; write a .tif instead";
+        return false;
+    }
+
+    // Probe the encoder's MCU size (depends on chroma subsampling and channel count)
+    std::vector<int> params = {cv::IMWRITE_JPEG_QUALITY, std::clamp(options.jpeg_quality, 0, 100)};
+    JpegLayout probe_layout;
+    {
+        std::vector<uchar> probe;
+        cv::Mat tiny(16, 16, image.type(), cv::Scalar::all(128));
+        if (!cv::imencode(".jpg", tiny, probe, params) || !parse_jpeg(probe, probe_layout)) {
+            return false;
+        }
+    }
+    const int mcu_w = probe_layout.mcu_width;
+    const int mcu_h = probe_layout.mcu_height;
+    const int mcus_per_row = (image.cols + mcu_w - 1) / mcu_w;
+    const int mcu_rows = (image.rows + mcu_h - 1) / mcu_h;
+    if (mcus_per_row > 65535) {
+        return false;
+    }
+
+    // Strips of whole MCU rows: about four per worker, capped so a batch stays small
+    const unsigned workers = pool ? pool->size() + 1 : 1;
+    const int rows_per_strip = std::clamp(mcu_rows / static_cast<int>(workers * 4), 1, std::max(1, 1024 / mcu_h));
+    const int strip_h = rows_per_strip * mcu_h;
+    const int strips = (image.rows + strip_h - 1) / strip_h;
+    if (strips < 2) {
+        return false; // nothing to parallelise; let the caller use cv::imwrite
+    }
+    params.push_back(cv::IMWRITE_JPEG_RST_INTERVAL);
+    params.push_back(mcus_per_row);
+
+    std::vector<uchar> first;
+    JpegLayout first_layout;
+    int next_rst = 0;
+    bool ok = true;
+    const int batch = static_cast<int>(workers) * 2;
+    for (int b0 = 0; b0 < strips && ok; b0 += batch) {
+        const int count = std::min(batch, strips - b0);
+        std::vector<std::vector<uchar>> encoded(count);
+        std::vector<char> encoded_ok(count, 0);
+        run_parallel(pool, static_cast<std::size_t>(count), [&](std::size_t k) {
+            const int y0 = (b0 + static_cast<int>(k)) * strip_h;
+            const int y1 = std::min(image.rows, y0 + strip_h);
+            encoded_ok[k] = cv::imencode(".jpg", image.rowRange(y0, y1), encoded[k], params);
+        });
+        for (int k = 0; k < count && ok; ++k) {
+            JpegLayout layout;
+            if (!encoded_ok[k] || !parse_jpeg(encoded[k], layout)) {
+                ok = false;
+                break;
+            }
+            if (b0 + k == 0) {
+                // Headers of the first strip, with the frame height of the whole image
+                first = encoded[k];
+                first_layout = layout;
+                first[layout.sof_height] = static_cast<uchar>(image.rows >> 8);
+                first[layout.sof_height + 1] = static_cast<uchar>(image.rows & 0xFF);
+                out.write(reinterpret_cast<const char*>(first.data()), static_cast<std::streamsize>(layout.scan_begin));
+            } else {
+                if (!same_headers(first, first_layout, encoded[k], layout)) {
+                    ok = false;
+                    break;
+                }
+                // Close the previous strip's last restart interval
+                const uchar rst[2] = {0xFF, static_cast<uchar>(0xD0 + next_rst)};
+                next_rst = (next_rst + 1) & 7;
+                out.write(reinterpret_cast<const char*>(rst), 2);
+            }
+            append_scan(out, encoded[k], layout, next_rst);
+            encoded[k].clear();
+            encoded[k].shrink_to_fit();
+        }
+    }
+    if (!ok) {
+        return false; // caller falls back to OpenCV's encoder, which replaces what was written
+    }
+    const uchar eoi[2] = {0xFF, 0xD9};
+    out.write(reinterpret_cast<const char*>(eoi), 2);
+    out.flush();
+    if (!out) {
+        error_message = "Failed to write " + target;
+        return false;
+    }
+    if (report) {
+        report->format = "jpeg(rst, " + std::to_string(strips) + " strips)";
+    }
+    return true;
+}
+
+// ---------------------------------------------------------------------------
+// Tiled (Big)TIFF, uncompressed RGB(8-bit)
+//
+// Tiles are stored in row-major order right after the header, so every tile
+// offset is known up front; the tag arrays and the single IFD follow them.
+
+class TiffBuilder {
+public:
+    explicit TiffBuilder(bool big) : big_(big) {}
+
+    std::size_t header_size() const { return big_ ? 16 : 8; }
+    std::size_t offset_size() const { return big_ ? 8 : 4; }
+
+    void header(std::vector<uchar>& b, std::uint64_t ifd_offset) const {
+        b.push_back('I');
+        b.push_back('I');
+        if (big_) {
+            put(b, 43, 2);
+            put(b, 8, 2);
+            put(b, 0, 2);
+            put(b, ifd_offset, 8);
+        } else {
+            put(b, 42, 2);
+            put(b, ifd_offset, 4);
+        }
+    }
+
+    // IFD entry whose values are inline or stored at 'external' when they do not fit.
+    void entry(std::vector<uchar>& b, int tag, int type, std::uint64_t count, std::uint64_t value_or_offset,
+               const std::vector<std::uint64_t>* inline_values = nullptr) const {
+        put(b, static_cast<std::uint64_t>(tag), 2);
+        put(b, static_cast<std::uint64_t>(type), 2);
+        put(b, count, offset_size());
+        const std::size_t field = offset_size();
+        const std::size_t start = b.size();
+        if (inline_values) {
+            const std::size_t width = type_size(type);
+            for (std::uint64_t v : *inline_values) {
+                put(b, v, width);
+            }
+        } else {
+            put(b, value_or_offset, field);
+        }
+        while (b.size() < start + field) {
+            b.push_back(0);
+        }
+    }
+
+    std::size_t ifd_size(std::size_t entries) const {
+        return big_ ? 8 + entries * 20 + 8 : 2 + entries * 12 + 4;
+    }
+
+    static std::size_t type_size(int type) {
+        switch (type) {
+            case kShort: return 2;
+            case kLong: return 4;
+            default: return 8;
+        }
+    }
+
+    static void put(std::vector<uchar>& b, std::uint64_t v, std::size_t bytes) {
+        for (std::size_t i = 0; i < bytes; ++i) {
+            b.push_back(static_cast<uchar>((v >> (8 * i)) & 0xFF));
+        }
+    }
+
+    static constexpr int kShort = 3;
+    static constexpr int kLong = 4;
+    static constexpr int kLong8 = 16;
+
+private:
+    bool big_;
+};
+
+bool write_tiled_tiff(const cv::Mat& image, std::ostream& out, const std::string& target, const OutputOptions& options,
+                      ThreadPool* pool, OutputReport* report, std::string& error_message) {
+    if (image.type() != CV_8UC3) {
+        return false;
+    }
+    const int tile = std::max(16, options.tiff_tile / 16 * 16);
+    const int tiles_x = (image.cols + tile - 1) / tile;
+    const int tiles_y = (image.rows + tile - 1) / tile;
+    const std::uint64_t tile_bytes = static_cast<std::uint64_t>(tile) * tile * 3;
+    const std::uint64_t n_tiles = static_cast<std::uint64_t>(tiles_x) * tiles_y;
+
+    // Classic TIFF offsets are 32-bit; leave headroom for the tag arrays and IFD
+    const std::uint64_t data_bytes = n_tiles * tile_bytes;
+    const bool big = options.force_bigtiff || data_bytes + n_tiles * 16 + 4096 > 0xFFFFFFFFull;
+    TiffBuilder tb(big);
+    const int offset_type = big ? TiffBuilder::kLong8 : TiffBuilder::kLong;
+    const std::size_t osz = tb.offset_size();
+
+    // Layout: header | tiles | BitsPerSample | TileOffsets | TileByteCounts | IFD
+    const std::uint64_t tiles_at = tb.header_size();
+    std::uint64_t pos = tiles_at + data_bytes;
+    const std::uint64_t bps_at = pos;
+    pos += 8;
+    const std::uint64_t offsets_at = pos;
+    pos += n_tiles * osz;
+    const std::uint64_t counts_at = pos;
+    pos += n_tiles * osz;
+    pos = (pos + 7) & ~static_cast<std::uint64_t>(7);
+    const std::uint64_t ifd_at = pos;
+
+    std::vector<uchar> head;
+    tb.header(head, ifd_at);
+    out.write(reinterpret_cast<const char*>(head.data()), static_cast<std::streamsize>(head.size()));
+
+    // One row of tiles at a time: tiles are converted to RGB and padded in parallel, then streamed out
+    std::vector<uchar> row(static_cast<std::size_t>(tiles_x) * tile_bytes);
+    for (int ty = 0; ty < tiles_y; ++ty) {
+        PROFILE_SCOPE("encode_tiles");
+        run_parallel(pool, static_cast<std::size_t>(tiles_x), [&](std::size_t tx) {
+            uchar* dst = row.data() + tx * tile_bytes;
+            cv::Mat tile_mat(tile, tile, CV_8UC3, dst);
+            const cv::Rect r = cv::Rect(static_cast<int>(tx) * tile, ty * tile, tile, tile) &
+                               cv::Rect(0, 0, image.cols, image.rows);
+            if (r.width < tile || r.height < tile) {
+                tile_mat.setTo(cv::Scalar::all(0));
+            }
+            cv::Mat dst_roi = tile_mat(cv::Rect(0, 0, r.width, r.height));
+            cv::cvtColor(image(r), dst_roi, cv::COLOR_BGR2RGB);
+        });
+        out.write(reinterpret_cast<const char*>(row.data()), static_cast<std::streamsize>(row.size()));
+        if (!out) {
+            error_message = "Failed to write " + target;
+            return false;
+        }
+    }
+
+    std::vector<uchar> tail;
+    for (int i = 0; i < 4; ++i) {
+        TiffBuilder::put(tail, i < 3 ? 8 : 0, 2); // BitsPerSample 8,8,8 (+ padding)
+    }
+    for (std::uint64_t k = 0; k < n_tiles; ++k) {
+        TiffBuilder::put(tail, tiles_at + k * tile_bytes, osz);
+    }
+    for (std::uint64_t k = 0; k < n_tiles; ++k) {
+        TiffBuilder::put(tail, tile_bytes, osz);
+    }
+    while (bps_at + tail.size() < ifd_at) {
+        tail.push_back(0);
+    }
+
+    // Entries sorted by tag, as TIFF requires
+    const std::size_t entries = 11;
+    if (big) {
+        TiffBuilder::put(tail, entries, 8);
+    } else {
+        TiffBuilder::put(tail, entries, 2);
+    }
+    const bool offsets_inline = n_tiles * osz <= osz;
+    const std::vector<std::uint64_t> bps_inline = {8, 8, 8};
+    tb.entry(tail, 256, TiffBuilder::kLong, 1, static_cast<std::uint64_t>(image.cols)); // ImageWidth
+    tb.entry(tail, 257, TiffBuilder::kLong, 1, static_cast<std::uint64_t>(image.rows)); // ImageLength
+    if (big) {
+        tb.entry(tail, 258, TiffBuilder::kShort, 3, 0, &bps_inline); // BitsPerSample fits in 8 bytes
+    } else {
+        tb.entry(tail, 258, TiffBuilder::kShort, 3, bps_at);
+    }
+    tb.entry(tail, 259, TiffBuilder::kShort, 1, 1);  // Compression: none
+    tb.entry(tail, 262, TiffBuilder::kShort, 1, 2);  // Photometric: RGB
+    tb.entry(tail, 277, TiffBuilder::kShort, 1, 3);  // SamplesPerPixel
+    tb.entry(tail, 284, TiffBuilder::kShort, 1, 1);  // PlanarConfiguration: chunky
+    tb.entry(tail, 322, TiffBuilder::kLong, 1, static_cast<std::uint64_t>(tile)); // TileWidth
+    tb.entry(tail, 323, TiffBuilder::kLong, 1, static_cast<std::uint64_t>(tile)); // TileLength
+    tb.entry(tail, 324, offset_type, n_tiles, offsets_inline ? tiles_at : offsets_at); // TileOffsets
+    tb.entry(tail, 325, offset_type, n_tiles, offsets_inline ? tile_bytes : counts_at); // TileByteCounts
+    TiffBuilder::put(tail, 0, osz); // no further IFD
+    out.write(reinterpret_cast<const char*>(tail.data()), static_cast<std::streamsize>(tail.size()));
+    out.flush();
+    if (!out) {
+        error_message = "Failed to write " + target;
+        return false;
+    }
+    if (report) {
+        report->format = big ? "bigtiff(tiled)" : "tiff(tiled)";
+    }
+    return true;
+}
+
+// std::streambuf appending everything written to a byte vector.
+class VectorSink : public std::streambuf {
+public:
+    explicit VectorSink(std::vector<uchar>& bytes) : bytes_(bytes) {}
+
+protected:
+    int_type overflow(int_type c) override {
+        if (!traits_type::eq_int_type(c, traits_type::eof())) {
+            bytes_.push_back(static_cast<uchar>(c));
+        }
+        return traits_type::not_eof(c);
+    }
+    std::streamsize xsputn(const char* s, std::streamsize n) override {
+        bytes_.insert(bytes_.end(), s, s + n);
+        return n;
+    }
+
+private:
+    std::vector<uchar>& bytes_;
+};
+
+// True if 'ext' has a parallel encoder here for this image.
+bool parallel_format(const cv::Mat& image, const std::string& ext) {
+    return ((ext == ".jpg" || ext == ".jpeg") && image.depth() == CV_8U) || ext == ".tif" || ext == ".tiff";
+}
+
+// Encode with the parallel JPEG/TIFF writers. Returns false with an empty error_message
+// when they do not apply, so the caller uses OpenCV's own encoder instead.
+bool encode_parallel(const cv::Mat& image, const std::string& ext, std::ostream& out, const std::string& target,
+                     const OutputOptions& options, ThreadPool* pool, OutputReport* report,
+                     std::string& error_message) {
+    if (ext == ".jpg" || ext == ".jpeg") {
+        return write_rst_jpeg(image, out, target, options, pool, report, error_message);
+    }
+    return write_tiled_tiff(image, out, target, options, pool, report, error_message);
+}
+
+// A private pool for the parallel encoders when the caller has none.
+std::unique_ptr<ThreadPool> encode_pool(ThreadPool*& pool, unsigned requested) {
+    std::unique_ptr<ThreadPool> own_pool;
+    if (!pool) {
+        const unsigned threads = resolve_thread_count(requested);
+        if (threads > 1) {
+            own_pool = std::make_unique<ThreadPool>(threads - 1);
+            pool = own_pool.get();
+        }
+    }
+    return own_pool;
+}
+
+} // namespace
+
+bool write_panorama(const cv::Mat& image,
+                    const fs::path& file,
+                    const OutputOptions& options,
+                    ThreadPool* pool,
+                    OutputReport* report,
+                    std::string& error_message) {
+    if (image.empty()) {
+        error_message = "Nothing to write";
+        return false;
+    }
+    OutputReport local;
+    OutputReport& rep = report ? *report : local;
+    rep = OutputReport();
+
+    try {
+        std::unique_ptr<ThreadPool> own_pool = encode_pool(pool, options.threads);
+
+        const std::string ext = lower_ext(file);
+        bool written = false;
+        error_message.clear();
+        if (parallel_format(image, ext)) {
+            std::ofstream out(file, std::ios::binary | std::ios::trunc);
+            if (!out) {
+                error_message = "Cannot open " + file.string() + " for writing";
+                return false;
+            }
+            written = encode_parallel(image, ext, out, file.string(), options, pool, &rep, error_message);
+        }
+        if (!written && !error_message.empty()) {
+            return false;
+        }
+        if (!written) {
+            // Small images, unsupported types and other formats
+            if (!cv::imwrite(file.string(), image, {cv::IMWRITE_JPEG_QUALITY, options.jpeg_quality})) {
+                error_message = "Failed to save output image to: " + file.string();
+                return false;
+            }
+            rep.format = "imwrite";
+        }
+        std::error_code ec;
+        rep.bytes = static_cast<std::size_t>(fs::file_size(file, ec));
+
+        if (options.thumbnail_dim > 0) {
+            return write_thumbnail(image, file, options.thumbnail_dim, &rep.thumbnail, error_message);
+        }
+        return true;
+    } catch (const std::exception& ex) {
+        error_message = ex.what();
+        return false;
+    }
+}
+
+bool write_thumbnail(const cv::Mat& image,
+                     const fs::path& file,
+                     int max_dim,
+                     fs::path* thumbnail,
+                     std::string& error_message) {
+    PROFILE_SCOPE("thumbnail");
+    try {
+        const int m = std::max(image.cols, image.rows);
+        const double scale = std::min(1.0, static_cast<double>(max_dim) / m);
+        cv::Mat thumb;
+        cv::resize(image, thumb, cv::Size(), scale, scale, cv::INTER_AREA);
+        fs::path thumb_file = file.parent_path() / (file.stem().string() + "_thumb.jpg");
+        if (!cv::imwrite(thumb_file.string(), thumb, {cv::IMWRITE_JPEG_QUALITY, 85})) {
+            error_message = "Failed to save thumbnail to: " + thumb_file.string();
+            return false;
+        }
+        if (thumbnail) {
+            *thumbnail = thumb_file;
+        }
+        return true;
+    } catch (const std::exception& ex) {
+        error_message = ex.what();
+        return false;
+    }
+}
+
+bool encode_panorama(const cv::Mat& image,
+                     const std::string& ext,
+                     const OutputOptions& options,
+                     ThreadPool* pool,
+                     std::vector<unsigned char>& bytes,
+                     OutputReport* report,
+                     std::string& error_message) {
+    bytes.clear();
+    if (image.empty()) {
+        error_message = "Nothing to encode";
+        return false;
+    }
+    OutputReport local;
+    OutputReport& rep = report ? *report : local;
+    rep = OutputReport();
+
+    try {
+        std::unique_ptr<ThreadPool> own_pool = encode_pool(pool, options.threads);
+
+        std::string lower = ext;
+        std::transform(lower.begin(), lower.end(), lower.begin(), [](unsigned char c) { return std::tolower(c); });
+        bool written = false;
+        error_message.clear();
+        if (parallel_format(image, lower)) {
+            VectorSink sink(bytes);
+            std::ostream out(&sink);
+            written = encode_parallel(image, lower, out, "in-memory " + lower, options, pool, &rep, error_message);
+        }
+        if (!written && !error_message.empty()) {
+            return false;
+        }
+        if (!written) {
+            if (!cv::imencode(lower, image, bytes, {cv::IMWRITE_JPEG_QUALITY, options.jpeg_quality})) {
+                error_message = "Failed to encode the panorama as " + ext;
+                return false;
+            }
+            rep.format = "imencode";
+        }
+        rep.bytes = bytes.size();
+        return true;
+    } catch (const std::exception& ex) {
+        error_message = ex.what();
+        return false;
+    }
+}
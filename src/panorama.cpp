@@ -0,0 +1,328 @@
+#include "panorama.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <memory>
+#include <mutex>
+#include <opencv2/imgproc.hpp>
+
+#include "cli.hpp"
+#include "image_io.hpp"
+#include "output_writer.hpp"
+#include "panorama_stitcher.hpp"
+#include "profiler.hpp"
+#include "thread_pool.hpp"
+#include "utils.hpp"
+
+using Clock = std::chrono::steady_clock;
+
+static double ms_since(Clock::time_point t0) {
+    return std::chrono::duration<double, std::milli>(Clock::now() - t0).count();
+}
+
+namespace panorama {
+
+const char* stage_name(Stage stage) {
+    switch (stage) {
+        case Stage::Decode: return "decode";
+        case Stage::Register: return "register";
+        case Stage::Compose: return "compose";
+        case Stage::Crop: return "crop";
+        case Stage::Encode: return "encode";
+    }
+    return "unknown";
+}
+
+namespace {
+
+// Serialises progress calls and remembers a cancellation.
+class Progress {
+public:
+    explicit Progress(const ProgressCallback& callback) : callback_(callback) {}
+
+    bool report(Stage stage, std::size_t done, std::size_t total) {
+        if (cancelled_) {
+            return false;
+        }
+        if (!callback_) {
+            return true;
+        }
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (!cancelled_ && !callback_(stage, done, total)) {
+            cancelled_ = true;
+        }
+        return !cancelled_;
+    }
+
+    bool cancelled() const { return cancelled_; }
+
+private:
+    const ProgressCallback& callback_;
+    std::mutex mutex_;
+    std::atomic<bool> cancelled_{false};
+};
+
+// 'image' as BGR with max(width,height) <= max_dim; shared, not copied, when it already is.
+cv::Mat fit_frame(const cv::Mat& image, int max_dim) {
+    cv::Mat bgr = image;
+    if (image.channels() == 1) {
+        cv::cvtColor(image, bgr, cv::COLOR_GRAY2BGR);
+    } else if (image.channels() == 4) {
+        cv::cvtColor(image, bgr, cv::COLOR_BGRA2BGR);
+    }
+    const int longest = std::max(bgr.cols, bgr.rows);
+    if (max_dim > 0 && longest > max_dim) {
+        const double scale = static_cast<double>(max_dim) / longest;
+        cv::Mat scaled;
+        cv::resize(bgr, scaled, cv::Size(), scale, scale, cv::INTER_AREA);
+        return scaled;
+    }
+    return bgr;
+}
+
+// Configure 'stitcher' as run_pipeline() does for the matching command line flags.
+void configure(const StitchOptions& options, OpenCVStitcher& stitcher, std::vector<std::string>& warnings) {
+    double rx = 0.0, ry = 0.0, rw = 1.0, rh = 1.0;
+    if (!parse_match_region(options.match_region, rx, ry, rw, rh)) {
+        warnings.push_back("ignoring invalid match region '" + options.match_region + "'");
+        rx = 0.0, ry = 0.0, rw = 1.0, rh = 1.0;
+    }
+    stitcher.set_match_region(cv::Rect2d(rx, ry, rw, rh));
+    FeatureOptions features;
+    if (!options.quality.empty() && !feature_preset(options.quality, features)) {
+        warnings.push_back("ignoring unknown quality preset '" + options.quality + "'");
+    }
+    if (!options.features.empty() && !parse_feature_backend(options.features, features.backend)) {
+        warnings.push_back("ignoring unknown feature detector '" + options.features + "'");
+    }
+    if (options.max_keypoints >= 0) {
+        features.max_keypoints = options.max_keypoints;
+    }
+    stitcher.set_features(features);
+    stitcher.set_memory_budget_mb(options.memory_budget_mb);
+    stitcher.set_match_window(options.match_window, options.match_wrap);
+    SeamMethod seam;
+    if (!options.seam.empty()) {
+        if (parse_seam_method(options.seam, seam)) {
+            stitcher.set_seam_method(seam);
+        } else {
+            warnings.push_back("ignoring unknown seam finder '" + options.seam + "'");
+        }
+    }
+    ExposureMethod exposure;
+    if (!options.exposure.empty()) {
+        if (parse_exposure_method(options.exposure, exposure)) {
+            stitcher.set_exposure_method(exposure);
+        } else {
+            warnings.push_back("ignoring unknown exposure compensator '" + options.exposure + "'");
+        }
+    }
+    if (options.seam_megapix > 0.0) {
+        stitcher.set_seam_megapix(options.seam_megapix);
+    }
+    if (options.preview) {
+        stitcher.set_preview(true);
+    }
+}
+
+} // namespace
+
+bool stitch(const std::vector<InputFrame>& frames,
+            const StitchOptions& options,
+            StitchResult& result,
+            std::string& error_message,
+            const ProgressCallback& progress_callback,
+            ThreadPool* pool) {
+    const auto tStart = Clock::now();
+    result = StitchResult();
+    Progress progress(progress_callback);
+    auto cancel = [&]() {
+        result.cancelled = true;
+        result.timings.total_ms = ms_since(tStart);
+        error_message = "Cancelled";
+        return false;
+    };
+    if (frames.empty()) {
+        error_message = "No images provided";
+        return false;
+    }
+
+    try {
+        // Decode (or downscale) every frame on the pool; each worker writes only its own slot
+        auto tLoad = Clock::now();
+        const int maxDim = options.preview ? kPreviewDim : options.max_dim;
+        std::vector<cv::Mat> decoded(frames.size());
+        std::atomic<std::size_t> decodedCount{0};
+        auto decodeOne = [&](std::size_t i) {
+            if (progress.cancelled()) {
+                return;
+            }
+            const InputFrame& frame = frames[i];
+            decoded[i] = frame.image.empty() ? decode_image(frame.encoded, maxDim) : fit_frame(frame.image, maxDim);
+            progress.report(Stage::Decode, ++decodedCount, frames.size());
+        };
+        {
+            PROFILE_SCOPE("load");
+            std::unique_ptr<ThreadPool> ownPool;
+            const unsigned threads = std::min<unsigned>(resolve_thread_count(0), static_cast<unsigned>(frames.size()));
+            if (!pool && threads > 1) {
+                ownPool = std::make_unique<ThreadPool>(threads - 1);
+            }
+            ThreadPool* decodePool = pool ? pool : ownPool.get();
+            if (decodePool) {
+                decodePool->parallel_for(frames.size(), decodeOne);
+            } else {
+                for (std::size_t i = 0; i < frames.size(); ++i) {
+                    decodeOne(i);
+                }
+            }
+        }
+        if (progress.cancelled()) {
+            return cancel();
+        }
+        std::vector<cv::Mat> images;
+        std::vector<int> inputIndex; // input frame of each entry of 'images'
+        for (std::size_t i = 0; i < frames.size(); ++i) {
+            if (decoded[i].empty()) {
+                const std::string label = frames[i].name.empty() ? "frame " + std::to_string(i) : frames[i].name;
+                result.warnings.push_back("failed to decode " + label);
+                continue;
+            }
+            images.push_back(std::move(decoded[i]));
+            inputIndex.push_back(static_cast<int>(i));
+        }
+        decoded.clear();
+        result.timings.load_ms = ms_since(tLoad);
+        profiler::count("images", static_cast<double>(images.size()));
+        if (images.empty()) {
+            error_message = "Failed to decode any frame";
+            return false;
+        }
+
+        cv::Mat pano, panoMask;
+        auto tRegister = Clock::now();
+        if (images.size() == 1) {
+            // A single frame is its own panorama
+            pano = images.front();
+            panoMask = cv::Mat(pano.size(), CV_8U, cv::Scalar::all(255));
+            result.registered = inputIndex;
+        } else {
+            OpenCVStitcher stitcher;
+            configure(options, stitcher, result.warnings);
+            const cv::Stitcher::Mode mode = options.mode == "scans" ? cv::Stitcher::SCANS : cv::Stitcher::PANORAMA;
+            std::vector<cv::Size> sizes;
+            for (const auto& im : images) {
+                sizes.push_back(im.size());
+            }
+
+            // Registration cannot be interrupted; cancellation is checked on both sides of it
+            if (!progress.report(Stage::Register, 0, 1)) {
+                return cancel();
+            }
+            Registration registration;
+            bool registered = false;
+            {
+                PROFILE_SCOPE("register");
+                registered = stitcher.estimate(images, sizes, registration, error_message, mode);
+            }
+            result.timings.register_ms = ms_since(tRegister);
+            if (!registered) {
+                error_message = "Stitching failed: " + error_message;
+                return false;
+            }
+            if (!progress.report(Stage::Register, 1, 1)) {
+                return cancel();
+            }
+            for (int idx : registration.indices) {
+                result.registered.push_back(inputIndex[idx]);
+            }
+
+            // Every frame is loaded twice (seam pass, compose pass), or once when there is
+            // no seam pass (preview, or neither seams nor exposure compensation); an empty
+            // frame makes the compositor stop
+            auto tCompose = Clock::now();
+            const bool seamPass = !options.preview && !(options.seam == "none" && options.exposure == "none");
+            const std::size_t loads = registration.indices.size() * (seamPass ? 2 : 1);
+            std::atomic<std::size_t> loaded{0};
+            FrameLoader loadFrame = [&](std::size_t i, double scale) -> cv::Mat {
+                if (!progress.report(Stage::Compose, std::min(++loaded, loads), loads)) {
+                    return cv::Mat();
+                }
+                const cv::Mat& src = images[registration.indices[i]];
+                if (std::abs(scale - 1.0) < 1e-9) {
+                    return src;
+                }
+                cv::Mat scaled;
+                cv::resize(src, scaled, cv::Size(), scale, scale, scale < 1.0 ? cv::INTER_AREA : cv::INTER_LINEAR);
+                return scaled;
+            };
+            StitchReport report;
+            bool composed = false;
+            {
+                PROFILE_SCOPE("compose");
+                composed = stitcher.compose(registration, loadFrame, 1.0, pano, error_message, &report);
+            }
+            result.timings.compose_ms = ms_since(tCompose);
+            if (progress.cancelled()) {
+                return cancel();
+            }
+            if (!composed) {
+                error_message = "Stitching failed: " + error_message;
+                return false;
+            }
+            panoMask = report.result_mask;
+        }
+        images.clear();
+
+        // Crop; the result and its mask are views of the canvas
+        auto tWrite = Clock::now();
+        if (!progress.report(Stage::Crop, 0, 1)) {
+            return cancel();
+        }
+        {
+            PROFILE_SCOPE("trim");
+            std::string warning;
+            const cv::Rect roi = utils::crop_rect(pano, panoMask, options.crop, &warning);
+            if (!warning.empty()) {
+                result.warnings.push_back(warning);
+            }
+            result.panorama = pano(roi);
+            if (panoMask.size() == pano.size()) {
+                result.mask = panoMask(roi);
+            }
+        }
+        if (!progress.report(Stage::Crop, 1, 1)) {
+            return cancel();
+        }
+
+        if (!options.encode.empty()) {
+            if (!progress.report(Stage::Encode, 0, 1)) {
+                return cancel();
+            }
+            OutputOptions outOptions;
+            outOptions.jpeg_quality = options.jpeg_quality;
+            bool encoded = false;
+            {
+                PROFILE_SCOPE("encode");
+                encoded = encode_panorama(result.panorama, options.encode, outOptions, pool, result.encoded, nullptr,
+                                          error_message);
+            }
+            if (!encoded) {
+                return false;
+            }
+            if (!progress.report(Stage::Encode, 1, 1)) {
+                return cancel();
+            }
+        }
+        result.timings.write_ms = ms_since(tWrite);
+        result.timings.total_ms = ms_since(tStart);
+        return true;
+    } catch (const std::exception& ex) {
+        error_message = ex.what();
+        return false;
+    }
+}
+
+} // namespace panorama
@@ -5,14 +5,64 @@
 #include <opencv2/stitching/detail/blenders.hpp>
 #include <opencv2/stitching/detail/seam_finders.hpp>
 #include <opencv2/stitching/detail/exposure_compensate.hpp>
+#include <opencv2/stitching/detail/matchers.hpp>
+#include <opencv2/stitching/detail/motion_estimators.hpp>
 #include <opencv2/features2d.hpp>
 #include <opencv2/calib3d.hpp>
 #include <opencv2/imgproc.hpp>
+#include <opencv2/core/utility.hpp>
+#include <algorithm>
+#include <limits>
+#include <mutex>
+#include <numeric>
+#include <set>
 #include <sstream>
 #include <cmath>
 
+#include "profiler.hpp"
+
 OpenCVStitcher::OpenCVStitcher() = default;
 
+// Sizes OpenCV's process-wide pool for one stage (0 leaves it alone). Overlapping
+// scopes, such as --partial components composited at once, share the size set by
+// the first; the size in force before it is restored when the last one ends.
+class OpenCVThreadsScope {
+public:
+    explicit OpenCVThreadsScope(unsigned threads) : active_(threads > 0) {
+        if (!active_) {
+            return;
+        }
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (depth_++ == 0) {
+            saved_ = cv::getNumThreads();
+            cv::setNumThreads(static_cast<int>(threads));
+        }
+    }
+
+    ~OpenCVThreadsScope() {
+        if (!active_) {
+            return;
+        }
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (--depth_ == 0) {
+            cv::setNumThreads(saved_);
+        }
+    }
+
+    OpenCVThreadsScope(const OpenCVThreadsScope&) = delete;
+    OpenCVThreadsScope& operator=(const OpenCVThreadsScope&) = delete;
+
+private:
+    bool active_;
+    static std::mutex mutex_;
+    static int depth_;
+    static int saved_;
+};
+
+std::mutex OpenCVThreadsScope::mutex_;
+int OpenCVThreadsScope::depth_ = 0;
+int OpenCVThreadsScope::saved_ = 0;
+
 static const char* status_to_cstr(cv::Stitcher::Status s) {
     switch (s) {
         case cv::Stitcher::OK: return "OK";
@@ -23,43 +73,795 @@ static const char* status_to_cstr(cv::Stitcher::Status s) {
     }
 }
 
-bool OpenCVStitcher::stitch(const std::vector<cv::Mat>& images, cv::Mat& output, std::string& error_message, cv::Stitcher::Mode mode) const {
-    if (images.size() < 1) {
+static std::string status_message(cv::Stitcher::Status s) {
+    std::ostringstream oss;
+    oss << "OpenCV Stitcher failed with status: " << status_to_cstr(s);
+    return oss.str();
+}
+
+cv::Ptr<cv::Stitcher> OpenCVStitcher::create_stitcher(cv::Stitcher::Mode mode) const {
+    // Use OpenCV's high-level Stitcher API in the requested mode.
+    auto stitcher = cv::Stitcher::create(mode);
+
+    // Configure optional parameters
+    stitcher->setPanoConfidenceThresh(confidence_thresh_);
+    stitcher->setWaveCorrection(do_wave_correct_);
+    if (mode == cv::Stitcher::SCANS) {
+        // Translational/mosaic: disable wave correction; use default warper
+        stitcher->setWaveCorrection(false);
+    }
+    // cv::Stitcher needs a finder and a compensator; "none" maps to OpenCV's no-op ones
+    cv::Ptr<cv::detail::SeamFinder> seam_finder = create_seam_finder(seam_method_);
+    cv::Ptr<cv::detail::ExposureCompensator> exposure = create_exposure_compensator(exposure_method_);
+    stitcher->setSeamFinder(seam_finder ? seam_finder : cv::makePtr<cv::detail::NoSeamFinder>());
+    stitcher->setExposureCompensator(exposure ? exposure : cv::makePtr<cv::detail::NoExposureCompensator>());
+    stitcher->setSeamEstimationResol(seam_megapix_);
+    return stitcher;
+}
+
+cv::Rect OpenCVStitcher::match_roi(const cv::Size& size) const {
+    const cv::Rect roi(cvRound(match_region_.x * size.width), cvRound(match_region_.y * size.height),
+                       cvRound(match_region_.width * size.width), cvRound(match_region_.height * size.height));
+    return roi & cv::Rect(cv::Point(), size);
+}
+
+bool OpenCVStitcher::full_match_region() const {
+    return match_region_ == cv::Rect2d(0.0, 0.0, 1.0, 1.0);
+}
+
+bool feature_preset(const std::string& quality, FeatureOptions& options) {
+    FeatureOptions o;
+    o.grid_cols = 4;
+    o.grid_rows = 3;
+    if (quality == "fast") {
+        o.backend = FeatureBackend::ORB;
+        o.max_keypoints = 800;
+        o.registration_megapix = 0.3;
+    } else if (quality == "balanced") {
+        o.backend = FeatureBackend::ORB;
+        o.max_keypoints = 2000;
+        o.registration_megapix = 0.6;
+    } else if (quality == "best") {
+        o.backend = FeatureBackend::SIFT;
+        o.max_keypoints = 4000;
+        o.registration_megapix = 1.0;
+    } else {
+        return false;
+    }
+    options = o;
+    return true;
+}
+
+bool parse_feature_backend(const std::string& name, FeatureBackend& backend) {
+    if (name == "orb") {
+        backend = FeatureBackend::ORB;
+    } else if (name == "akaze") {
+        backend = FeatureBackend::AKAZE;
+    } else if (name == "sift") {
+        backend = FeatureBackend::SIFT;
+    } else {
+        return false;
+    }
+    return true;
+}
+
+// SIFT moved into the main features2d module in OpenCV 4.4
+#if CV_VERSION_MAJOR > 4 || (CV_VERSION_MAJOR == 4 && CV_VERSION_MINOR >= 4)
+#define PANORAMA_HAVE_SIFT 1
+#else
+#define PANORAMA_HAVE_SIFT 0
+#endif
+
+static FeatureBackend effective_backend(FeatureBackend backend) {
+    return (backend == FeatureBackend::SIFT && !PANORAMA_HAVE_SIFT) ? FeatureBackend::AKAZE : backend;
+}
+
+static const char* backend_name(FeatureBackend backend) {
+    switch (effective_backend(backend)) {
+        case FeatureBackend::AKAZE: return "akaze";
+        case FeatureBackend::SIFT: return "sift";
+        default: return "orb";
+    }
+}
+
+void OpenCVStitcher::set_preview(bool enable) {
+    preview_ = enable;
+    if (enable) {
+        // Enough keypoints per grid cell to tie neighbours together at thumbnail size
+        features_ = FeatureOptions();
+        features_.max_keypoints = 500;
+        features_.grid_cols = 4;
+        features_.grid_rows = 3;
+        features_.registration_megapix = 0.1;
+        seam_method_ = SeamMethod::None;
+        exposure_method_ = ExposureMethod::None;
+    }
+}
+
+bool OpenCVStitcher::default_features() const {
+    const FeatureOptions d;
+    return features_.backend == d.backend && features_.max_keypoints == d.max_keypoints &&
+           features_.registration_megapix == d.registration_megapix;
+}
+
+bool OpenCVStitcher::binary_descriptors() const {
+    return effective_backend(features_.backend) != FeatureBackend::SIFT;
+}
+
+// A new detector for one image. With a keypoint budget the detector is asked for
+// twice as many keypoints so the grid has candidates to choose from.
+static cv::Ptr<cv::Feature2D> create_finder(const FeatureOptions& options) {
+    const int wanted = options.max_keypoints > 0 ? options.max_keypoints * 2 : 0;
+    switch (effective_backend(options.backend)) {
+        case FeatureBackend::AKAZE:
+            return cv::AKAZE::create();
+#if PANORAMA_HAVE_SIFT
+        case FeatureBackend::SIFT:
+            return cv::SIFT::create(wanted);
+#endif
+        default:
+            return wanted > 0 ? cv::ORB::create(wanted) : cv::ORB::create();
+    }
+}
+
+// Indices of at most 'budget' keypoints spread over a cols x rows grid: every
+// cell first keeps its strongest share of the budget, then the strongest of the
+// remaining keypoints fill whatever budget sparse cells left unused.
+static std::vector<int> bucket_keypoints(const std::vector<cv::KeyPoint>& keypoints, const cv::Size& size,
+                                         int cols, int rows, std::size_t budget) {
+    std::vector<int> order(keypoints.size());
+    std::iota(order.begin(), order.end(), 0);
+    std::stable_sort(order.begin(), order.end(),
+                     [&](int a, int b) { return keypoints[a].response > keypoints[b].response; });
+    const std::size_t cells = static_cast<std::size_t>(cols) * rows;
+    const std::size_t share = std::max<std::size_t>(1, budget / cells);
+    std::vector<std::size_t> taken(cells, 0);
+    std::vector<int> kept, rest;
+    kept.reserve(std::min(budget, keypoints.size()));
+    for (int k : order) {
+        const cv::Point2f& pt = keypoints[k].pt;
+        const int cx = std::min(cols - 1, std::max(0, static_cast<int>(pt.x * cols / size.width)));
+        const int cy = std::min(rows - 1, std::max(0, static_cast<int>(pt.y * rows / size.height)));
+        std::size_t& n = taken[static_cast<std::size_t>(cy) * cols + cx];
+        if (n < share && kept.size() < budget) {
+            ++n;
+            kept.push_back(k);
+        } else {
+            rest.push_back(k);
+        }
+    }
+    for (std::size_t r = 0; r < rest.size() && kept.size() < budget; ++r) {
+        kept.push_back(rest[r]);
+    }
+    std::sort(kept.begin(), kept.end());
+    return kept;
+}
+
+// Detect and describe 'img' like cv::detail::computeImageFeatures, keeping at
+// most options.max_keypoints keypoints spread over the configured grid.
+static void detect_features(const FeatureOptions& options, const cv::Mat& img, cv::detail::ImageFeatures& f) {
+    cv::Ptr<cv::Feature2D> finder = create_finder(options);
+    std::vector<cv::KeyPoint> keypoints;
+    cv::Mat descriptors;
+    finder->detectAndCompute(img, cv::noArray(), keypoints, descriptors);
+    if (options.max_keypoints > 0 && keypoints.size() > static_cast<std::size_t>(options.max_keypoints)) {
+        const std::vector<int> kept = bucket_keypoints(keypoints, img.size(), std::max(1, options.grid_cols),
+                                                       std::max(1, options.grid_rows),
+                                                       static_cast<std::size_t>(options.max_keypoints));
+        std::vector<cv::KeyPoint> selected;
+        cv::Mat rows(static_cast<int>(kept.size()), descriptors.cols, descriptors.type());
+        selected.reserve(kept.size());
+        for (std::size_t r = 0; r < kept.size(); ++r) {
+            selected.push_back(keypoints[kept[r]]);
+            descriptors.row(kept[r]).copyTo(rows.row(static_cast<int>(r)));
+        }
+        keypoints.swap(selected);
+        descriptors = rows;
+    }
+    f.img_size = img.size();
+    f.keypoints = std::move(keypoints);
+    descriptors.copyTo(f.descriptors);
+}
+
+// cv::detail::BestOf2NearestMatcher (or its affine variant for SCANS) for binary
+// descriptors: an exact brute-force Hamming k-NN replaces the FLANN LSH index
+// CpuMatcher builds for every pair. The ratio test, geometric verification and
+// confidence are the same as OpenCV's.
+namespace {
+
+class HammingBestOf2NearestMatcher : public cv::detail::FeaturesMatcher {
+public:
+    explicit HammingBestOf2NearestMatcher(bool affine, float match_conf = 0.3f, int num_matches_thresh1 = 6,
+                                          int num_matches_thresh2 = 6)
+        : FeaturesMatcher(true), affine_(affine), match_conf_(match_conf),
+          num_matches_thresh1_(num_matches_thresh1), num_matches_thresh2_(num_matches_thresh2) {}
+
+protected:
+    void match(const cv::detail::ImageFeatures& features1, const cv::detail::ImageFeatures& features2,
+               cv::detail::MatchesInfo& matches_info) override {
+        matches_info.matches.clear();
+        if (features1.descriptors.empty() || features2.descriptors.empty()) {
+            return;
+        }
+
+        // Best of two nearest in both directions, as CpuMatcher does
+        cv::BFMatcher bf(cv::NORM_HAMMING);
+        std::set<std::pair<int, int>> seen;
+        std::vector<std::vector<cv::DMatch>> knn;
+        bf.knnMatch(features1.descriptors, features2.descriptors, knn, 2);
+        for (const auto& m : knn) {
+            if (m.size() == 2 && m[0].distance < (1.f - match_conf_) * m[1].distance) {
+                matches_info.matches.push_back(m[0]);
+                seen.insert(std::make_pair(m[0].queryIdx, m[0].trainIdx));
+            }
+        }
+        knn.clear();
+        bf.knnMatch(features2.descriptors, features1.descriptors, knn, 2);
+        for (const auto& m : knn) {
+            if (m.size() == 2 && m[0].distance < (1.f - match_conf_) * m[1].distance &&
+                seen.find(std::make_pair(m[0].trainIdx, m[0].queryIdx)) == seen.end()) {
+                matches_info.matches.push_back(cv::DMatch(m[0].trainIdx, m[0].queryIdx, m[0].distance));
+            }
+        }
+        if (matches_info.matches.size() < static_cast<std::size_t>(num_matches_thresh1_)) {
+            return;
+        }
+
+        // Homographies are estimated on centred coordinates, affine transforms on raw ones
+        const cv::Point2f c1 = affine_ ? cv::Point2f() : cv::Point2f(features1.img_size.width * 0.5f,
+                                                                     features1.img_size.height * 0.5f);
+        const cv::Point2f c2 = affine_ ? cv::Point2f() : cv::Point2f(features2.img_size.width * 0.5f,
+                                                                     features2.img_size.height * 0.5f);
+        std::vector<cv::Point2f> src, dst;
+        src.reserve(matches_info.matches.size());
+        dst.reserve(matches_info.matches.size());
+        for (const auto& m : matches_info.matches) {
+            src.push_back(features1.keypoints[m.queryIdx].pt - c1);
+            dst.push_back(features2.keypoints[m.trainIdx].pt - c2);
+        }
+        if (affine_) {
+            matches_info.H = cv::estimateAffinePartial2D(src, dst, matches_info.inliers_mask);
+            if (matches_info.H.empty()) {
+                matches_info.confidence = 0;
+                matches_info.num_inliers = 0;
+                return;
+            }
+        } else {
+            matches_info.H = cv::findHomography(src, dst, matches_info.inliers_mask, cv::RANSAC);
+            if (matches_info.H.empty() ||
+                std::abs(cv::determinant(matches_info.H)) < std::numeric_limits<double>::epsilon()) {
+                return;
+            }
+        }
+        matches_info.num_inliers = 0;
+        for (uchar in : matches_info.inliers_mask) {
+            matches_info.num_inliers += in ? 1 : 0;
+        }
+        // Same confidence as cv::detail::BestOf2NearestMatcher (see Brown & Lowe, 2007)
+        matches_info.confidence = matches_info.num_inliers / (8 + 0.3 * matches_info.matches.size());
+
+        if (affine_) {
+            cv::Mat H = cv::Mat::eye(3, 3, CV_64F);
+            matches_info.H.copyTo(H.rowRange(0, 2));
+            matches_info.H = H;
+            return;
+        }
+        // Too high a confidence means the images are (near) duplicates
+        matches_info.confidence = matches_info.confidence > 3. ? 0. : matches_info.confidence;
+        if (matches_info.num_inliers < num_matches_thresh2_) {
+            return;
+        }
+        // Refine the homography on the inliers
+        std::vector<cv::Point2f> src_in, dst_in;
+        for (std::size_t k = 0; k < matches_info.inliers_mask.size(); ++k) {
+            if (matches_info.inliers_mask[k]) {
+                src_in.push_back(src[k]);
+                dst_in.push_back(dst[k]);
+            }
+        }
+        matches_info.H = cv::findHomography(src_in, dst_in, cv::RANSAC);
+    }
+
+private:
+    bool affine_;
+    float match_conf_;
+    int num_matches_thresh1_;
+    int num_matches_thresh2_;
+};
+
+} // namespace
+
+// Registration components cv::Stitcher::create() configures for each mode.
+struct RegistrationPipeline {
+    cv::Ptr<cv::detail::FeaturesMatcher> matcher;
+    cv::Ptr<cv::detail::Estimator> estimator;
+    cv::Ptr<cv::detail::BundleAdjusterBase> adjuster;
+};
+
+static RegistrationPipeline make_pipeline(cv::Stitcher::Mode mode, bool binary_descriptors) {
+    RegistrationPipeline p;
+    if (mode == cv::Stitcher::SCANS) {
+        if (binary_descriptors) {
+            p.matcher = cv::makePtr<HammingBestOf2NearestMatcher>(true);
+        } else {
+            p.matcher = cv::makePtr<cv::detail::AffineBestOf2NearestMatcher>(false, false);
+        }
+        p.estimator = cv::makePtr<cv::detail::AffineBasedEstimator>();
+        p.adjuster = cv::makePtr<cv::detail::BundleAdjusterAffinePartial>();
+    } else {
+        if (binary_descriptors) {
+            p.matcher = cv::makePtr<HammingBestOf2NearestMatcher>(false);
+        } else {
+            p.matcher = cv::makePtr<cv::detail::BestOf2NearestMatcher>(false);
+        }
+        p.estimator = cv::makePtr<cv::detail::HomographyBasedEstimator>();
+        p.adjuster = cv::makePtr<cv::detail::BundleAdjusterRay>();
+    }
+    return p;
+}
+
+// Store the (i, j) match and its mirrored (j, i) entry the way cv::detail::FeaturesMatcher does.
+static void set_pair(std::vector<cv::detail::MatchesInfo>& pairwise, int n, int i, int j,
+                     const cv::detail::MatchesInfo& m) {
+    cv::detail::MatchesInfo& fwd = pairwise[i * n + j];
+    fwd = m;
+    fwd.src_img_idx = i;
+    fwd.dst_img_idx = j;
+
+    cv::detail::MatchesInfo& dual = pairwise[j * n + i];
+    dual = m;
+    dual.src_img_idx = j;
+    dual.dst_img_idx = i;
+    if (!m.H.empty()) {
+        dual.H = m.H.inv();
+    }
+    for (auto& dm : dual.matches) {
+        std::swap(dm.queryIdx, dm.trainIdx);
+    }
+}
+
+bool OpenCVStitcher::uses_default_pipeline() const {
+    // Anything cv::Stitcher::stitch() cannot express needs the explicit estimate/compose path
+    // (match regions included: it only takes full-size per-image masks)
+    return memory_budget_mb_ == 0 && match_window_ <= 0 && full_match_region() && default_features() && !preview_ &&
+           !custom_compositing_;
+}
+
+bool OpenCVStitcher::in_match_window(int i, int j, int n) const {
+    if (match_window_ <= 0) {
+        return true;
+    }
+    const int d = std::abs(j - i);
+    return d <= match_window_ || (match_wrap_ && n - d <= match_window_);
+}
+
+std::string OpenCVStitcher::feature_settings() const {
+    std::ostringstream oss;
+    oss << "features=" << backend_name(features_.backend) << "|keypoints=" << features_.max_keypoints
+        << "|grid=" << features_.grid_cols << "x" << features_.grid_rows
+        << "|megapix=" << features_.registration_megapix
+        << "|region=" << match_region_.x << "," << match_region_.y << "," << match_region_.width << ","
+        << match_region_.height;
+    return oss.str();
+}
+
+std::string OpenCVStitcher::registration_settings(cv::Stitcher::Mode mode) const {
+    std::ostringstream oss;
+    oss << "mode=" << (mode == cv::Stitcher::SCANS ? "scans" : "panorama")
+        << "|matcher=" << (binary_descriptors() ? "hamming" : "flann") << "|" << feature_settings();
+    return oss.str();
+}
+
+std::vector<std::string> OpenCVStitcher::feature_keys(const std::vector<cv::Mat>& proxies,
+                                                     const std::vector<std::filesystem::path>* sources) const {
+    const std::string settings = feature_settings();
+    std::vector<std::string> keys;
+    if (!cache_.enabled() || !sources || sources->size() != proxies.size()) {
+        return keys;
+    }
+    for (std::size_t i = 0; i < proxies.size(); ++i) {
+        std::ostringstream proxy;
+        proxy << settings << "|proxy=" << proxies[i].cols << "x" << proxies[i].rows;
+        keys.push_back(RegistrationCache::file_key((*sources)[i], proxy.str()));
+    }
+    return keys;
+}
+
+std::vector<cv::detail::ImageFeatures> OpenCVStitcher::find_features(const std::vector<cv::Mat>& proxies,
+                                                                     double work_scale,
+                                                                     const std::vector<std::string>& keys,
+                                                                     const std::vector<char>* wanted) const {
+    const bool use_cache = !keys.empty();
+    std::vector<cv::detail::ImageFeatures> features(proxies.size());
+    OpenCVThreadsScope threads(features_threads_);
+    // One scope for the whole stage: its CPU time is process-wide, so a scope per task would
+    // charge every thread's work to each of the overlapping events
+    PROFILE_SCOPE("features");
+    // One image per task; every task creates its own detector, so no detector state is shared
+    cv::parallel_for_(cv::Range(0, static_cast<int>(proxies.size())), [&](const cv::Range& range) {
+        for (int i = range.start; i < range.end; ++i) {
+            cv::detail::ImageFeatures& f = features[i];
+            const cv::Size work_size(cvRound(proxies[i].cols * work_scale), cvRound(proxies[i].rows * work_scale));
+            if (wanted && !(*wanted)[i]) {
+                f.img_idx = i;
+                f.img_size = work_size;
+                continue;
+            }
+            if (!(use_cache && cache_.load_features(keys[i], f))) {
+                // Detect only inside the match region: a view of the proxy, resized on its own,
+                // with keypoints shifted back to full-frame coordinates
+                const cv::Rect roi = match_roi(work_size);
+                const cv::Rect src_roi = match_roi(proxies[i].size());
+                cv::Mat img;
+                if (!roi.empty() && !src_roi.empty()) {
+                    cv::resize(proxies[i](src_roi), img, roi.size(), 0, 0, cv::INTER_LINEAR_EXACT);
+                    detect_features(features_, img, f);
+                }
+                for (auto& kp : f.keypoints) {
+                    kp.pt.x += static_cast<float>(roi.x);
+                    kp.pt.y += static_cast<float>(roi.y);
+                }
+                f.img_size = work_size;
+                if (use_cache) {
+                    cache_.save_features(keys[i], f);
+                }
+            }
+            f.img_idx = i;
+            profiler::count("keypoints", static_cast<double>(f.keypoints.size()));
+        }
+    });
+    return features;
+}
+
+void OpenCVStitcher::match_pairs(const std::vector<cv::detail::ImageFeatures>& features,
+                                 const cv::Ptr<cv::detail::FeaturesMatcher>& matcher,
+                                 const cv::Mat_<uchar>& candidates,
+                                 const std::vector<std::string>& keys,
+                                 const std::string& settings,
+                                 std::vector<cv::detail::MatchesInfo>& pairwise) const {
+    const int n = static_cast<int>(features.size());
+    const bool use_cache = !keys.empty();
+    OpenCVThreadsScope threads(matching_threads_);
+    std::vector<std::pair<int, int>> cached_pairs;
+    std::vector<cv::detail::MatchesInfo> cached_matches;
+    std::vector<std::string> pair_keys;
+    cv::Mat_<uchar> todo(n, n, uchar(0));
+    bool every_pair = true;
+    if (use_cache) {
+        pair_keys.resize(static_cast<std::size_t>(n) * n);
+    }
+    for (int i = 0; i < n; ++i) {
+        for (int j = i + 1; j < n; ++j) {
+            if (!candidates(i, j)) {
+                every_pair = false;
+                continue;
+            }
+            if (use_cache) {
+                pair_keys[i * n + j] = RegistrationCache::combine({keys[i], keys[j], settings});
+                cv::detail::MatchesInfo m;
+                if (cache_.load_matches(pair_keys[i * n + j], m)) {
+                    cached_pairs.emplace_back(i, j);
+                    cached_matches.push_back(std::move(m));
+                    every_pair = false;
+                    continue;
+                }
+            }
+            todo(i, j) = 1;
+        }
+    }
+    cv::UMat matching_mask;
+    if (!every_pair) {
+        todo.copyTo(matching_mask);
+    }
+    {
+        PROFILE_SCOPE("matching");
+        (*matcher)(features, pairwise, matching_mask);
+        matcher->collectGarbage();
+    }
+    if (use_cache) {
+        for (int i = 0; i < n; ++i) {
+            for (int j = i + 1; j < n; ++j) {
+                if (todo(i, j)) {
+                    cache_.save_matches(pair_keys[i * n + j], pairwise[i * n + j]);
+                }
+            }
+        }
+    }
+    for (std::size_t k = 0; k < cached_pairs.size(); ++k) {
+        set_pair(pairwise, n, cached_pairs[k].first, cached_pairs[k].second, cached_matches[k]);
+    }
+    if (profiler::enabled()) {
+        int matched = 0;
+        for (int i = 0; i < n; ++i) {
+            for (int j = i + 1; j < n; ++j) {
+                matched += candidates(i, j) && pairwise[i * n + j].confidence > confidence_thresh_;
+            }
+        }
+        profiler::count("matched_pairs", matched);
+    }
+}
+
+// Every candidate pair with a non-zero confidence as an edge of 'graph'.
+static void collect_edges(const std::vector<cv::detail::MatchesInfo>& pairwise,
+                          const cv::Mat_<uchar>& candidates,
+                          MatchGraph& graph) {
+    const int n = candidates.rows;
+    for (int i = 0; i < n; ++i) {
+        for (int j = i + 1; j < n; ++j) {
+            const cv::detail::MatchesInfo& m = pairwise[i * n + j];
+            if (candidates(i, j) && m.confidence > 0) {
+                graph.edges.push_back({i, j, m.confidence, m.num_inliers});
+            }
+        }
+    }
+}
+
+// Wave-correct solved cameras (if asked) and store them in 'registration'. Cameras
+// come out of bundle adjustment at the registration (work) scale; each one is
+// rescaled to the pixel units of its full-resolution frame.
+static void finish_registration(std::vector<cv::detail::CameraParams>& cameras,
+                                const std::vector<int>& indices,
+                                bool wave_correct,
+                                const std::vector<cv::Mat>& proxies,
+                                const std::vector<cv::Size>& full_sizes,
+                                double work_scale,
+                                Registration& registration) {
+    if (wave_correct) {
+        std::vector<cv::Mat> rmats;
+        for (const auto& c : cameras) {
+            rmats.push_back(c.R.clone());
+        }
+        cv::detail::waveCorrect(rmats, cv::detail::WAVE_CORRECT_HORIZ);
+        for (std::size_t k = 0; k < cameras.size(); ++k) {
+            cameras[k].R = rmats[k];
+        }
+    }
+    registration.indices = indices;
+    registration.cameras = cameras;
+    registration.full_sizes.clear();
+    for (std::size_t k = 0; k < indices.size(); ++k) {
+        const int idx = indices[k];
+        const double s = static_cast<double>(full_sizes[idx].width) / (proxies[idx].cols * work_scale);
+        cv::detail::CameraParams& cam = registration.cameras[k];
+        cam.focal *= s;
+        cam.ppx *= s;
+        cam.ppy *= s;
+        registration.full_sizes.push_back(full_sizes[idx]);
+    }
+}
+
+bool OpenCVStitcher::estimate(const std::vector<cv::Mat>& proxies,
+                              const std::vector<cv::Size>& full_sizes,
+                              Registration& registration,
+                              std::string& error_message,
+                              cv::Stitcher::Mode mode,
+                              const std::vector<std::filesystem::path>* sources,
+                              MatchGraph* graph) const {
+    if (graph) {
+        *graph = MatchGraph();
+        graph->confidence_threshold = confidence_thresh_;
+        graph->component.assign(proxies.size(), -1);
+    }
+    if (proxies.empty() || full_sizes.size() != proxies.size()) {
         error_message = "No images provided";
         return false;
     }
 
     try {
-        // Use OpenCV's high-level Stitcher API in the requested mode.
-        auto stitcher = cv::Stitcher::create(mode);
+        const int n = static_cast<int>(proxies.size());
+        registration.mode = mode;
+
+        // Cache keys: one per image, one per pair, one for the whole set
+        const std::string settings = registration_settings(mode);
+        const std::vector<std::string> keys = feature_keys(proxies, sources);
+        const bool use_cache = !keys.empty();
+        std::string camera_key;
+        if (use_cache) {
+            std::vector<std::string> set_keys = keys;
+            std::ostringstream solve;
+            solve << settings << "|conf=" << confidence_thresh_ << "|wave=" << do_wave_correct_
+                  << "|window=" << match_window_ << "|wrap=" << match_wrap_ << "|drop=" << max_dropped_frames_;
+            set_keys.push_back(solve.str());
+            camera_key = RegistrationCache::combine(set_keys);
+            if (cache_.load_cameras(camera_key, registration.indices, registration.cameras)) {
+                registration.full_sizes.clear();
+                for (int idx : registration.indices) {
+                    registration.full_sizes.push_back(full_sizes[idx]);
+                    if (graph) {
+                        graph->component[idx] = 0;
+                    }
+                }
+                return true;
+            }
+        }
+
+        RegistrationPipeline pipe = make_pipeline(mode, binary_descriptors());
 
-        // Configure optional parameters
-        stitcher->setPanoConfidenceThresh(confidence_thresh_);
-        stitcher->setWaveCorrection(do_wave_correct_);
-        if (mode == cv::Stitcher::SCANS) {
-            // Translational/mosaic: disable wave correction; use default warper
-            stitcher->setWaveCorrection(false);
+        // Features at registration resolution (cv::Stitcher derives the scale from the first image)
+        const double work_scale = std::min(1.0, std::sqrt(features_.registration_megapix * 1e6 / proxies[0].size().area()));
+        std::vector<cv::detail::ImageFeatures> features = find_features(proxies, work_scale, keys);
+
+        // Pairwise matching. Only pairs inside the match window are considered,
+        // and cached pairs are masked out of the matcher.
+        std::vector<cv::detail::MatchesInfo> pairwise;
+        cv::Mat_<uchar> candidates(n, n, uchar(0));
+        for (int i = 0; i < n; ++i) {
+            for (int j = i + 1; j < n; ++j) {
+                candidates(i, j) = in_match_window(i, j, n);
+            }
+        }
+        match_pairs(features, pipe.matcher, candidates, keys, settings, pairwise);
+        if (graph) {
+            collect_edges(pairwise, candidates, *graph);
         }
 
-        // Create masks per-image (match each image size)
-        std::vector<cv::Mat> masks;
-        masks.reserve(images.size());
-        for (const auto& im : images) {
-            masks.emplace_back(im.rows, im.cols, CV_8UC1, cv::Scalar(255));
+        // Keep the largest set of confidently connected images
+        std::vector<int> indices = cv::detail::leaveBiggestComponent(features, pairwise, confidence_thresh_);
+        profiler::count("registered_images", static_cast<double>(indices.size()));
+        if (indices.size() < 2) {
+            error_message = status_message(cv::Stitcher::ERR_NEED_MORE_IMGS);
+            return false;
         }
-        if (top_match_only_) {
-            for (size_t i = 0; i < images.size(); ++i) {
-                // Keep top half (zero bottom half)
-                masks[i](cv::Rect(0, images[i].rows / 2, images[i].cols, images[i].rows / 2)) = 0;
+
+        // Initial cameras, bundle adjustment and wave correction as in cv::Stitcher::estimateCameraParams.
+        // If the solve fails, up to max_dropped_frames_ outliers are dropped one at a time:
+        // the frame with the weakest confident links to the rest of the component goes first.
+        std::vector<cv::detail::CameraParams> cameras;
+        {
+            std::vector<int> all(indices.size());
+            for (std::size_t k = 0; k < all.size(); ++k) {
+                all[k] = static_cast<int>(k);
+            }
+            int dropped = 0;
+            while (!solve_local(all, std::vector<int>(all.size(), -1), features, pairwise, pipe, cameras,
+                                error_message)) {
+                const int m = static_cast<int>(indices.size());
+                if (dropped >= max_dropped_frames_ || m <= 2) {
+                    return false;
+                }
+                int weakest = 0;
+                double weakest_links = std::numeric_limits<double>::max();
+                for (int a = 0; a < m; ++a) {
+                    double links = 0.0;
+                    for (int b = 0; b < m; ++b) {
+                        const double c = pairwise[a * m + b].confidence;
+                        links += (a != b && c > confidence_thresh_) ? c : 0.0;
+                    }
+                    if (links < weakest_links) {
+                        weakest_links = links;
+                        weakest = a;
+                    }
+                }
+                for (int b = 0; b < m; ++b) {
+                    pairwise[weakest * m + b].confidence = 0;
+                    pairwise[b * m + weakest].confidence = 0;
+                }
+                const std::vector<int> kept = cv::detail::leaveBiggestComponent(features, pairwise, confidence_thresh_);
+                std::vector<int> remaining;
+                for (int k : kept) {
+                    remaining.push_back(indices[k]);
+                }
+                indices.swap(remaining);
+                all.resize(indices.size());
+                ++dropped;
+                profiler::count("dropped_frames", dropped);
+                if (indices.size() < 2) {
+                    error_message = status_message(cv::Stitcher::ERR_NEED_MORE_IMGS);
+                    return false;
+                }
+            }
+        }
+        finish_registration(cameras, indices, do_wave_correct_ && mode == cv::Stitcher::PANORAMA, proxies,
+                            full_sizes, work_scale, registration);
+        if (graph) {
+            for (int idx : indices) {
+                graph->component[idx] = 0;
+            }
+        }
+        if (use_cache) {
+            cache_.save_cameras(camera_key, registration.indices, registration.cameras);
+        }
+        return true;
+    } catch (const std::exception& ex) {
+        error_message = ex.what();
+        return false;
+    }
+}
+
+bool OpenCVStitcher::estimate_components(const std::vector<cv::Mat>& proxies,
+                                         const std::vector<cv::Size>& full_sizes,
+                                         std::vector<Registration>& components,
+                                         MatchGraph& graph,
+                                         std::string& error_message,
+                                         cv::Stitcher::Mode mode,
+                                         const std::vector<std::filesystem::path>* sources) const {
+    components.clear();
+    graph = MatchGraph();
+    if (proxies.empty() || full_sizes.size() != proxies.size()) {
+        error_message = "No images provided";
+        return false;
+    }
+
+    try {
+        const int n = static_cast<int>(proxies.size());
+        const std::string settings = registration_settings(mode);
+        const std::vector<std::string> keys = feature_keys(proxies, sources);
+
+        // Features and matches once for the whole set, as in estimate()
+        const double work_scale = std::min(1.0, std::sqrt(features_.registration_megapix * 1e6 / proxies[0].size().area()));
+        std::vector<cv::detail::ImageFeatures> features = find_features(proxies, work_scale, keys);
+        std::vector<cv::detail::MatchesInfo> pairwise;
+        cv::Mat_<uchar> candidates(n, n, uchar(0));
+        for (int i = 0; i < n; ++i) {
+            for (int j = i + 1; j < n; ++j) {
+                candidates(i, j) = in_match_window(i, j, n);
             }
         }
+        match_pairs(features, make_pipeline(mode, binary_descriptors()).matcher, candidates, keys, settings, pairwise);
 
-        // Let stitcher automatically choose features and matchers (OpenCV may default to ORB if SIFT not available)
-        cv::Stitcher::Status status = stitcher->stitch(images, masks, output);
-        if (status != cv::Stitcher::OK) {
-            std::ostringstream oss;
-            oss << "OpenCV Stitcher failed with status: " << status_to_cstr(status);
-            error_message = oss.str();
+        // The match graph and its connected components over confident edges
+        graph.confidence_threshold = confidence_thresh_;
+        graph.component.assign(n, -1);
+        collect_edges(pairwise, candidates, graph);
+        cv::detail::DisjointSets sets(n);
+        for (const MatchGraph::Edge& e : graph.edges) {
+            const int a = sets.findSetByElem(e.i);
+            const int b = sets.findSetByElem(e.j);
+            if (e.confidence > confidence_thresh_ && a != b) {
+                sets.mergeSets(a, b);
+            }
+        }
+        std::vector<std::vector<int>> members;
+        {
+            std::vector<int> slot(n, -1);
+            for (int i = 0; i < n; ++i) {
+                int& s = slot[sets.findSetByElem(i)];
+                if (s < 0) {
+                    s = static_cast<int>(members.size());
+                    members.emplace_back();
+                }
+                members[s].push_back(i);
+            }
+        }
+        members.erase(std::remove_if(members.begin(), members.end(),
+                                     [](const std::vector<int>& m) { return m.size() < 2; }),
+                      members.end());
+        std::stable_sort(members.begin(), members.end(),
+                         [](const std::vector<int>& a, const std::vector<int>& b) { return a.size() > b.size(); });
+        profiler::count("components", static_cast<double>(members.size()));
+
+        // Solve every component on its own, in parallel; each task gets its own
+        // estimator and bundle adjuster since those keep per-run state
+        std::vector<Registration> solved(members.size());
+        std::vector<std::string> errors(members.size());
+        std::vector<char> ok(members.size(), 0);
+        cv::parallel_for_(cv::Range(0, static_cast<int>(members.size())), [&](const cv::Range& range) {
+            for (int c = range.start; c < range.end; ++c) {
+                const RegistrationPipeline pipe = make_pipeline(mode, binary_descriptors());
+                std::vector<cv::detail::CameraParams> cameras;
+                if (solve_local(members[c], std::vector<int>(n, -1), features, pairwise, pipe, cameras, errors[c])) {
+                    solved[c].mode = mode;
+                    finish_registration(cameras, members[c], do_wave_correct_ && mode == cv::Stitcher::PANORAMA,
+                                        proxies, full_sizes, work_scale, solved[c]);
+                    ok[c] = 1;
+                }
+            }
+        });
+        for (std::size_t c = 0; c < members.size(); ++c) {
+            if (!ok[c]) {
+                error_message = errors[c];
+                continue;
+            }
+            for (int idx : members[c]) {
+                graph.component[idx] = static_cast<int>(components.size());
+            }
+            components.push_back(std::move(solved[c]));
+        }
+        profiler::count("registered_images", components.empty() ? 0.0 : static_cast<double>(components[0].indices.size()));
+        if (components.empty()) {
+            if (members.empty()) {
+                error_message = status_message(cv::Stitcher::ERR_NEED_MORE_IMGS);
+            }
             return false;
         }
         return true;
@@ -67,4 +869,474 @@ bool OpenCVStitcher::stitch(const std::vector<cv::Mat>& images, cv::Mat& output,
         error_message = ex.what();
         return false;
     }
-}
\ No newline at end of file
+}
+
+bool OpenCVStitcher::solve_local(const std::vector<int>& local,
+                                 const std::vector<int>& known,
+                                 const std::vector<cv::detail::ImageFeatures>& features,
+                                 const std::vector<cv::detail::MatchesInfo>& pairwise,
+                                 const RegistrationPipeline& pipe,
+                                 std::vector<cv::detail::CameraParams>& cameras,
+                                 std::string& error_message) const {
+    const int n = static_cast<int>(features.size());
+    const int m = static_cast<int>(local.size());
+    std::vector<cv::detail::ImageFeatures> local_features(m);
+    std::vector<cv::detail::MatchesInfo> local_pairwise(static_cast<std::size_t>(m) * m);
+    for (int a = 0; a < m; ++a) {
+        local_features[a] = features[local[a]];
+        local_features[a].img_idx = a;
+        for (int b = 0; b < m; ++b) {
+            cv::detail::MatchesInfo& mi = local_pairwise[a * m + b];
+            // Pairs of registered frames were not matched again; their cameras are anchors only
+            if (known[local[a]] >= 0 && known[local[b]] >= 0) {
+                continue;
+            }
+            mi = pairwise[local[a] * n + local[b]];
+            if (mi.src_img_idx >= 0) {
+                mi.src_img_idx = a;
+                mi.dst_img_idx = b;
+            }
+        }
+    }
+
+    PROFILE_SCOPE("bundle_adjust");
+    if (!(*pipe.estimator)(local_features, local_pairwise, cameras)) {
+        error_message = status_message(cv::Stitcher::ERR_HOMOGRAPHY_EST_FAIL);
+        return false;
+    }
+    for (auto& c : cameras) {
+        cv::Mat R;
+        c.R.convertTo(R, CV_32F);
+        c.R = R;
+    }
+    pipe.adjuster->setConfThresh(confidence_thresh_);
+    if (!(*pipe.adjuster)(local_features, local_pairwise, cameras)) {
+        error_message = status_message(cv::Stitcher::ERR_CAMERA_PARAMS_ADJUST_FAIL);
+        return false;
+    }
+    return true;
+}
+
+bool OpenCVStitcher::extend(const std::vector<cv::Mat>& proxies,
+                            const std::vector<cv::Size>& full_sizes,
+                            const Registration& previous,
+                            Registration& registration,
+                            std::vector<std::size_t>& added,
+                            std::string& error_message,
+                            const std::vector<std::filesystem::path>* sources) const {
+    const int n = static_cast<int>(proxies.size());
+    if (n == 0 || full_sizes.size() != proxies.size() || previous.cameras.empty() ||
+        previous.cameras.size() != previous.indices.size()) {
+        error_message = "No previous registration to extend";
+        return false;
+    }
+
+    try {
+        const cv::Stitcher::Mode mode = previous.mode;
+        registration = previous;
+        added.clear();
+
+        // Frames already in the panorama keep their cameras
+        std::vector<int> known(n, -1);
+        for (std::size_t k = 0; k < previous.indices.size(); ++k) {
+            const int idx = previous.indices[k];
+            if (idx < 0 || idx >= n) {
+                error_message = "Previous registration does not match the input frames";
+                return false;
+            }
+            known[idx] = static_cast<int>(k);
+        }
+        cv::Mat_<uchar> candidates(n, n, uchar(0));
+        std::vector<char> wanted(n, 0);
+        bool any_new = false;
+        for (int i = 0; i < n; ++i) {
+            for (int j = i + 1; j < n; ++j) {
+                if ((known[i] < 0 || known[j] < 0) && in_match_window(i, j, n)) {
+                    candidates(i, j) = 1;
+                    wanted[i] = wanted[j] = 1;
+                }
+            }
+            any_new = any_new || known[i] < 0;
+        }
+        if (!any_new) {
+            return true;
+        }
+
+        // Features and matches only for the new frames and their match-window neighbours
+        RegistrationPipeline pipe = make_pipeline(mode, binary_descriptors());
+        const std::string settings = registration_settings(mode);
+        const std::vector<std::string> keys = feature_keys(proxies, sources);
+        const double work_scale = std::min(1.0, std::sqrt(features_.registration_megapix * 1e6 / proxies[0].size().area()));
+        std::vector<cv::detail::ImageFeatures> features = find_features(proxies, work_scale, keys, &wanted);
+        std::vector<cv::detail::MatchesInfo> pairwise;
+        match_pairs(features, pipe.matcher, candidates, keys, settings, pairwise);
+
+        // New frames joining the panorama: confidently connected to it, directly or through other new frames
+        std::vector<char> joined(n, 0);
+        for (bool grew = true; grew;) {
+            grew = false;
+            for (int i = 0; i < n; ++i) {
+                if (known[i] >= 0 || joined[i]) {
+                    continue;
+                }
+                for (int j = 0; j < n; ++j) {
+                    if ((known[j] >= 0 || joined[j]) && pairwise[i * n + j].confidence > confidence_thresh_) {
+                        joined[i] = 1;
+                        grew = true;
+                        break;
+                    }
+                }
+            }
+        }
+        if (std::none_of(joined.begin(), joined.end(), [](char c) { return c != 0; })) {
+            return true; // nothing new connects to the panorama
+        }
+
+        // Local problems: the joining frames plus the registered frames they overlap,
+        // split into connected groups (each group has its own gauge to recover)
+        auto linked = [&](int i, int j) {
+            return (joined[i] || joined[j]) && pairwise[i * n + j].confidence > confidence_thresh_;
+        };
+        std::vector<int> group(n, -1);
+        int groups = 0;
+        for (int seed = 0; seed < n; ++seed) {
+            if (!joined[seed] || group[seed] >= 0) {
+                continue;
+            }
+            std::vector<int> stack = {seed};
+            group[seed] = groups;
+            while (!stack.empty()) {
+                const int i = stack.back();
+                stack.pop_back();
+                for (int j = 0; j < n; ++j) {
+                    // Registered frames only link through new ones
+                    if (group[j] < 0 && (known[i] < 0 || known[j] < 0) && linked(i, j)) {
+                        group[j] = groups;
+                        stack.push_back(j);
+                    }
+                }
+            }
+            ++groups;
+        }
+
+        for (int g = 0; g < groups; ++g) {
+            std::vector<int> local;
+            for (int i = 0; i < n; ++i) {
+                if (group[i] == g) {
+                    local.push_back(i);
+                }
+            }
+            std::vector<cv::detail::CameraParams> cameras;
+            if (!solve_local(local, known, features, pairwise, pipe, cameras, error_message)) {
+                return false;
+            }
+            profiler::count("registered_images", static_cast<double>(local.size()));
+            const int m = static_cast<int>(local.size());
+            for (int a = 0; a < m; ++a) {
+                const int idx = local[a];
+                const double s = static_cast<double>(full_sizes[idx].width) / (proxies[idx].cols * work_scale);
+                cameras[a].focal *= s;
+                cameras[a].ppx *= s;
+                cameras[a].ppy *= s;
+            }
+
+            // The local solution is defined up to a global transform G (R -> G * R) and a
+            // focal scale. Recover both from the registered frames and apply them to the
+            // new ones, so earlier cameras (and the canvas built from them) stay put.
+            cv::Mat G = cv::Mat::zeros(3, 3, CV_64F);
+            double focal_ratio = 0.0;
+            int anchors = 0;
+            for (int a = 0; a < m; ++a) {
+                const int k = known[local[a]];
+                if (k < 0) {
+                    continue;
+                }
+                cv::Mat R_prev, R_local;
+                previous.cameras[k].R.convertTo(R_prev, CV_64F);
+                cameras[a].R.convertTo(R_local, CV_64F);
+                if (mode == cv::Stitcher::SCANS) {
+                    // Affine cameras: pin the gauge to the first anchor
+                    if (anchors == 0) {
+                        G = R_prev * R_local.inv();
+                    }
+                } else {
+                    G += R_prev * R_local.t();
+                }
+                focal_ratio += previous.cameras[k].focal / cameras[a].focal;
+                ++anchors;
+            }
+            if (anchors == 0) {
+                continue; // cannot happen: every group reaches the panorama through a registered frame
+            }
+            if (mode != cv::Stitcher::SCANS) {
+                // Nearest rotation to the summed anchor alignments
+                cv::SVD svd(G);
+                G = svd.u * svd.vt;
+                if (cv::determinant(G) < 0) {
+                    G = svd.u * cv::Mat::diag(cv::Mat(cv::Vec3d(1.0, 1.0, -1.0))) * svd.vt;
+                }
+            }
+            focal_ratio /= anchors;
+
+            for (int a = 0; a < m; ++a) {
+                const int idx = local[a];
+                if (known[idx] >= 0) {
+                    continue;
+                }
+                cv::detail::CameraParams cam = cameras[a];
+                cv::Mat R;
+                cam.R.convertTo(R, CV_64F);
+                cv::Mat(G * R).convertTo(cam.R, CV_32F);
+                cam.focal *= focal_ratio;
+                added.push_back(registration.indices.size());
+                registration.indices.push_back(idx);
+                registration.full_sizes.push_back(full_sizes[idx]);
+                registration.cameras.push_back(cam);
+            }
+        }
+        return true;
+    } catch (const std::exception& ex) {
+        error_message = ex.what();
+        return false;
+    }
+}
+
+bool OpenCVStitcher::compose_region(const Registration& registration,
+                                    const std::vector<std::size_t>& added,
+                                    const FrameLoader& load_frame,
+                                    double compose_scale,
+                                    float warped_scale,
+                                    cv::Mat& canvas,
+                                    cv::Mat& canvas_mask,
+                                    cv::Point& origin,
+                                    std::string& error_message,
+                                    StitchReport* report) const {
+    if (added.empty()) {
+        return true;
+    }
+    if (canvas.empty() || canvas_mask.size() != canvas.size() || warped_scale <= 0.f) {
+        error_message = "No canvas to extend";
+        return false;
+    }
+
+    try {
+        OpenCVThreadsScope threads(compose_threads_);
+        auto stitcher = create_stitcher(registration.mode);
+        const cv::Ptr<cv::WarperCreator> warper = stitcher->warper();
+
+        // Affected region: where the new frames land
+        std::vector<cv::detail::CameraParams> added_cameras;
+        std::vector<cv::Size> added_sizes;
+        std::vector<char> is_added(registration.cameras.size(), 0);
+        for (std::size_t k : added) {
+            added_cameras.push_back(registration.cameras[k]);
+            added_sizes.push_back(registration.full_sizes[k]);
+            is_added[k] = 1;
+        }
+        const cv::Rect region = estimate_canvas(added_cameras, added_sizes, warper, compose_scale, warped_scale);
+
+        // Re-composite the new frames together with every earlier frame overlapping them
+        std::vector<std::size_t> subset;
+        std::vector<cv::detail::CameraParams> cameras;
+        std::vector<cv::Size> sizes;
+        for (std::size_t k = 0; k < registration.cameras.size(); ++k) {
+            if (!is_added[k]) {
+                const cv::Rect footprint = estimate_canvas({registration.cameras[k]}, {registration.full_sizes[k]},
+                                                           warper, compose_scale, warped_scale);
+                if ((footprint & region).empty()) {
+                    continue;
+                }
+            }
+            subset.push_back(k);
+            cameras.push_back(registration.cameras[k]);
+            sizes.push_back(registration.full_sizes[k]);
+        }
+        FrameLoader load_subset = [&](std::size_t i, double scale) { return load_frame(subset[i], scale); };
+
+        CompositeOptions options;
+        options.memory_budget_bytes = memory_budget_mb_ * 1024 * 1024;
+        options.compose_scale = compose_scale;
+        options.seam_megapix = seam_megapix_;
+        options.scratch_dir = scratch_dir_;
+        options.warped_scale = warped_scale;
+        cv::Mat local, local_mask;
+        CompositeReport composite;
+        if (!composite_streaming(cameras, sizes, load_subset, warper, create_seam_finder(seam_method_),
+                                 create_exposure_compensator(exposure_method_), options, local, &local_mask,
+                                 &composite, error_message)) {
+            return false;
+        }
+        if (std::abs(composite.compose_scale - compose_scale) > 1e-9) {
+            error_message = "Memory budget too small to extend the canvas at its original scale";
+            return false;
+        }
+
+        // Grow the canvas to cover the new frames
+        const cv::Rect local_rect(composite.canvas_origin, local.size());
+        const cv::Rect old_rect(origin, canvas.size());
+        const cv::Rect grown = old_rect | local_rect;
+        if (grown != old_rect) {
+            cv::Mat bigger(grown.size(), CV_8UC3, cv::Scalar::all(0));
+            cv::Mat bigger_mask(grown.size(), CV_8U, cv::Scalar::all(0));
+            const cv::Rect at(old_rect.tl() - grown.tl(), old_rect.size());
+            canvas.copyTo(bigger(at));
+            canvas_mask.copyTo(bigger_mask(at));
+            canvas = bigger;
+            canvas_mask = bigger_mask;
+            origin = grown.tl();
+        }
+
+        // Splice: inside the new frames' footprint the fresh composite wins, fading
+        // into the existing content over a band along the footprint's edge; elsewhere
+        // it only fills pixels that were empty.
+        cv::Mat footprint, distance;
+        render_footprints(added_cameras, added_sizes, warper, compose_scale, warped_scale, local_rect, footprint);
+        footprint &= local_mask;
+        cv::distanceTransform(footprint, distance, cv::DIST_L2, 3);
+        const float band = std::max(8.f, 0.02f * std::min(region.width, region.height));
+        const cv::Rect at(local_rect.tl() - origin, local_rect.size());
+        cv::Mat dst = canvas(at);
+        cv::Mat dst_mask = canvas_mask(at);
+        cv::parallel_for_(cv::Range(0, local.rows), [&](const cv::Range& rows) {
+            for (int y = rows.start; y < rows.end; ++y) {
+                const cv::Vec3b* src = local.ptr<cv::Vec3b>(y);
+                const uchar* src_m = local_mask.ptr<uchar>(y);
+                const float* d = distance.ptr<float>(y);
+                cv::Vec3b* out = dst.ptr<cv::Vec3b>(y);
+                uchar* out_m = dst_mask.ptr<uchar>(y);
+                for (int x = 0; x < local.cols; ++x) {
+                    if (!src_m[x]) {
+                        continue;
+                    }
+                    const float w = out_m[x] ? std::min(1.f, d[x] / band) : 1.f;
+                    if (w <= 0.f) {
+                        continue;
+                    }
+                    for (int c = 0; c < 3; ++c) {
+                        out[x][c] = cv::saturate_cast<uchar>(w * src[x][c] + (1.f - w) * out[x][c]);
+                    }
+                    out_m[x] = 255;
+                }
+            }
+        });
+
+        if (report) {
+            report->low_memory = true;
+            report->composite = composite;
+            report->composite.canvas = canvas.size();
+            report->composite.canvas_origin = origin;
+            report->result_mask = canvas_mask;
+        }
+        return true;
+    } catch (const std::exception& ex) {
+        error_message = ex.what();
+        return false;
+    }
+}
+
+bool OpenCVStitcher::compose(const Registration& registration,
+                             const FrameLoader& load_frame,
+                             double compose_scale,
+                             cv::Mat& output,
+                             std::string& error_message,
+                             StitchReport* report) const {
+    if (registration.cameras.empty()) {
+        error_message = "No registered images to compose";
+        return false;
+    }
+
+    try {
+        OpenCVThreadsScope threads(compose_threads_);
+        // Reuse the warper cv::Stitcher picks for this mode, with the configured seam finder and compensator
+        auto stitcher = create_stitcher(registration.mode);
+
+        CompositeOptions options;
+        options.memory_budget_bytes = memory_budget_mb_ * 1024 * 1024;
+        options.compose_scale = compose_scale;
+        options.seam_megapix = seam_megapix_;
+        options.scratch_dir = scratch_dir_;
+        options.feather_only = preview_;
+        CompositeReport composite;
+        if (!composite_streaming(registration.cameras, registration.full_sizes, load_frame, stitcher->warper(),
+                                 create_seam_finder(seam_method_), create_exposure_compensator(exposure_method_),
+                                 options, output, report ? &report->result_mask : nullptr,
+                                 &composite, error_message)) {
+            return false;
+        }
+        if (report) {
+            report->low_memory = true;
+            report->composite = composite;
+        }
+        return true;
+    } catch (const std::exception& ex) {
+        error_message = ex.what();
+        return false;
+    }
+}
+
+bool OpenCVStitcher::stitch(const std::vector<cv::Mat>& images,
+                            cv::Mat& output,
+                            std::string& error_message,
+                            cv::Stitcher::Mode mode,
+                            StitchReport* report) const {
+    if (images.size() < 1) {
+        error_message = "No images provided";
+        return false;
+    }
+
+    try {
+        if (uses_default_pipeline()) {
+            auto stitcher = create_stitcher(mode);
+
+            // cv::Stitcher's own ORB finder and matchers (the explicit path handles other feature settings)
+            // Same as cv::Stitcher::stitch(), split so the two halves can be profiled
+            cv::Stitcher::Status status;
+            {
+                // Features and matching run inside one call here; the larger budget applies
+                OpenCVThreadsScope threads(std::max(features_threads_, matching_threads_));
+                PROFILE_SCOPE("estimate_transform");
+                status = stitcher->estimateTransform(images);
+            }
+            if (status == cv::Stitcher::OK) {
+                profiler::count("registered_images", static_cast<double>(stitcher->component().size()));
+                OpenCVThreadsScope threads(compose_threads_);
+                PROFILE_SCOPE("compose_panorama");
+                status = stitcher->composePanorama(output);
+            }
+            if (status != cv::Stitcher::OK) {
+                error_message = status_message(status);
+                return false;
+            }
+            profiler::count("canvas_px", static_cast<double>(output.total()));
+            if (report) {
+                stitcher->resultMask().copyTo(report->result_mask);
+            }
+            return true;
+        }
+
+        // Explicit pipeline: register, then warp/seam/blend one image at a time
+        std::vector<cv::Size> sizes;
+        sizes.reserve(images.size());
+        for (const auto& im : images) {
+            sizes.push_back(im.size());
+        }
+        Registration registration;
+        if (!estimate(images, sizes, registration, error_message, mode)) {
+            return false;
+        }
+        FrameLoader load_frame = [&](std::size_t i, double scale) -> cv::Mat {
+            const cv::Mat& src = images[registration.indices[i]];
+            if (std::abs(scale - 1.0) < 1e-9) {
+                return src;
+            }
+            cv::Mat dst;
+            cv::Size sz(std::max(1, cvRound(src.cols * scale)), std::max(1, cvRound(src.rows * scale)));
+            cv::resize(src, dst, sz, 0, 0, scale < 1.0 ? cv::INTER_AREA : cv::INTER_LINEAR);
+            return dst;
+        };
+        return compose(registration, load_frame, 1.0, output, error_message, report);
+    } catch (const std::exception& ex) {
+        error_message = ex.what();
+        return false;
+    }
+}
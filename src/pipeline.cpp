@@ -0,0 +1,962 @@
+#include "pipeline.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <fstream>
+#include <functional>
+#include <future>
+#include <iostream>
+#include <iterator>
+#include <memory>
+#include <random>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <opencv2/core/utility.hpp>
+#include <opencv2/imgcodecs.hpp>
+#include <opencv2/imgproc.hpp>
+
+#include "frame_store.hpp"
+#include "cpu_affinity.hpp"
+#include "image_io.hpp"
+#include "incremental_state.hpp"
+#include "output_writer.hpp"
+#include "panorama_stitcher.hpp"
+#include "profiler.hpp"
+#include "thread_pool.hpp"
+#include "tile_pyramid.hpp"
+#include "utils.hpp"
+#include "video_input.hpp"
+
+namespace fs = std::filesystem;
+using Clock = std::chrono::steady_clock;
+
+static double ms_since(Clock::time_point t0) {
+    return std::chrono::duration<double, std::milli>(Clock::now() - t0).count();
+}
+
+// One configuration of the --retry ladder.
+struct RetryAttempt {
+    std::string name;
+    float confidence;
+    FeatureOptions features;
+    cv::Stitcher::Mode mode;
+    int max_dropped;
+};
+
+// Fallbacks tried in order after registration fails. Each step keeps the changes of
+// the steps before it, except that outliers are dropped in the requested mode.
+static std::vector<RetryAttempt> retry_ladder(const FeatureOptions& base, cv::Stitcher::Mode mode,
+                                              std::size_t images) {
+    std::vector<RetryAttempt> ladder;
+    ladder.push_back({"confidence 0.3", 0.3f, base, mode, 0});
+
+    FeatureOptions more = base;
+    more.max_keypoints = std::max(4000, base.max_keypoints * 2);
+    more.grid_cols = 4;
+    more.grid_rows = 3;
+    more.registration_megapix = std::max(1.0, base.registration_megapix);
+    ladder.push_back({"confidence 0.3, " + std::to_string(more.max_keypoints) + " keypoints at 1 MP", 0.3f, more,
+                      mode, 0});
+    if (mode == cv::Stitcher::PANORAMA) {
+        ladder.push_back({ladder.back().name + ", scans mode", 0.3f, more, cv::Stitcher::SCANS, 0});
+    }
+    const int drop = std::max(1, static_cast<int>(images / 4));
+    ladder.push_back({ladder[1].name + ", dropping up to " + std::to_string(drop) + " outlier frame(s)", 0.3f, more,
+                      mode, drop});
+    return ladder;
+}
+
+// Registration cache that lives only as long as one run: --retry without --cache
+// shares features and matches between its attempts through it, and the directory
+// is removed again when the run ends.
+struct ScratchCacheDir {
+    fs::path dir;
+    ~ScratchCacheDir() {
+        if (!dir.empty()) {
+            std::error_code ec;
+            fs::remove_all(dir, ec);
+        }
+    }
+    // Create a fresh, empty directory under the system temp directory.
+    bool create() {
+        std::error_code ec;
+        const fs::path base = fs::temp_directory_path(ec);
+        if (ec) {
+            return false;
+        }
+        std::random_device rd;
+        for (int attempt = 0; attempt < 16; ++attempt) {
+            std::ostringstream name;
+            name << "panorama_retry_" << std::hex << rd() << rd();
+            const fs::path candidate = base / name.str();
+            if (fs::create_directory(candidate, ec) && !ec) {
+                dir = candidate;
+                return true;
+            }
+        }
+        return false;
+    }
+};
+
+// Crop a stitched canvas as --crop asks (see utils::crop_rect); returns a view into 'pano'.
+static cv::Mat crop_panorama(const cv::Mat& pano, const cv::Mat& resultMask, const std::string& crop,
+                             std::ostream& err_out) {
+    PROFILE_SCOPE("trim");
+    std::string warning;
+    const cv::Rect roi = utils::crop_rect(pano, resultMask, crop, &warning);
+    if (!warning.empty()) {
+        err_out << "Warning: " << warning << "\n";
+    }
+    return pano(roi);
+}
+
+// Output file of the k-th extra --partial component: <stem>_part<k+1><ext>.
+static fs::path part_file(const fs::path& outFile, std::size_t k) {
+    return outFile.parent_path() /
+           (outFile.stem().string() + "_part" + std::to_string(k + 1) + outFile.extension().string());
+}
+
+// JSON report of a --preview run: how many frames registered, how confidently
+// they are tied together, and how much of the bounding canvas they fill.
+// 'mask' is the valid-pixel mask of the preview canvas (empty if nothing was
+// composited) and 'cropped' the size written after --crop.
+static bool write_preview_report(const fs::path& file,
+                                 const MatchGraph& graph,
+                                 const std::vector<fs::path>& frames,
+                                 const cv::Mat& mask,
+                                 const cv::Size& cropped,
+                                 const std::string& failure,
+                                 double elapsed_ms,
+                                 std::string& error_message) {
+    std::size_t registered = 0;
+    for (int c : graph.component) {
+        registered += c == 0;
+    }
+    // Mean confidence of the links holding the panorama together, and the weakest
+    // frame: the registered frame whose best link is the lowest
+    double sum = 0.0;
+    int links = 0;
+    std::vector<double> best(frames.size(), 0.0);
+    for (const MatchGraph::Edge& e : graph.edges) {
+        if (graph.component[e.i] != 0 || graph.component[e.j] != 0 || e.confidence <= graph.confidence_threshold) {
+            continue;
+        }
+        sum += e.confidence;
+        ++links;
+        best[e.i] = std::max(best[e.i], e.confidence);
+        best[e.j] = std::max(best[e.j], e.confidence);
+    }
+    int weakest = -1;
+    for (std::size_t i = 0; i < frames.size(); ++i) {
+        if (graph.component[i] == 0 && best[i] > 0.0 && (weakest < 0 || best[i] < best[weakest])) {
+            weakest = static_cast<int>(i);
+        }
+    }
+    const double canvas_px = static_cast<double>(mask.total());
+
+    std::ofstream json(file);
+    json << "{\n  \"status\": "
+         << (!failure.empty() ? "\"failed\"" : registered == frames.size() ? "\"ok\"" : "\"partial\"");
+    if (!failure.empty()) {
+        json << ",\n  \"error\": " << utils::json_string(failure);
+    }
+    json << ",\n  \"frames\": " << frames.size() << ",\n  \"registered\": " << registered
+         << ",\n  \"unregistered\": [";
+    bool first = true;
+    for (std::size_t i = 0; i < frames.size(); ++i) {
+        if (graph.component[i] != 0) {
+            json << (first ? "" : ", ") << utils::json_string(frames[i].string());
+            first = false;
+        }
+    }
+    json << "],\n  \"confidence_threshold\": " << graph.confidence_threshold << ",\n  \"links\": " << links
+         << ",\n  \"mean_confidence\": " << (links ? sum / links : 0.0);
+    if (weakest >= 0) {
+        json << ",\n  \"weakest_frame\": {\"file\": " << utils::json_string(frames[weakest].string())
+             << ", \"confidence\": " << best[weakest] << "}";
+    }
+    json << ",\n  \"canvas\": [" << mask.cols << ", " << mask.rows << "]"
+         << ",\n  \"coverage\": " << (canvas_px > 0.0 ? cv::countNonZero(mask) / canvas_px : 0.0)
+         << ",\n  \"crop_fraction\": " << (canvas_px > 0.0 ? cropped.area() / canvas_px : 0.0)
+         << ",\n  \"elapsed_ms\": " << elapsed_ms << "\n}\n";
+    if (!json) {
+        error_message = "Failed to write " + file.string();
+        return false;
+    }
+    return true;
+}
+
+// JSON report of the --partial match graph: every frame with the component it
+// joined, every matched pair, and the output written for each component.
+static bool write_match_graph(const fs::path& file,
+                              const MatchGraph& graph,
+                              const std::vector<fs::path>& frames,
+                              const std::vector<fs::path>& outputs,
+                              std::string& error_message) {
+    std::ofstream json(file);
+    json << "{\n  \"confidence_threshold\": " << graph.confidence_threshold << ",\n  \"frames\": [";
+    for (std::size_t i = 0; i < frames.size(); ++i) {
+        const int c = i < graph.component.size() ? graph.component[i] : -1;
+        json << (i ? "," : "") << "\n    {\"index\": " << i << ", \"file\": " << utils::json_string(frames[i].string())
+             << ", \"component\": " << c << "}";
+    }
+    json << "\n  ],\n  \"edges\": [";
+    for (std::size_t e = 0; e < graph.edges.size(); ++e) {
+        const MatchGraph::Edge& edge = graph.edges[e];
+        json << (e ? "," : "") << "\n    {\"i\": " << edge.i << ", \"j\": " << edge.j
+             << ", \"confidence\": " << edge.confidence << ", \"inliers\": " << edge.inliers
+             << ", \"connected\": " << (edge.confidence > graph.confidence_threshold ? "true" : "false") << "}";
+    }
+    json << "\n  ],\n  \"components\": [";
+    for (std::size_t c = 0; c < outputs.size(); ++c) {
+        json << (c ? "," : "") << "\n    {\"component\": " << c << ", \"frames\": [";
+        bool first = true;
+        for (std::size_t i = 0; i < graph.component.size(); ++i) {
+            if (graph.component[i] == static_cast<int>(c)) {
+                json << (first ? "" : ", ") << i;
+                first = false;
+            }
+        }
+        json << "], \"output\": " << utils::json_string(outputs[c].string()) << "}";
+    }
+    json << "\n  ]\n}\n";
+    if (!json) {
+        error_message = "Failed to write " + file.string();
+        return false;
+    }
+    return true;
+}
+
+bool configure_threads(const CLIOptions& opts, std::ostream& err_out) {
+    std::vector<int> cpus;
+    std::string err;
+    if (opts.numa_node >= 0 && !numa_node_cpus(opts.numa_node, cpus, err)) {
+        err_out << "Error: " << err << "\n";
+        return false;
+    }
+    if (!opts.cpus.empty()) {
+        std::vector<int> listed;
+        if (!parse_cpu_list(opts.cpus, listed)) {
+            err_out << "Error: invalid CPU list '" << opts.cpus << "'\n";
+            return false;
+        }
+        if (cpus.empty()) {
+            cpus = listed;
+        } else {
+            // --cpus within --numa-node: keep the listed CPUs that are on the node
+            std::vector<int> both;
+            std::set_intersection(cpus.begin(), cpus.end(), listed.begin(), listed.end(), std::back_inserter(both));
+            if (both.empty()) {
+                err_out << "Error: none of the CPUs " << opts.cpus << " is on NUMA node " << opts.numa_node << "\n";
+                return false;
+            }
+            cpus = both;
+        }
+    }
+    if (!cpus.empty() && !pin_to_cpus(cpus, err)) {
+        err_out << "Error: " << err << "\n";
+        return false;
+    }
+
+    set_default_thread_count(opts.threads);
+    if (opts.threads > 0 || !cpus.empty()) {
+        cv::setNumThreads(static_cast<int>(resolve_thread_count(0)));
+    }
+    const StageThreads& st = opts.stage_threads;
+    if ((st.features || st.matching || st.compose) && (!opts.batch_root.empty() || !opts.watch_root.empty())) {
+        err_out << "Warning: features/matching/compose thread budgets are ignored in batch and watch mode, "
+                   "where concurrent jobs share OpenCV's pool (sized by --threads)\n";
+    }
+    return true;
+}
+
+// 'requested' without the options that cannot apply to this run, with one warning
+// naming them: --video keeps only downscaled keyframes in memory, so nothing can be
+// re-decoded from files, and --preview is one fixed configuration that adds no
+// other work or outputs.
+static CLIOptions resolve_option_conflicts(const CLIOptions& requested, std::ostream& err_out) {
+    CLIOptions opts = requested;
+    const bool video = !opts.video.empty();
+    std::vector<std::string> ignored;
+    auto ignore = [&](bool set, const char* flag, const std::function<void()>& reset) {
+        if (set) {
+            ignored.push_back(flag);
+            reset();
+        }
+    };
+    ignore((video || opts.preview) && opts.register_dim > 0, "--register-dim", [&] { opts.register_dim = 0; });
+    ignore((video || opts.preview) && opts.incremental, "--incremental", [&] { opts.incremental = false; });
+    if (opts.preview) {
+        ignore(opts.partial, "--partial", [&] { opts.partial = false; });
+        ignore(opts.retry, "--retry", [&] { opts.retry = false; });
+        ignore(opts.memory_budget_mb > 0, "--memory-budget", [&] { opts.memory_budget_mb = 0; });
+        ignore(!opts.tiles_dir.empty(), "--tiles", [&] { opts.tiles_dir.clear(); });
+        ignore(!opts.seam.empty(), "--seam", [&] { opts.seam.clear(); });
+        ignore(!opts.exposure.empty(), "--exposure", [&] { opts.exposure.clear(); });
+        ignore(opts.seam_megapix > 0.0, "--seam-megapix", [&] { opts.seam_megapix = 0.0; });
+    }
+    if (!ignored.empty()) {
+        err_out << "Warning: ignoring";
+        for (std::size_t i = 0; i < ignored.size(); ++i) {
+            err_out << (i ? ", " : " ") << ignored[i];
+        }
+        const char* cause = video && opts.preview ? "--video and --preview" : video ? "--video" : "--preview";
+        err_out << " (not applicable with " << cause << ")\n";
+    }
+    return opts;
+}
+
+int run_pipeline(const CLIOptions& requested,
+                 const fs::path& inputDir,
+                 const fs::path& outputDir,
+                 const PipelineContext& ctx,
+                 PipelineResult* result) {
+    std::ostream& out = ctx.out ? *ctx.out : std::cout;
+    std::ostream& err_out = ctx.err ? *ctx.err : std::cerr;
+    const CLIOptions opts = resolve_option_conflicts(requested, err_out);
+    PipelineResult local;
+    PipelineResult& res = result ? *result : local;
+    res = PipelineResult();
+    const auto tStart = Clock::now();
+
+    auto fail = [&](int code, const std::string& message) {
+        err_out << message << "\n";
+        res.exit_code = code;
+        res.message = message;
+        res.timings.total_ms = ms_since(tStart);
+        return code;
+    };
+
+    try {
+        const bool video = !opts.video.empty();
+
+        // Check input directory exists
+        if (!video && (!fs::exists(inputDir) || !fs::is_directory(inputDir))) {
+            return fail(2, "Input directory does not exist or is not a directory: " + inputDir.string());
+        }
+
+        // Create output directory if it doesn't exist
+        if (!fs::exists(outputDir)) {
+            std::error_code ec;
+            fs::create_directories(outputDir, ec);
+            if (ec) {
+                return fail(3, "Failed to create output directory: " + outputDir.string() + " (" + ec.message() + ")");
+            }
+        }
+
+        // Load images (parallel decode, reduced-resolution JPEG decode where --max-dim allows).
+        // With --register-dim only small registration proxies are kept in memory.
+        const bool twoPhase = opts.register_dim > 0;
+        const int loadDim = opts.preview ? kPreviewDim : twoPhase ? opts.register_dim : opts.max_dim;
+        // Low-memory runs keep the decoded frames in memory-mapped scratch files, paged in only
+        // while a stage works on them and freed after their last use (proxies are small enough to keep)
+        std::unique_ptr<FrameStore> store;
+        if (opts.memory_budget_mb > 0 && !twoPhase && !video) {
+            store = std::make_unique<FrameStore>(outputDir);
+        }
+        auto tLoad = Clock::now();
+        std::vector<cv::Mat> images;       // views into 'store' when it exists
+        std::vector<std::size_t> slots;    // store slot of each image
+        std::vector<fs::path> loadedPaths; // <video>#<frame> for video keyframes
+        std::vector<cv::Size> fullSizes;
+        if (video) {
+            // --video: keyframes are picked while the stream decodes; no frame goes through the disk
+            KeyframeOptions keyOptions;
+            keyOptions.max_dim = loadDim;
+            keyOptions.overlap = opts.video_overlap;
+            std::vector<Keyframe> keyframes;
+            VideoStats videoStats;
+            std::string videoErr;
+            bool extracted = false;
+            {
+                PROFILE_SCOPE("video");
+                extracted = extract_keyframes(opts.video, keyOptions, keyframes, &videoStats, videoErr);
+            }
+            if (!extracted) {
+                return fail(4, videoErr);
+            }
+            for (auto& k : keyframes) {
+                slots.push_back(images.size());
+                images.push_back(std::move(k.image));
+                loadedPaths.push_back(fs::path(opts.video + "#" + std::to_string(k.frame_index)));
+                fullSizes.push_back(k.original_size);
+            }
+            out << "Video: selected " << images.size() << " keyframe(s) from " << videoStats.frames
+                << " frame(s) in " << videoStats.wall_ms << " ms (" << videoStats.blurry_rejected
+                << " blurry frame(s) passed over)\n";
+        } else {
+            // Gather images (HEIC/HEIF frames are decoded directly by the loader)
+            std::vector<fs::path> imagePaths = list_image_files(inputDir);
+            if (imagePaths.empty()) {
+                return fail(4, "No images found in: " + inputDir.string());
+            }
+
+            // Optionally decode HEIC/HEIF through JPEG copies kept in the cache directory;
+            // the input folder is left untouched
+            if (opts.heic_cache) {
+                PROFILE_SCOPE("heic");
+                int jpgQuality = 95;
+                std::string report;
+                HeicCacheStats heic = cache_heic_as_jpeg(imagePaths, outputDir / ".panorama_cache" / "heic",
+                                                         ctx.pool, jpgQuality, &report);
+                if (heic.reused + heic.written + heic.failed > 0) {
+                    out << "HEIC cache: " << heic.reused << " reused, " << heic.written << " written, "
+                        << heic.failed << " failed in " << heic.wall_ms << " ms\n";
+                }
+                if (!report.empty()) {
+                    out << report; // include per-file results
+                }
+            }
+
+            LoadStats loadStats;
+            std::vector<LoadedImage> loaded;
+            {
+                PROFILE_SCOPE("load");
+                loaded = ctx.pool ? load_images(imagePaths, loadDim, *ctx.pool, &loadStats, store.get())
+                                  : load_images(imagePaths, loadDim, opts.stage_threads.decode, &loadStats,
+                                                store.get());
+            }
+            images.reserve(loaded.size());
+            for (std::size_t i = 0; i < loaded.size(); ++i) {
+                LoadedImage& li = loaded[i];
+                if (li.image.empty()) {
+                    err_out << "Warning: failed to load image: " << li.path.string()
+                            << (utils::is_heic_file(li.path) ? " (check OpenCV HEIF support)" : "") << "\n";
+                    continue;
+                }
+                images.emplace_back(std::move(li.image));
+                slots.push_back(i);
+                loadedPaths.push_back(li.path);
+                fullSizes.push_back(li.original_size);
+            }
+            loaded.clear();
+            out << "Loaded " << images.size() << " image(s) in " << loadStats.wall_ms << " ms using "
+                << loadStats.threads << " thread(s) (decode " << loadStats.decode_ms << " ms, resize "
+                << loadStats.resize_ms << " ms, " << loadStats.reduced_decodes << " reduced decode(s))\n";
+            if (store) {
+                out << "Frame store: " << (store->stored_bytes() >> 20) << " MB of decoded frames in scratch files\n";
+            }
+        }
+        res.images = images.size();
+        profiler::count("images", static_cast<double>(images.size()));
+        res.timings.load_ms = ms_since(tLoad);
+        if (images.empty()) {
+            return fail(5, "Failed to load any images from: " + (video ? opts.video : inputDir.string()));
+        }
+        // Registration cache keys need files on disk; video keyframes are not cached
+        const std::vector<fs::path>* sources = video ? nullptr : &loadedPaths;
+
+        // If only one image provided, save it directly as the panorama
+        fs::path outFile = outputDir / (opts.output_filename.empty() ? fs::path("panorama.jpg") : fs::path(opts.output_filename));
+        if (opts.preview) {
+            // A preview never replaces a full-resolution result
+            outFile = outputDir / (outFile.stem().string() + "_preview.jpg");
+        }
+        if (images.size() == 1) {
+            cv::Mat single = twoPhase ? load_image_scaled(loadedPaths.front(), fullSizes.front(), opts.compose_scale)
+                                      : images.front();
+            if (!cv::imwrite(outFile.string(), single)) {
+                return fail(6, "Failed to save output image to: " + outFile.string());
+            }
+            out << "Only one image provided; copied to output: " << outFile.string() << "\n";
+            res.message = outFile.string();
+            res.timings.total_ms = ms_since(tStart);
+            return 0;
+        }
+
+        // Stitch panorama
+        cv::Mat pano;
+        std::string err;
+        OpenCVStitcher stitcher;
+        double rx = 0.0, ry = 0.0, rw = 1.0, rh = 1.0;
+        if (!parse_match_region(opts.match_region, rx, ry, rw, rh)) {
+            err_out << "Warning: ignoring invalid match region '" << opts.match_region << "'\n";
+            rx = 0.0, ry = 0.0, rw = 1.0, rh = 1.0;
+        }
+        stitcher.set_match_region(cv::Rect2d(rx, ry, rw, rh));
+        FeatureOptions features;
+        if (!opts.quality.empty() && !feature_preset(opts.quality, features)) {
+            err_out << "Warning: ignoring unknown quality preset '" << opts.quality << "'\n";
+        }
+        if (!opts.features.empty() && !parse_feature_backend(opts.features, features.backend)) {
+            err_out << "Warning: ignoring unknown feature detector '" << opts.features << "'\n";
+        }
+        if (opts.max_keypoints >= 0) {
+            features.max_keypoints = opts.max_keypoints;
+        }
+        stitcher.set_features(features);
+        stitcher.set_memory_budget_mb(opts.memory_budget_mb);
+        stitcher.set_scratch_dir(outputDir);
+        stitcher.set_match_window(opts.match_window, opts.match_wrap);
+        SeamMethod seamMethod;
+        if (!opts.seam.empty()) {
+            if (parse_seam_method(opts.seam, seamMethod)) {
+                stitcher.set_seam_method(seamMethod);
+            } else {
+                err_out << "Warning: ignoring unknown seam finder '" << opts.seam << "'\n";
+            }
+        }
+        ExposureMethod exposureMethod;
+        if (!opts.exposure.empty()) {
+            if (parse_exposure_method(opts.exposure, exposureMethod)) {
+                stitcher.set_exposure_method(exposureMethod);
+            } else {
+                err_out << "Warning: ignoring unknown exposure compensator '" << opts.exposure << "'\n";
+            }
+        }
+        if (opts.seam_megapix > 0.0) {
+            stitcher.set_seam_megapix(opts.seam_megapix);
+        }
+        // OpenCV's pool is process-wide: jobs sharing a process (ctx.pool set) keep the size from --threads
+        if (!ctx.pool) {
+            stitcher.set_stage_threads(opts.stage_threads.features, opts.stage_threads.matching,
+                                       opts.stage_threads.compose);
+        }
+        cv::Stitcher::Mode mode = (opts.mode == "scans") ? cv::Stitcher::SCANS : cv::Stitcher::PANORAMA;
+        StitchReport stitchReport;
+        ScratchCacheDir retryCache;
+        if (opts.use_cache || opts.incremental) {
+            stitcher.set_cache_dir(outputDir / ".panorama_cache");
+        } else if (opts.retry) {
+            if (retryCache.create()) {
+                stitcher.set_cache_dir(retryCache.dir);
+            } else {
+                err_out << "Warning: no temporary directory for the --retry cache; attempts recompute features\n";
+            }
+        }
+        auto tRegister = Clock::now();
+        if (opts.preview) {
+            // --preview: register the small frames already in memory, feather them together without
+            // seams or exposure compensation, and report how well the set holds together
+            stitcher.set_preview(true);
+            std::vector<cv::Size> sizes;
+            for (const auto& im : images) {
+                sizes.push_back(im.size());
+            }
+            Registration registration;
+            MatchGraph graph;
+            bool stitched = false;
+            {
+                PROFILE_SCOPE("register");
+                stitched = stitcher.estimate(images, sizes, registration, err, mode, sources, &graph);
+            }
+            res.timings.register_ms = ms_since(tRegister);
+            if (stitched) {
+                auto tCompose = Clock::now();
+                FrameLoader loadFrame = [&](std::size_t i, double scale) -> cv::Mat {
+                    const cv::Mat& src = images[registration.indices[i]];
+                    if (std::abs(scale - 1.0) < 1e-9) {
+                        return src;
+                    }
+                    cv::Mat scaled;
+                    cv::resize(src, scaled, cv::Size(), scale, scale, scale < 1.0 ? cv::INTER_AREA : cv::INTER_LINEAR);
+                    return scaled;
+                };
+                PROFILE_SCOPE("compose");
+                stitched = stitcher.compose(registration, loadFrame, 1.0, pano, err, &stitchReport);
+                res.timings.compose_ms = ms_since(tCompose);
+            }
+            auto tWrite = Clock::now();
+            cv::Mat trimmed;
+            if (stitched) {
+                trimmed = crop_panorama(pano, stitchReport.result_mask, opts.crop, err_out);
+                PROFILE_SCOPE("encode");
+                if (!cv::imwrite(outFile.string(), trimmed, {cv::IMWRITE_JPEG_QUALITY, 80})) {
+                    return fail(8, "Failed to save preview to: " + outFile.string());
+                }
+            }
+            const fs::path reportFile = outputDir / (outFile.stem().string() + ".json");
+            std::string reportErr;
+            if (!write_preview_report(reportFile, graph, loadedPaths, stitched ? stitchReport.result_mask : cv::Mat(),
+                                      trimmed.size(), stitched ? std::string() : "Stitching failed: " + err, ms_since(tStart),
+                                      reportErr)) {
+                err_out << "Warning: " << reportErr << "\n";
+            } else {
+                out << "Preview report written to: " << reportFile.string() << "\n";
+            }
+            if (!stitched) {
+                return fail(7, "Stitching failed: " + err);
+            }
+            res.timings.write_ms = ms_since(tWrite);
+            out << "Preview: " << registration.indices.size() << " of " << images.size() << " frame(s) registered, "
+                << trimmed.cols << "x" << trimmed.rows << " in " << ms_since(tStart) << " ms\n";
+            out << "Preview saved to: " << outFile.string() << "\n";
+            res.message = outFile.string();
+            res.timings.total_ms = ms_since(tStart);
+            return 0;
+        }
+        if (twoPhase || opts.use_cache || opts.incremental || opts.retry || opts.partial || store ||
+            ctx.explicit_stages) {
+            // Register (reusing cached work if enabled), then compose either from the original
+            // files streamed from disk (--register-dim) or from the images already in memory
+            Registration registration;
+            std::vector<cv::Size> registeredSizes = twoPhase ? fullSizes : std::vector<cv::Size>();
+            if (!twoPhase) {
+                for (const auto& im : images) {
+                    registeredSizes.push_back(im.size());
+                }
+            }
+            double composeScale = twoPhase ? opts.compose_scale : 1.0;
+
+            // --incremental: resume from the previous run's cameras and canvas when the earlier
+            // frames are all still there, unchanged, and were stitched with the same options
+            const fs::path stateDir = outputDir / ".panorama_cache" / "incremental";
+            std::ostringstream stateSettings;
+            stateSettings << "mode=" << opts.mode << "|dim=" << loadDim << "|register=" << twoPhase
+                          << "|compose=" << composeScale << "|region=" << opts.match_region
+                          << "|window=" << opts.match_window << "|wrap=" << opts.match_wrap;
+            std::vector<std::string> frameKeys;
+            IncrementalState state;
+            std::vector<std::size_t> added;
+            bool resumed = false;
+            if (opts.incremental) {
+                for (const auto& p : loadedPaths) {
+                    frameKeys.push_back(RegistrationCache::file_key(p, std::string()));
+                }
+                Registration previous;
+                std::string stateErr;
+                if (!load_incremental_state(stateDir, state, &stateErr)) {
+                    out << "Incremental: no previous state; stitching all frames\n";
+                } else if (state.settings != stateSettings.str() ||
+                           !resolve_incremental_frames(state, frameKeys, registeredSizes, previous)) {
+                    out << "Incremental: options or earlier frames changed; stitching all frames\n";
+                } else {
+                    PROFILE_SCOPE("register");
+                    resumed = stitcher.extend(images, registeredSizes, previous, registration, added, err, sources);
+                    if (!resumed) {
+                        err_out << "Warning: incremental registration failed (" << err << "); stitching all frames\n";
+                    }
+                }
+            }
+
+            bool registered = resumed;
+            std::vector<Registration> parts; // --partial: the components after the largest one
+            // --partial: every connected group of frames is registered; the largest takes the
+            // regular output, the others go to <stem>_part<k><ext>. Each call rewrites the graph.
+            auto registerComponents = [&](cv::Stitcher::Mode attemptMode) {
+                std::vector<Registration> components;
+                MatchGraph graph;
+                bool ok = false;
+                {
+                    PROFILE_SCOPE("register");
+                    ok = stitcher.estimate_components(images, registeredSizes, components, graph, err, attemptMode,
+                                                      sources);
+                }
+                std::vector<fs::path> outputs;
+                for (std::size_t c = 0; c < components.size(); ++c) {
+                    outputs.push_back(c == 0 ? outFile : part_file(outFile, c));
+                }
+                const fs::path graphFile = outputDir / (outFile.stem().string() + "_graph.json");
+                std::string graphErr;
+                if (write_match_graph(graphFile, graph, loadedPaths, outputs, graphErr)) {
+                    out << "Match graph written to: " << graphFile.string() << "\n";
+                } else {
+                    err_out << "Warning: " << graphErr << "\n";
+                }
+                if (ok) {
+                    registration = components.front();
+                    parts.assign(components.begin() + 1, components.end());
+                    out << "Partial: " << components.size() << " component(s) of " << images.size() << " frame(s);";
+                    for (const auto& c : components) {
+                        out << " " << c.indices.size();
+                    }
+                    out << " frame(s) each\n";
+                }
+                return ok;
+            };
+            if (!registered && opts.partial) {
+                registered = registerComponents(mode);
+            } else if (!registered) {
+                PROFILE_SCOPE("register");
+                registered = stitcher.estimate(images, registeredSizes, registration, err, mode, sources);
+            }
+            if (!registered && opts.retry) {
+                // --retry: escalate on the frames already decoded. Features and matches an attempt
+                // shares with an earlier one come back from the registration cache. The budget is
+                // only checked between attempts, so the last one may run past it.
+                for (const RetryAttempt& attempt : retry_ladder(features, mode, images.size())) {
+                    if (opts.partial && attempt.max_dropped > 0) {
+                        continue; // components already leave out frames that do not fit
+                    }
+                    if (ms_since(tRegister) > opts.retry_budget_s * 1000.0) {
+                        err_out << "Warning: retry time budget of " << opts.retry_budget_s << " s used up\n";
+                        break;
+                    }
+                    out << "Registration failed (" << err << "); retrying with " << attempt.name << "\n";
+                    stitcher.set_confidence_threshold(attempt.confidence);
+                    stitcher.set_features(attempt.features);
+                    stitcher.set_max_dropped_frames(attempt.max_dropped);
+                    if (opts.partial) {
+                        registered = registerComponents(attempt.mode);
+                    } else {
+                        PROFILE_SCOPE("register");
+                        registered = stitcher.estimate(images, registeredSizes, registration, err, attempt.mode,
+                                                       sources);
+                    }
+                    if (registered) {
+                        res.registration_attempt = attempt.name;
+                        out << "Registered " << registration.indices.size() << " of " << images.size()
+                            << " frame(s) with " << attempt.name << "\n";
+                        break;
+                    }
+                }
+            }
+            if (!registered) {
+                return fail(7, "Stitching failed: " + err);
+            }
+            res.timings.register_ms = ms_since(tRegister);
+            if (twoPhase) {
+                images.clear();
+            }
+            if (store) {
+                // Registered frames have a use left for every load the compositor makes (seam pass
+                // unless it is skipped, compose pass); the rest are freed
+                const int uses = stitcher.frame_loads();
+                for (int idx : registration.indices) {
+                    store->retain(slots[idx], uses);
+                }
+                for (const auto& part : parts) {
+                    for (int idx : part.indices) {
+                        store->retain(slots[idx], uses);
+                    }
+                }
+                for (std::size_t slot : slots) {
+                    store->release(slot);
+                }
+                images.clear(); // views of freed frames
+            }
+            // A full-scale view handed to the compositor is only released on the next call,
+            // once the compositor has let go of it, and the last one by releaseHeld() after
+            // compositing. One loader (and held slot) per registration composited.
+            auto releaseHeld = [&](std::size_t& heldSlot) {
+                if (store && heldSlot != SIZE_MAX) {
+                    store->release(heldSlot);
+                    heldSlot = SIZE_MAX;
+                }
+            };
+            auto makeLoader = [&](const Registration& reg, const std::shared_ptr<std::size_t>& heldSlot) -> FrameLoader {
+                return [&, heldSlot](std::size_t i, double scale) -> cv::Mat {
+                    const int idx = reg.indices[i];
+                    if (twoPhase) {
+                        return load_image_scaled(loadedPaths[idx], fullSizes[idx], scale);
+                    }
+                    cv::Mat src;
+                    if (!store) {
+                        src = images[idx];
+                    } else {
+                        releaseHeld(*heldSlot);
+                        src = store->view(slots[idx]);
+                        if (src.empty()) {
+                            // Used up (e.g. a second compositing attempt): decode it again
+                            src = load_image(loadedPaths[idx], loadDim);
+                        } else if (std::abs(scale - 1.0) < 1e-9) {
+                            *heldSlot = slots[idx];
+                            return src;
+                        } else {
+                            cv::Mat scaled;
+                            cv::resize(src, scaled, cv::Size(), scale, scale, scale < 1.0 ? cv::INTER_AREA : cv::INTER_LINEAR);
+                            store->release(slots[idx]);
+                            return scaled;
+                        }
+                    }
+                    if (std::abs(scale - 1.0) < 1e-9) {
+                        return src;
+                    }
+                    cv::Mat scaled;
+                    cv::resize(src, scaled, cv::Size(), scale, scale, scale < 1.0 ? cv::INTER_AREA : cv::INTER_LINEAR);
+                    return scaled;
+                };
+            };
+            auto heldSlot = std::make_shared<std::size_t>(SIZE_MAX);
+            FrameLoader loadFrame = makeLoader(registration, heldSlot);
+
+            // --partial: the other components are composited, cropped and written on their own
+            // threads while the largest one goes through the regular path below
+            std::vector<std::future<std::string>> partJobs;
+            if (!parts.empty() && opts.memory_budget_mb > 0) {
+                stitcher.set_memory_budget_mb(std::max<std::size_t>(1, opts.memory_budget_mb / (parts.size() + 1)));
+            }
+            for (std::size_t k = 0; k < parts.size(); ++k) {
+                partJobs.push_back(std::async(std::launch::async, [&, k]() {
+                    std::ostringstream log;
+                    const fs::path file = part_file(outFile, k + 1);
+                    try {
+                        cv::Mat partPano;
+                        std::string partErr;
+                        StitchReport partReport;
+                        bool ok = false;
+                        {
+                            PROFILE_SCOPE("compose");
+                            auto partHeld = std::make_shared<std::size_t>(SIZE_MAX);
+                            ok = stitcher.compose(parts[k], makeLoader(parts[k], partHeld), composeScale, partPano,
+                                                  partErr, &partReport);
+                            releaseHeld(*partHeld);
+                        }
+                        if (ok) {
+                            cv::Mat trimmedPart = crop_panorama(partPano, partReport.result_mask, opts.crop, log);
+                            OutputOptions partOptions;
+                            partOptions.thumbnail_dim = opts.thumbnail_dim;
+                            partOptions.threads = opts.stage_threads.encode;
+                            OutputReport partOut;
+                            PROFILE_SCOPE("encode");
+                            ok = write_panorama(trimmedPart, file, partOptions, ctx.pool, &partOut, partErr);
+                        }
+                        if (ok) {
+                            log << "Part " << (k + 2) << " (" << parts[k].indices.size()
+                                << " frame(s)) saved to: " << file.string() << "\n";
+                        } else {
+                            log << "Warning: part " << (k + 2) << " failed: " << partErr << "\n";
+                        }
+                    } catch (const std::exception& ex) {
+                        log << "Warning: part " << (k + 2) << " failed: " << ex.what() << "\n";
+                    }
+                    return log.str();
+                }));
+            }
+            auto tCompose = Clock::now();
+            bool composed = false;
+            if (resumed) {
+                // Only the region the new frames cover is composited again
+                PROFILE_SCOPE("compose");
+                composed = stitcher.compose_region(registration, added, loadFrame, state.compose_scale,
+                                                   state.warped_scale, state.canvas, state.canvas_mask,
+                                                   state.origin, err, &stitchReport);
+                releaseHeld(*heldSlot);
+                if (composed) {
+                    pano = state.canvas;
+                    stitchReport.result_mask = state.canvas_mask;
+                    out << "Incremental: added " << added.size() << " of "
+                        << (loadedPaths.size() + added.size() - registration.indices.size())
+                        << " new frame(s) to " << (registration.indices.size() - added.size())
+                        << " registered frame(s)\n";
+                } else {
+                    err_out << "Warning: incremental compositing failed (" << err << "); compositing all frames\n";
+                }
+            }
+            if (!composed) {
+                PROFILE_SCOPE("compose");
+                composed = stitcher.compose(registration, loadFrame, composeScale, pano, err, &stitchReport);
+                releaseHeld(*heldSlot);
+                if (composed && opts.incremental) {
+                    state.compose_scale = stitchReport.composite.compose_scale;
+                    state.warped_scale = stitchReport.composite.warped_scale;
+                    state.origin = stitchReport.composite.canvas_origin;
+                }
+            }
+            for (auto& job : partJobs) {
+                out << job.get();
+            }
+            if (!composed) {
+                return fail(7, "Stitching failed: " + err);
+            }
+            res.timings.compose_ms = ms_since(tCompose);
+
+            if (opts.incremental && !(resumed && added.empty())) {
+                state.settings = stateSettings.str();
+                state.registration = registration;
+                state.frame_keys.clear();
+                for (int idx : registration.indices) {
+                    state.frame_keys.push_back(frameKeys[idx]);
+                }
+                state.canvas = pano;
+                state.canvas_mask = stitchReport.result_mask;
+                std::string stateErr;
+                if (!save_incremental_state(stateDir, state, &stateErr)) {
+                    err_out << "Warning: failed to save incremental state: " << stateErr << "\n";
+                }
+            }
+        } else {
+            bool stitched = false;
+            {
+                PROFILE_SCOPE("stitch");
+                stitched = stitcher.stitch(images, pano, err, mode, &stitchReport);
+            }
+            if (!stitched) {
+                return fail(7, "Stitching failed: " + err);
+            }
+            res.timings.register_ms = ms_since(tRegister);
+        }
+        images.clear();
+        if (stitchReport.low_memory) {
+            const CompositeReport& c = stitchReport.composite;
+            out << "Composited " << c.canvas.width << "x" << c.canvas.height << " canvas at scale "
+                << c.compose_scale << " with " << c.blender << " (estimated "
+                << (c.estimated_bytes >> 20) << " MB)\n";
+            if (c.over_budget) {
+                err_out << "Warning: compositing needs an estimated " << (c.estimated_bytes >> 20)
+                        << " MB even at scale " << c.compose_scale << ", over the memory budget\n";
+            }
+            out << "Compositing stages: seam warp " << c.seam_warp_ms << " ms, exposure " << c.exposure_ms
+                << " ms, seams " << c.seam_ms << " ms, blend " << c.blend_ms << " ms\n";
+        }
+        out << "Peak RSS: " << (utils::peak_rss_bytes() >> 20) << " MB\n";
+
+        // Crop the result (a view into 'pano', which stays alive until the write below)
+        auto tWrite = Clock::now();
+        cv::Mat trimmed = crop_panorama(pano, stitchReport.result_mask, opts.crop, err_out);
+
+        // Web viewer output: a DeepZoom pyramid built straight from the crop view replaces the single file
+        if (!opts.tiles_dir.empty()) {
+            fs::path tilesDir = fs::path(opts.tiles_dir).is_absolute() ? fs::path(opts.tiles_dir)
+                                                                       : outputDir / opts.tiles_dir;
+            TilePyramidOptions tileOptions;
+            tileOptions.threads = opts.stage_threads.encode;
+            TilePyramidReport tiles;
+            bool tiled = false;
+            {
+                PROFILE_SCOPE("tiles");
+                tiled = write_deepzoom(trimmed, tilesDir, outFile.stem().string(), tileOptions, ctx.pool, &tiles,
+                                       err);
+            }
+            if (!tiled) {
+                return fail(8, "Failed to write tile pyramid: " + err);
+            }
+            // --thumbnail still goes next to where the single file would have been
+            fs::path thumbnail;
+            if (opts.thumbnail_dim > 0 && !write_thumbnail(trimmed, outFile, opts.thumbnail_dim, &thumbnail, err)) {
+                return fail(8, err);
+            }
+            res.timings.write_ms = ms_since(tWrite);
+            out << "Wrote " << tiles.tiles << " tile(s) in " << tiles.levels << " level(s) in "
+                << res.timings.write_ms << " ms\n";
+            out << "Panorama tiles saved to: " << tiles.descriptor.string() << "\n";
+            if (!thumbnail.empty()) {
+                out << "Thumbnail saved to: " << thumbnail.string() << "\n";
+            }
+            res.message = tiles.descriptor.string();
+            res.timings.total_ms = ms_since(tStart);
+            return 0;
+        }
+
+        // Save result: parallel restart-marker JPEG or tiled (Big)TIFF, straight from the crop view
+        OutputOptions outOptions;
+        outOptions.thumbnail_dim = opts.thumbnail_dim;
+        outOptions.threads = opts.stage_threads.encode;
+        OutputReport outReport;
+        bool written = false;
+        {
+            PROFILE_SCOPE("encode");
+            written = write_panorama(trimmed, outFile, outOptions, ctx.pool, &outReport, err);
+        }
+        if (!written) {
+            return fail(8, "Failed to save panorama to: " + outFile.string() + " (" + err + ")");
+        }
+        res.timings.write_ms = ms_since(tWrite);
+        out << "Wrote " << trimmed.cols << "x" << trimmed.rows << " " << outReport.format << ", "
+            << (outReport.bytes >> 10) << " KB in " << res.timings.write_ms << " ms\n";
+        if (!outReport.thumbnail.empty()) {
+            out << "Thumbnail saved to: " << outReport.thumbnail.string() << "\n";
+        }
+
+        // Success
+        out << "Panorama saved to: " << outFile.string() << "\n";
+        res.message = outFile.string();
+        res.timings.total_ms = ms_since(tStart);
+        return 0;
+    } catch (const std::exception& ex) {
+        return fail(100, std::string("Unhandled exception: ") + ex.what());
+    }
+}
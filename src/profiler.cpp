@@ -0,0 +1,123 @@
+#include "profiler.hpp"
+
+#include <chrono>
+#include <fstream>
+#include <iomanip>
+#include <mutex>
+
+#include "utils.hpp"
+
+namespace profiler {
+
+namespace detail {
+std::atomic<bool> enabled{false};
+} // namespace detail
+
+namespace {
+
+using Clock = std::chrono::steady_clock;
+
+std::mutex g_mutex;
+std::vector<Event> g_events;
+std::atomic<std::int64_t> g_origin_ns{0};
+std::atomic<unsigned> g_next_thread{0};
+
+std::int64_t now_ns() {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(Clock::now().time_since_epoch()).count();
+}
+
+unsigned thread_id() {
+    thread_local unsigned id = g_next_thread.fetch_add(1);
+    return id;
+}
+
+void push(Event e) {
+    std::lock_guard<std::mutex> lock(g_mutex);
+    g_events.push_back(std::move(e));
+}
+
+} // namespace
+
+void enable() {
+    {
+        std::lock_guard<std::mutex> lock(g_mutex);
+        g_events.clear();
+    }
+    g_origin_ns.store(now_ns());
+    detail::enabled.store(true);
+}
+
+void disable() {
+    detail::enabled.store(false);
+}
+
+std::vector<Event> take_events() {
+    std::lock_guard<std::mutex> lock(g_mutex);
+    std::vector<Event> events;
+    events.swap(g_events);
+    return events;
+}
+
+void Scope::begin() {
+    start_ns_ = now_ns();
+    cpu_start_ms_ = utils::process_cpu_ms();
+}
+
+void Scope::end() {
+    const std::int64_t end_ns = now_ns();
+    Event e;
+    e.name = name_;
+    e.start_us = static_cast<double>(start_ns_ - g_origin_ns.load()) / 1000.0;
+    e.wall_us = static_cast<double>(end_ns - start_ns_) / 1000.0;
+    e.cpu_us = (utils::process_cpu_ms() - cpu_start_ms_) * 1000.0;
+    e.peak_rss_bytes = utils::peak_rss_bytes();
+    e.thread = thread_id();
+    push(std::move(e));
+}
+
+void record_counter(const char* name, double value) {
+    Event e;
+    e.kind = Event::Kind::Counter;
+    e.name = name;
+    e.start_us = static_cast<double>(now_ns() - g_origin_ns.load()) / 1000.0;
+    e.thread = thread_id();
+    e.value = value;
+    push(std::move(e));
+}
+
+bool write_chrome_trace(const std::filesystem::path& file,
+                        const std::vector<Event>& events,
+                        std::string* error_message) {
+    std::ofstream out(file);
+    if (!out) {
+        if (error_message) {
+            *error_message = "Cannot open " + file.string() + " for writing";
+        }
+        return false;
+    }
+    out << std::fixed << std::setprecision(3);
+    out << "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n";
+    out << "{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":1,\"args\":{\"name\":\"panorama\"}}";
+    for (const auto& e : events) {
+        out << ",\n{\"name\":" << utils::json_string(e.name) << ",\"pid\":1,\"tid\":" << e.thread
+            << ",\"ts\":" << e.start_us;
+        if (e.kind == Event::Kind::Counter) {
+            out << ",\"ph\":\"C\",\"args\":{\"value\":" << e.value << "}}";
+        } else {
+            out << ",\"ph\":\"X\",\"cat\":\"stage\",\"dur\":" << e.wall_us
+                << ",\"args\":{\"cpu_ms\":" << e.cpu_us / 1000.0
+                << ",\"peak_rss_mb\":" << static_cast<double>(e.peak_rss_bytes) / (1024.0 * 1024.0) << "}}";
+        }
+    }
+    out << "\n]}\n";
+    out.flush();
+    if (!out) {
+        if (error_message) {
+            *error_message = "Failed to write " + file.string();
+        }
+        return false;
+    }
+    return true;
+}
+
+} // namespace profiler
@@ -0,0 +1,223 @@
+#include "registration_cache.hpp"
+
+#include <atomic>
+#include <iomanip>
+#include <sstream>
+
+#if defined(_WIN32)
+#include <process.h>
+#else
+#include <unistd.h>
+#endif
+
+namespace fs = std::filesystem;
+
+std::uint64_t fnv1a64(const std::string& s) {
+    std::uint64_t h = 1469598103934665603ull;
+    for (unsigned char c : s) {
+        h ^= c;
+        h *= 1099511628211ull;
+    }
+    return h;
+}
+
+static std::string to_hex(std::uint64_t v) {
+    std::ostringstream oss;
+    oss << std::hex << std::setw(16) << std::setfill('0') << v;
+    return oss.str();
+}
+
+static long process_id() {
+#if defined(_WIN32)
+    return static_cast<long>(_getpid());
+#else
+    return static_cast<long>(getpid());
+#endif
+}
+
+static std::atomic<unsigned long long> temp_counter{0};
+
+// Write a FileStorage entry to a temporary name, then rename it into place. The
+// temporary name is unique per process (pid) and per write (counter), so runs and
+// threads sharing a cache never write into the same file.
+template <typename WriteFn>
+static void write_atomically(const fs::path& target, WriteFn&& write) {
+    std::error_code ec;
+    fs::create_directories(target.parent_path(), ec);
+    if (ec) {
+        return;
+    }
+    std::ostringstream tmp_name;
+    tmp_name << "tmp_" << process_id() << "_" << temp_counter++ << "_" << target.filename().string();
+    fs::path tmp = target.parent_path() / tmp_name.str();
+    try {
+        cv::FileStorage out(tmp.string(), cv::FileStorage::WRITE);
+        if (!out.isOpened()) {
+            return;
+        }
+        write(out);
+        out.release();
+    } catch (const cv::Exception&) {
+        fs::remove(tmp, ec);
+        return;
+    }
+    fs::rename(tmp, target, ec);
+    if (ec) {
+        fs::remove(tmp, ec);
+    }
+}
+
+RegistrationCache::RegistrationCache(const fs::path& dir) : dir_(dir) {}
+
+std::string RegistrationCache::file_key(const fs::path& p, const std::string& settings) {
+    std::error_code ec;
+    fs::path abs = fs::absolute(p, ec);
+    std::ostringstream oss;
+    oss << (ec ? p : abs).string() << '|';
+    oss << fs::file_size(p, ec) << '|';
+    auto mtime = fs::last_write_time(p, ec);
+    oss << (ec ? 0 : static_cast<long long>(mtime.time_since_epoch().count())) << '|';
+    oss << settings;
+    return to_hex(fnv1a64(oss.str()));
+}
+
+std::string RegistrationCache::combine(const std::vector<std::string>& keys) {
+    std::string joined;
+    for (const auto& k : keys) {
+        joined += k;
+        joined += ';';
+    }
+    return to_hex(fnv1a64(joined));
+}
+
+fs::path RegistrationCache::entry_path(const char* kind, const std::string& key) const {
+    return dir_ / kind / (key + ".yml.gz");
+}
+
+bool RegistrationCache::load_features(const std::string& key, cv::detail::ImageFeatures& features) const {
+    if (!enabled()) {
+        return false;
+    }
+    fs::path p = entry_path("features", key);
+    std::error_code ec;
+    if (!fs::exists(p, ec)) {
+        return false;
+    }
+    try {
+        cv::FileStorage in(p.string(), cv::FileStorage::READ);
+        if (!in.isOpened()) {
+            return false;
+        }
+        in["img_size"] >> features.img_size;
+        cv::read(in["keypoints"], features.keypoints);
+        cv::Mat descriptors;
+        in["descriptors"] >> descriptors;
+        descriptors.copyTo(features.descriptors);
+        return !features.keypoints.empty() || features.img_size.area() > 0;
+    } catch (const cv::Exception&) {
+        return false;
+    }
+}
+
+void RegistrationCache::save_features(const std::string& key, const cv::detail::ImageFeatures& features) const {
+    if (!enabled()) {
+        return;
+    }
+    write_atomically(entry_path("features", key), [&](cv::FileStorage& out) {
+        out << "img_size" << features.img_size;
+        cv::write(out, "keypoints", features.keypoints);
+        out << "descriptors" << features.descriptors.getMat(cv::ACCESS_READ);
+    });
+}
+
+bool RegistrationCache::load_matches(const std::string& key, cv::detail::MatchesInfo& matches) const {
+    if (!enabled()) {
+        return false;
+    }
+    fs::path p = entry_path("matches", key);
+    std::error_code ec;
+    if (!fs::exists(p, ec)) {
+        return false;
+    }
+    try {
+        cv::FileStorage in(p.string(), cv::FileStorage::READ);
+        if (!in.isOpened()) {
+            return false;
+        }
+        cv::read(in["matches"], matches.matches);
+        in["inliers_mask"] >> matches.inliers_mask;
+        in["num_inliers"] >> matches.num_inliers;
+        in["H"] >> matches.H;
+        in["confidence"] >> matches.confidence;
+        return true;
+    } catch (const cv::Exception&) {
+        return false;
+    }
+}
+
+void RegistrationCache::save_matches(const std::string& key, const cv::detail::MatchesInfo& matches) const {
+    if (!enabled()) {
+        return;
+    }
+    write_atomically(entry_path("matches", key), [&](cv::FileStorage& out) {
+        cv::write(out, "matches", matches.matches);
+        out << "inliers_mask" << matches.inliers_mask;
+        out << "num_inliers" << matches.num_inliers;
+        out << "H" << matches.H;
+        out << "confidence" << matches.confidence;
+    });
+}
+
+bool RegistrationCache::load_cameras(const std::string& key,
+                                     std::vector<int>& indices,
+                                     std::vector<cv::detail::CameraParams>& cameras) const {
+    if (!enabled()) {
+        return false;
+    }
+    fs::path p = entry_path("cameras", key);
+    std::error_code ec;
+    if (!fs::exists(p, ec)) {
+        return false;
+    }
+    try {
+        cv::FileStorage in(p.string(), cv::FileStorage::READ);
+        if (!in.isOpened()) {
+            return false;
+        }
+        in["indices"] >> indices;
+        cv::FileNode node = in["cameras"];
+        cameras.clear();
+        for (auto it = node.begin(); it != node.end(); ++it) {
+            cv::detail::CameraParams c;
+            (*it)["focal"] >> c.focal;
+            (*it)["aspect"] >> c.aspect;
+            (*it)["ppx"] >> c.ppx;
+            (*it)["ppy"] >> c.ppy;
+            (*it)["R"] >> c.R;
+            (*it)["t"] >> c.t;
+            cameras.push_back(c);
+        }
+        return !cameras.empty() && cameras.size() == indices.size();
+    } catch (const cv::Exception&) {
+        return false;
+    }
+}
+
+void RegistrationCache::save_cameras(const std::string& key,
+                                     const std::vector<int>& indices,
+                                     const std::vector<cv::detail::CameraParams>& cameras) const {
+    if (!enabled()) {
+        return;
+    }
+    write_atomically(entry_path("cameras", key), [&](cv::FileStorage& out) {
+        out << "indices" << indices;
+        out << "cameras" << "[";
+        for (const auto& c : cameras) {
+            out << "{";
+            out << "focal" << c.focal << "aspect" << c.aspect << "ppx" << c.ppx << "ppy" << c.ppy;
+            out << "R" << c.R << "t" << c.t;
+            out << "}";
+        }
+        out << "]";
+    });
+}
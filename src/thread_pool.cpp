@@ -0,0 +1,100 @@
+#include "thread_pool.hpp"
+#include "cpu_affinity.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <exception>
+
+static std::atomic<unsigned> default_thread_count{0};
+
+unsigned resolve_thread_count(unsigned requested) {
+    if (requested > 0) {
+        return requested;
+    }
+    const unsigned configured = default_thread_count.load();
+    return configured > 0 ? configured : available_cpus();
+}
+
+void set_default_thread_count(unsigned count) {
+    default_thread_count = count;
+}
+
+ThreadPool::ThreadPool(unsigned num_threads) {
+    unsigned n = resolve_thread_count(num_threads);
+    workers_.reserve(n);
+    for (unsigned i = 0; i < n; ++i) {
+        workers_.emplace_back([this]() { worker_loop(); });
+    }
+}
+
+ThreadPool::~ThreadPool() {
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        stopping_ = true;
+    }
+    cv_.notify_all();
+    for (auto& t : workers_) {
+        if (t.joinable()) {
+            t.join();
+        }
+    }
+}
+
+void ThreadPool::worker_loop() {
+    for (;;) {
+        std::function<void()> task;
+        {
+            std::unique_lock<std::mutex> lock(mutex_);
+            cv_.wait(lock, [this]() { return stopping_ || !tasks_.empty(); });
+            if (stopping_ && tasks_.empty()) {
+                return;
+            }
+            task = std::move(tasks_.front());
+            tasks_.pop();
+        }
+        task();
+    }
+}
+
+void ThreadPool::parallel_for(std::size_t count, const std::function<void(std::size_t)>& fn) {
+    if (count == 0) {
+        return;
+    }
+
+    std::atomic<std::size_t> next{0};
+    std::exception_ptr first_error;
+    std::mutex error_mutex;
+
+    auto drain = [&]() {
+        for (;;) {
+            std::size_t i = next.fetch_add(1);
+            if (i >= count) {
+                return;
+            }
+            try {
+                fn(i);
+            } catch (...) {
+                std::lock_guard<std::mutex> lock(error_mutex);
+                if (!first_error) {
+                    first_error = std::current_exception();
+                }
+            }
+        }
+    };
+
+    // One helper per worker (at most count - 1); the caller is the last worker.
+    std::size_t helpers = std::min<std::size_t>(size(), count - 1);
+    std::vector<std::future<void>> pending;
+    pending.reserve(helpers);
+    for (std::size_t h = 0; h < helpers; ++h) {
+        pending.emplace_back(submit(drain));
+    }
+    drain();
+    for (auto& f : pending) {
+        f.wait();
+    }
+
+    if (first_error) {
+        std::rethrow_exception(first_error);
+    }
+}
@@ -0,0 +1,140 @@
+#include "tile_pyramid.hpp"
+#include "profiler.hpp"
+#include "thread_pool.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <fstream>
+#include <memory>
+#include <vector>
+#include <opencv2/imgcodecs.hpp>
+#include <opencv2/imgproc.hpp>
+
+namespace fs = std::filesystem;
+
+namespace {
+
+// Number of the full-resolution level: level 0 is 1x1, each level doubles.
+int max_level(const cv::Size& size) {
+    int level = 0;
+    for (int m = std::max(size.width, size.height); m > 1; m = (m + 1) / 2) {
+        ++level;
+    }
+    return level;
+}
+
+// Pixel span of tile 'index' along one axis, overlapping its neighbours by 'overlap'.
+cv::Range tile_span(int index, int tile, int overlap, int length) {
+    const int begin = std::max(0, index * tile - (index > 0 ? overlap : 0));
+    const int end = std::min(length, (index + 1) * tile + overlap);
+    return cv::Range(begin, end);
+}
+
+} // namespace
+
+bool write_deepzoom(const cv::Mat& image,
+                    const fs::path& dir,
+                    const std::string& name,
+                    const TilePyramidOptions& options,
+                    ThreadPool* pool,
+                    TilePyramidReport* report,
+                    std::string& error_message) {
+    if (image.empty()) {
+        error_message = "Nothing to write";
+        return false;
+    }
+    if (options.tile_size <= 0 || options.overlap < 0) {
+        error_message = "Invalid tile size or overlap";
+        return false;
+    }
+
+    try {
+        std::unique_ptr<ThreadPool> own_pool;
+        if (!pool) {
+            const unsigned threads = resolve_thread_count(options.threads);
+            if (threads > 1) {
+                own_pool = std::make_unique<ThreadPool>(threads - 1);
+                pool = own_pool.get();
+            }
+        }
+
+        const fs::path files_dir = dir / (name + "_files");
+        std::error_code ec;
+        fs::create_directories(files_dir, ec);
+        if (ec) {
+            error_message = "Failed to create " + files_dir.string() + " (" + ec.message() + ")";
+            return false;
+        }
+
+        const std::vector<int> params = {cv::IMWRITE_JPEG_QUALITY, std::clamp(options.jpeg_quality, 1, 100)};
+        const int top = max_level(image.size());
+        std::size_t tiles_written = 0;
+        cv::Mat level_image = image; // full resolution: a view, never copied
+        for (int level = top; level >= 0; --level) {
+            PROFILE_SCOPE("tile_level");
+            if (level < top) {
+                cv::Mat smaller;
+                cv::resize(level_image, smaller, cv::Size((level_image.cols + 1) / 2, (level_image.rows + 1) / 2),
+                           0, 0, cv::INTER_AREA);
+                level_image = smaller;
+            }
+            const fs::path level_dir = files_dir / std::to_string(level);
+            fs::create_directories(level_dir, ec);
+            if (ec) {
+                error_message = "Failed to create " + level_dir.string() + " (" + ec.message() + ")";
+                return false;
+            }
+
+            const int cols = (level_image.cols + options.tile_size - 1) / options.tile_size;
+            const int rows = (level_image.rows + options.tile_size - 1) / options.tile_size;
+            const std::size_t count = static_cast<std::size_t>(cols) * rows;
+            std::atomic<bool> failed{false};
+            auto write_tile = [&](std::size_t k) {
+                const int c = static_cast<int>(k % cols);
+                const int r = static_cast<int>(k / cols);
+                const cv::Mat tile = level_image(tile_span(r, options.tile_size, options.overlap, level_image.rows),
+                                                 tile_span(c, options.tile_size, options.overlap, level_image.cols));
+                const fs::path file = level_dir / (std::to_string(c) + "_" + std::to_string(r) + ".jpg");
+                if (!cv::imwrite(file.string(), tile, params)) {
+                    failed = true;
+                }
+            };
+            if (pool && count > 1) {
+                pool->parallel_for(count, write_tile);
+            } else {
+                for (std::size_t k = 0; k < count; ++k) {
+                    write_tile(k);
+                }
+            }
+            if (failed) {
+                error_message = "Failed to write tiles to " + level_dir.string();
+                return false;
+            }
+            tiles_written += count;
+        }
+
+        const fs::path dzi = dir / (name + ".dzi");
+        std::ofstream xml(dzi);
+        xml << "<?xml version=\"1.0\" encoding=\"UTF-8\"?>\n"
+            << "<Image xmlns=\"http://schemas.microsoft.com/deepzoom/2008\" Format=\"jpg\" Overlap=\""
+            << options.overlap << "\" TileSize=\"" << options.tile_size << "\">\n"
+            << "  <Size Width=\"" << image.cols << "\" Height=\"" << image.rows << "\"/>\n"
+            << "</Image>\n";
+        xml.flush();
+        if (!xml) {
+            error_message = "Failed to write " + dzi.string();
+            return false;
+        }
+
+        if (report) {
+            report->levels = top + 1;
+            report->tiles = tiles_written;
+            report->descriptor = dzi;
+        }
+        return true;
+    } catch (const std::exception& ex) {
+        error_message = ex.what();
+        return false;
+    }
+}
@@ -2,9 +2,19 @@
 
 #include <algorithm>
 #include <cctype>
-#include <opencv2/imgcodecs.hpp>
+#include <cstdint>
 #include <opencv2/imgproc.hpp>
-#include <sstream>
+#include <vector>
+#include <opencv2/core/hal/intrin.hpp>
+#include <opencv2/core/utility.hpp>
+
+#if defined(_WIN32)
+#define NOMINMAX
+#include <windows.h>
+#include <psapi.h>
+#else
+#include <sys/resource.h>
+#endif
 
 namespace utils {
 
@@ -20,160 +30,155 @@ bool is_heic_file(const std::filesystem::path& p) {
     return ext == ".heic" || ext == ".heif";
 }
 
-bool convert_heic_to_jpg(const std::filesystem::path& heic_path,
-                         std::filesystem::path* out_jpg_path,
-                         int jpg_quality,
-                         std::string* error_message) {
-    if (!std::filesystem::exists(heic_path) || !std::filesystem::is_regular_file(heic_path)) {
-        if (error_message) {
-            *error_message = "Input file does not exist or is not a regular file";
-        }
-        return false;
-    }
-    if (!is_heic_file(heic_path)) {
-        if (error_message) {
-            *error_message = "Input file is not .heic/.heif";
-        }
-        return false;
-    }
-
-    // Read using OpenCV (requires OpenCV built with HEIF/HEIC support via libheif).
-    cv::Mat img = cv::imread(heic_path.string(), cv::IMREAD_COLOR);
-    if (img.empty()) {
-        if (error_message) {
-            *error_message = "Failed to read HEIC image (check OpenCV HEIF support)";
+// One row of count_black_pixels(): adds 1 to col[c] for every black pixel and
+// returns the row's count. CN is the channel count of 'p' (1, 3 or 4), or 0 when
+// 'p' is the valid mask (black where it is 0). Where OpenCV has fixed-width
+// universal intrinsics, the row is processed one vector of pixels at a time;
+// the scalar loop does the remainder (and everything on other builds).
+template <int CN>
+static int count_black_row(const uchar* __restrict p,
+                           int* __restrict col,
+                           int cols,
+                           int max_black,
+                           int weighted_limit) {
+    int c = 0;
+    int cnt = 0;
+#if CV_SIMD && !CV_SIMD_SCALABLE
+    const int lanes = cv::v_uint8::nlanes;
+    const int quarter = cv::v_int32::nlanes;
+    cv::v_int32 vcnt = cv::vx_setzero_s32();
+    for (; c <= cols - lanes; c += lanes) {
+        cv::v_int32 black[4]; // -1 where black, 0 elsewhere; 'quarter' pixels each
+        if constexpr (CN <= 1) {
+            const cv::v_uint8 v = cv::vx_load(p + c);
+            const cv::v_uint8 hit = CN == 0 ? v == cv::vx_setzero_u8()
+                                            : v <= cv::vx_setall_u8(static_cast<uchar>(max_black));
+            cv::v_int16 lo, hi;
+            cv::v_expand(cv::v_reinterpret_as_s8(hit), lo, hi); // sign extension keeps -1
+            cv::v_expand(lo, black[0], black[1]);
+            cv::v_expand(hi, black[2], black[3]);
+        } else {
+            cv::v_uint8 b, g, r;
+            if constexpr (CN == 3) {
+                cv::v_load_deinterleave(p + c * 3, b, g, r);
+            } else {
+                cv::v_uint8 a;
+                cv::v_load_deinterleave(p + c * 4, b, g, r, a);
+            }
+            const cv::v_uint32 wb = cv::vx_setall_u32(1868), wg = cv::vx_setall_u32(9617), wr = cv::vx_setall_u32(4899);
+            const cv::v_int32 limit = cv::vx_setall_s32(weighted_limit);
+            cv::v_uint16 b16[2], g16[2], r16[2];
+            cv::v_expand(b, b16[0], b16[1]);
+            cv::v_expand(g, g16[0], g16[1]);
+            cv::v_expand(r, r16[0], r16[1]);
+            for (int h = 0; h < 2; ++h) {
+                cv::v_uint32 b32[2], g32[2], r32[2];
+                cv::v_expand(b16[h], b32[0], b32[1]);
+                cv::v_expand(g16[h], g32[0], g32[1]);
+                cv::v_expand(r16[h], r32[0], r32[1]);
+                for (int k = 0; k < 2; ++k) {
+                    const cv::v_uint32 sum = b32[k] * wb + g32[k] * wg + r32[k] * wr;
+                    black[2 * h + k] = cv::v_reinterpret_as_s32(sum) < limit;
+                }
+            }
         }
-        return false;
-    }
-
-    std::filesystem::path jpg_path = heic_path;
-    jpg_path.replace_extension(".jpg");
-
-    std::vector<int> params = { cv::IMWRITE_JPEG_QUALITY, std::clamp(jpg_quality, 1, 100) };
-    if (!cv::imwrite(jpg_path.string(), img, params)) {
-        if (error_message) {
-            *error_message = "Failed to write JPEG file";
+        for (int k = 0; k < 4; ++k) {
+            int* dst = col + c + k * quarter;
+            cv::v_store(dst, cv::vx_load(dst) - black[k]);
+            vcnt -= black[k];
         }
-        return false;
     }
-
-    // Remove original on success
-    std::error_code ec;
-    std::filesystem::remove(heic_path, ec);
-    if (ec) {
-        // JPEG was written but original couldn't be removed; treat as partial success
-        if (error_message) {
-            *error_message = std::string("Converted, but failed to remove original: ") + ec.message();
-        }
-        if (out_jpg_path) {
-            *out_jpg_path = jpg_path;
+    cnt = cv::v_reduce_sum(vcnt);
+    cv::vx_cleanup();
+#endif
+    for (; c < cols; ++c) {
+        int black;
+        if constexpr (CN == 0) {
+            black = p[c] == 0;
+        } else if constexpr (CN == 1) {
+            black = p[c] <= max_black;
+        } else {
+            const uchar* px = p + c * CN;
+            black = (1868 * px[0] + 9617 * px[1] + 4899 * px[2]) < weighted_limit;
         }
-        return true;
+        col[c] += black;
+        cnt += black;
     }
-
-    if (out_jpg_path) {
-        *out_jpg_path = jpg_path;
-    }
-    return true;
+    return cnt;
 }
 
-std::size_t convert_heic_to_jpg_in_dir(const std::filesystem::path& dir,
-                                       int jpg_quality,
-                                       bool recursive,
-                                       std::string* report) {
-    if (!std::filesystem::exists(dir) || !std::filesystem::is_directory(dir)) {
-        if (report) {
-            *report = "Directory does not exist or is not a directory";
-        }
-        return 0;
-    }
-    std::size_t converted = 0;
-    std::ostringstream oss;
-    auto handle_file = [&](const std::filesystem::path& p){
-        if (!is_heic_file(p)) {
-            return;
-        }
-        std::string err;
-        std::filesystem::path outp;
-        if (convert_heic_to_jpg(p, &outp, jpg_quality, &err)) {
-            ++converted;
-            oss << "Converted: " << p.filename().string() << " -> " << outp.filename().string() << "\n";
-        } else {
-            oss << "Failed: " << p.filename().string() << " (" << err << ")\n";
-        }
-    };
+// Count the black pixels of every row and every column in one row-major pass.
+// A pixel is black if valid_mask is 0 there (when a mask is given) or if its
+// gray level is <= max_black. Gray uses cvtColor's fixed-point BGR2GRAY weights,
+// so the result matches the former cvtColor-based test without building a gray copy:
+//   (1868*B + 9617*G + 4899*R + 8192) >> 14 <= max_black
+// Row stripes run on OpenCV's thread pool, each with private column counters
+// that are summed at the end.
+static void count_black_pixels(const cv::Mat& input,
+                               const cv::Mat& valid_mask,
+                               int max_black,
+                               std::vector<int>& row_counts,
+                               std::vector<int>& col_counts) {
+    const int rows = input.rows;
+    const int cols = input.cols;
+    const int cn = input.channels();
+    const int weighted_limit = ((max_black + 1) << 14) - 8192; // black iff weighted sum < this
+    row_counts.assign(rows, 0);
+    col_counts.assign(cols, 0);
 
-    if (recursive) {
-        for (const auto& entry : std::filesystem::recursive_directory_iterator(dir)) {
-            if (entry.is_regular_file()) {
-                handle_file(entry.path());
-            }
-        }
-    } else {
-        for (const auto& entry : std::filesystem::directory_iterator(dir)) {
-            if (entry.is_regular_file()) {
-                handle_file(entry.path());
+    auto count_row = valid_mask.empty() ? (cn == 1 ? &count_black_row<1> : cn == 3 ? &count_black_row<3> : &count_black_row<4>)
+                                        : &count_black_row<0>;
+    const cv::Mat& source = valid_mask.empty() ? input : valid_mask;
+
+    const int stripes = std::max(1, std::min(rows, cv::getNumThreads() * 4));
+    std::vector<std::vector<int>> stripe_cols(stripes);
+    cv::parallel_for_(cv::Range(0, stripes), [&](const cv::Range& range) {
+        for (int s = range.start; s < range.end; ++s) {
+            std::vector<int>& counts = stripe_cols[s];
+            counts.assign(cols, 0);
+            const int r0 = static_cast<int>(static_cast<std::int64_t>(rows) * s / stripes);
+            const int r1 = static_cast<int>(static_cast<std::int64_t>(rows) * (s + 1) / stripes);
+            for (int r = r0; r < r1; ++r) {
+                row_counts[r] = count_row(source.ptr<uchar>(r), counts.data(), cols, max_black, weighted_limit);
             }
         }
-    }
+    });
 
-    if (report) {
-        *report = oss.str();
+    int* col = col_counts.data();
+    for (const auto& counts : stripe_cols) {
+        const int* src = counts.data();
+        for (int c = 0; c < cols; ++c) {
+            col[c] += src[c];
+        }
     }
-    return converted;
 }
 
-cv::Mat trim_black_bands(const cv::Mat& input,
-                        int black_threshold,
-                        double black_pixel_ratio_threshold,
-                        int extra_crop) {
+cv::Rect find_content_rect(const cv::Mat& input,
+                           int black_threshold,
+                           double black_pixel_ratio_threshold,
+                           int extra_crop,
+                           const cv::Mat& valid_mask) {
+    const cv::Rect full(0, 0, input.cols, input.rows);
     if (input.empty()) {
-        return input.clone();
+        return full;
     }
+    CV_Assert(input.depth() == CV_8U);
     CV_Assert(input.channels() == 1 || input.channels() == 3 || input.channels() == 4);
+    CV_Assert(valid_mask.empty() || (valid_mask.type() == CV_8UC1 && valid_mask.size() == input.size()));
 
-    // Convert to grayscale to measure darkness per row/col
-    cv::Mat gray;
-    if (input.channels() == 3) {
-        cv::cvtColor(input, gray, cv::COLOR_BGR2GRAY);
-    } else if (input.channels() == 4) {
-        cv::cvtColor(input, gray, cv::COLOR_BGRA2GRAY);
-    } else {
-        gray = input;
-    }
-
-    const int rows = gray.rows;
-    const int cols = gray.cols;
+    const int rows = input.rows;
+    const int cols = input.cols;
     const int max_black = std::clamp(black_threshold, 0, 255);
     const int row_black_limit = static_cast<int>(std::clamp(black_pixel_ratio_threshold, 0.0, 1.0) * cols);
     const int col_black_limit = static_cast<int>(std::clamp(black_pixel_ratio_threshold, 0.0, 1.0) * rows);
 
-    auto row_is_black = [&](int r) -> bool {
-        const uchar* ptr = gray.ptr<uchar>(r);
-        int cnt = 0;
-        for (int c = 0; c < cols; ++c) {
-            if (ptr[c] <= max_black) {
-                ++cnt;
-                if (cnt >= row_black_limit) {
-                    return true;
-                }
-            }
-        }
-        return false;
-    };
+    std::vector<int> row_counts;
+    std::vector<int> col_counts;
+    count_black_pixels(input, valid_mask, max_black, row_counts, col_counts);
 
-    auto col_is_black = [&](int c) -> bool {
-        int cnt = 0;
-        for (int r = 0; r < rows; ++r) {
-            if (gray.at<uchar>(r, c) <= max_black) {
-                ++cnt;
-                if (cnt >= col_black_limit) {
-                    return true;
-                }
-            }
-        }
-        return false;
-    };
+    // A row/column is black once its count reaches the limit (and it has any black pixel at all)
+    auto row_is_black = [&](int r) { return row_counts[r] > 0 && row_counts[r] >= row_black_limit; };
+    auto col_is_black = [&](int c) { return col_counts[c] > 0 && col_counts[c] >= col_black_limit; };
 
     // Find top
     int top = 0;
@@ -206,12 +211,150 @@ cv::Mat trim_black_bands(const cv::Mat& input,
     right = std::max(0, std::min(cols - 1, right - extra_crop));
 
     if (bottom <= top || right <= left) {
-        // Cropped out everything; return original to be safe
+        // Cropped out everything; keep the whole image to be safe
+        return full;
+    }
+    return cv::Rect(left, top, right - left + 1, bottom - top + 1);
+}
+
+cv::Mat trim_black_bands(const cv::Mat& input,
+                        int black_threshold,
+                        double black_pixel_ratio_threshold,
+                        int extra_crop,
+                        const cv::Mat& valid_mask,
+                        bool copy) {
+    if (input.empty()) {
         return input.clone();
     }
+    cv::Mat view = input(find_content_rect(input, black_threshold, black_pixel_ratio_threshold,
+                                           extra_crop, valid_mask));
+    return copy ? view.clone() : view;
+}
+
+cv::Rect largest_inscribed_rect(const cv::Mat& mask) {
+    if (mask.empty()) {
+        return cv::Rect();
+    }
+    CV_Assert(mask.type() == CV_8UC1);
+
+    // Row by row, heights[c] is the run of valid pixels ending at this row in column c;
+    // the largest rectangle under that histogram is found with a stack of increasing heights.
+    const int rows = mask.rows;
+    const int cols = mask.cols;
+    std::vector<int> heights(cols + 1, 0); // heights[cols] stays 0 and flushes the stack
+    std::vector<int> stack;
+    stack.reserve(cols + 1);
+    std::int64_t best_area = 0;
+    cv::Rect best;
+
+    for (int r = 0; r < rows; ++r) {
+        const uchar* m = mask.ptr<uchar>(r);
+        int* h = heights.data();
+        for (int c = 0; c < cols; ++c) {
+            h[c] = m[c] ? h[c] + 1 : 0;
+        }
 
-    cv::Rect roi(left, top, right - left + 1, bottom - top + 1);
-    return input(roi).clone();
+        stack.clear();
+        for (int c = 0; c <= cols; ++c) {
+            while (!stack.empty() && h[stack.back()] >= h[c]) {
+                const int height = h[stack.back()];
+                stack.pop_back();
+                const int left = stack.empty() ? 0 : stack.back() + 1;
+                const std::int64_t area = static_cast<std::int64_t>(height) * (c - left);
+                if (area > best_area) {
+                    best_area = area;
+                    best = cv::Rect(left, r - height + 1, c - left, height);
+                }
+            }
+            stack.push_back(c);
+        }
+    }
+    return best;
+}
+
+cv::Rect crop_rect(const cv::Mat& pano, const cv::Mat& result_mask, const std::string& crop, std::string* warning) {
+    const cv::Rect whole(0, 0, pano.cols, pano.rows);
+    const cv::Mat valid_mask = result_mask.size() == pano.size() ? result_mask : cv::Mat();
+    std::string mode = crop;
+    if (mode == "mask" && valid_mask.empty()) {
+        if (warning) {
+            *warning = "no valid-pixel mask available; using heuristic crop";
+        }
+        mode = "heuristic";
+    }
+    if (mode == "mask") {
+        const cv::Rect roi = largest_inscribed_rect(valid_mask);
+        return roi.area() > 0 ? roi : whole;
+    }
+    if (mode == "heuristic" && !pano.empty()) {
+        int black_threshold = 5;            // Threshold for black pixel detection
+        double black_pixel_ratio = 0.05;    // % of black pixels in the row/col to trim it
+        int extra_crop = 1;                 // Safety trim
+        return find_content_rect(pano, black_threshold, black_pixel_ratio, extra_crop, valid_mask);
+    }
+    return whole;
+}
+
+std::string json_string(const std::string& s) {
+    static const char* hex = "0123456789abcdef";
+    std::string out = "\"";
+    for (char c : s) {
+        const unsigned char u = static_cast<unsigned char>(c);
+        if (c == '"' || c == '\\') {
+            out += '\\';
+            out += c;
+        } else if (u < 0x20) {
+            out += "\\u00";
+            out += hex[u >> 4];
+            out += hex[u & 0xf];
+        } else {
+            out += c;
+        }
+    }
+    out += '"';
+    return out;
+}
+
+std::size_t peak_rss_bytes() {
+#if defined(_WIN32)
+    PROCESS_MEMORY_COUNTERS pmc;
+    if (GetProcessMemoryInfo(GetCurrentProcess(), &pmc, sizeof(pmc))) {
+        return static_cast<std::size_t>(pmc.PeakWorkingSetSize);
+    }
+    return 0;
+#else
+    struct rusage usage;
+    if (getrusage(RUSAGE_SELF, &usage) != 0) {
+        return 0;
+    }
+#if defined(__APPLE__)
+    return static_cast<std::size_t>(usage.ru_maxrss);        // bytes on macOS
+#else
+    return static_cast<std::size_t>(usage.ru_maxrss) * 1024; // kilobytes on Linux
+#endif
+#endif
+}
+
+double process_cpu_ms() {
+#if defined(_WIN32)
+    FILETIME creation, exit, kernel, user;
+    if (!GetProcessTimes(GetCurrentProcess(), &creation, &exit, &kernel, &user)) {
+        return 0.0;
+    }
+    auto to_100ns = [](const FILETIME& ft) {
+        return (static_cast<unsigned long long>(ft.dwHighDateTime) << 32) | ft.dwLowDateTime;
+    };
+    return static_cast<double>(to_100ns(kernel) + to_100ns(user)) / 1e4;
+#else
+    struct rusage usage;
+    if (getrusage(RUSAGE_SELF, &usage) != 0) {
+        return 0.0;
+    }
+    auto to_ms = [](const struct timeval& tv) {
+        return static_cast<double>(tv.tv_sec) * 1e3 + static_cast<double>(tv.tv_usec) / 1e3;
+    };
+    return to_ms(usage.ru_utime) + to_ms(usage.ru_stime);
+#endif
 }
 
 } // namespace utils
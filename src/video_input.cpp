@@ -0,0 +1,152 @@
+#include "video_input.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <opencv2/imgproc.hpp>
+#include <opencv2/videoio.hpp>
+
+#include "profiler.hpp"
+
+using Clock = std::chrono::steady_clock;
+
+static double ms_since(Clock::time_point t0) {
+    return std::chrono::duration<double, std::milli>(Clock::now() - t0).count();
+}
+
+// Copy of 'frame' with max(width,height) <= max_dim (0 keeps full size).
+static cv::Mat downscale_copy(const cv::Mat& frame, int max_dim) {
+    const int longest = std::max(frame.cols, frame.rows);
+    if (max_dim <= 0 || longest <= max_dim) {
+        return frame.clone();
+    }
+    const double scale = static_cast<double>(max_dim) / longest;
+    cv::Mat out;
+    cv::resize(frame, out, cv::Size(), scale, scale, cv::INTER_AREA);
+    return out;
+}
+
+bool extract_keyframes(const std::filesystem::path& video,
+                       const KeyframeOptions& options,
+                       std::vector<Keyframe>& keyframes,
+                       VideoStats* stats,
+                       std::string& error_message) {
+    const auto t0 = Clock::now();
+    keyframes.clear();
+    VideoStats local;
+    VideoStats& st = stats ? *stats : local;
+    st = VideoStats();
+
+    cv::VideoCapture cap(video.string());
+    if (!cap.isOpened()) {
+        error_message = "Failed to open video: " + video.string();
+        return false;
+    }
+    st.fps = cap.get(cv::CAP_PROP_FPS);
+
+    // A keyframe is due after moving 'step' frame widths/heights, and is forced
+    // (blurry or not) before the overlap with the previous one halves
+    const double overlap = std::min(0.95, std::max(0.05, options.overlap));
+    const double step = 1.0 - overlap;
+    const double max_step = 1.0 - overlap * 0.5;
+
+    auto make_keyframe = [&](const cv::Mat& frame, int index, double sharpness) {
+        Keyframe k;
+        k.image = downscale_copy(frame, options.max_dim);
+        k.original_size = cv::Size(frame.cols, frame.rows);
+        k.frame_index = index;
+        k.timestamp_ms = cap.get(cv::CAP_PROP_POS_MSEC);
+        k.sharpness = sharpness;
+        return k;
+    };
+
+    cv::Mat frame, small, gray, proxy, prev, window, lap;
+    double moved_x = 0.0, moved_y = 0.0; // motion since the last keyframe, in proxy widths/heights
+    double mean_sharpness = -1.0;
+    // Sharpest blurry frame since a keyframe became due, with the motion at which it was seen
+    Keyframe candidate;
+    double candidate_x = 0.0, candidate_y = 0.0;
+    bool have_candidate = false;
+    // Most recent sharp frame past half a step, to close the sweep
+    Keyframe tail;
+    bool have_tail = false;
+
+    for (int index = 0; cap.read(frame); ++index) {
+        if (frame.empty()) {
+            continue;
+        }
+        ++st.frames;
+
+        // Grayscale float proxy for motion and sharpness
+        const double ps = std::min(1.0, static_cast<double>(options.proxy_dim) / std::max(frame.cols, frame.rows));
+        cv::resize(frame, small, cv::Size(), ps, ps, cv::INTER_AREA);
+        if (small.channels() == 1) {
+            gray = small;
+        } else {
+            cv::cvtColor(small, gray, small.channels() == 4 ? cv::COLOR_BGRA2GRAY : cv::COLOR_BGR2GRAY);
+        }
+        cv::Laplacian(gray, lap, CV_32F);
+        cv::Scalar mean, dev;
+        cv::meanStdDev(lap, mean, dev);
+        const double sharpness = dev[0] * dev[0];
+        const bool blurry = mean_sharpness > 0.0 && sharpness < options.blur_ratio * mean_sharpness;
+        mean_sharpness = mean_sharpness < 0.0 ? sharpness : 0.9 * mean_sharpness + 0.1 * sharpness;
+
+        gray.convertTo(proxy, CV_32F);
+        if (prev.empty()) {
+            cv::createHanningWindow(window, proxy.size(), CV_32F);
+        } else {
+            const cv::Point2d shift = cv::phaseCorrelate(prev, proxy, window);
+            moved_x += shift.x / proxy.cols;
+            moved_y += shift.y / proxy.rows;
+        }
+        std::swap(prev, proxy);
+
+        if (keyframes.empty()) {
+            keyframes.push_back(make_keyframe(frame, index, sharpness));
+            continue;
+        }
+        const double moved = std::max(std::abs(moved_x), std::abs(moved_y));
+        if (moved < step) {
+            if (moved >= step * 0.5 && !blurry) {
+                tail = make_keyframe(frame, index, sharpness);
+                have_tail = true;
+            }
+            continue;
+        }
+        if (!blurry) {
+            keyframes.push_back(make_keyframe(frame, index, sharpness));
+            moved_x = moved_y = 0.0;
+            have_candidate = have_tail = false;
+            continue;
+        }
+        ++st.blurry_rejected;
+        if (!have_candidate || sharpness > candidate.sharpness) {
+            candidate = make_keyframe(frame, index, sharpness);
+            candidate_x = moved_x;
+            candidate_y = moved_y;
+            have_candidate = true;
+        }
+        if (moved >= max_step) {
+            // Waited too long for a sharp frame: settle for the sharpest one seen
+            keyframes.push_back(std::move(candidate));
+            moved_x -= candidate_x;
+            moved_y -= candidate_y;
+            have_candidate = have_tail = false;
+        }
+    }
+
+    if (have_candidate) {
+        keyframes.push_back(std::move(candidate));
+    } else if (have_tail) {
+        keyframes.push_back(std::move(tail));
+    }
+    st.wall_ms = ms_since(t0);
+    profiler::count("video_frames", static_cast<double>(st.frames));
+    profiler::count("keyframes", static_cast<double>(keyframes.size()));
+    if (keyframes.empty()) {
+        error_message = "No frames could be decoded from: " + video.string();
+        return false;
+    }
+    return true;
+}
@@ -0,0 +1,408 @@
+#include "watch.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <csignal>
+#include <deque>
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <mutex>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "batch.hpp"
+#include "image_io.hpp"
+#include "pipeline.hpp"
+#include "thread_pool.hpp"
+#include "utils.hpp"
+
+#if defined(__linux__)
+#include <poll.h>
+#include <sys/inotify.h>
+#include <unistd.h>
+#endif
+
+namespace fs = std::filesystem;
+using Clock = std::chrono::steady_clock;
+
+namespace {
+
+std::atomic<bool> g_stop{false};
+
+extern "C" void on_stop_signal(int) {
+    g_stop.store(true);
+}
+
+double ms_between(Clock::time_point a, Clock::time_point b) {
+    return std::chrono::duration<double, std::milli>(b - a).count();
+}
+
+// Cheap fingerprint of a capture set: image count, total size and newest mtime.
+std::string set_signature(const fs::path& dir) {
+    std::size_t count = 0;
+    std::uintmax_t bytes = 0;
+    fs::file_time_type newest{};
+    for (const auto& p : list_image_files(dir)) {
+        // Separate error codes: an unreadable size must not count as (uintmax_t)-1
+        std::error_code size_ec, time_ec;
+        const std::uintmax_t size = fs::file_size(p, size_ec);
+        const fs::file_time_type mtime = fs::last_write_time(p, time_ec);
+        ++count;
+        if (!size_ec) {
+            bytes += size;
+        }
+        if (!time_ec) {
+            newest = std::max(newest, mtime);
+        }
+    }
+    std::ostringstream oss;
+    oss << count << '|' << bytes << '|' << newest.time_since_epoch().count();
+    return oss.str();
+}
+
+// Wakes the scanner when anything under the root changes. Uses inotify on Linux
+// (one watch per directory, added as directories appear); elsewhere wait() just
+// sleeps, which turns the scanner into a once-per-second poll.
+class ChangeNotifier {
+public:
+    explicit ChangeNotifier(const fs::path& root) : root_(root) {
+#if defined(__linux__)
+        fd_ = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+        if (fd_ >= 0) {
+            add_tree(root_);
+        }
+#endif
+    }
+
+    ~ChangeNotifier() {
+#if defined(__linux__)
+        if (fd_ >= 0) {
+            close(fd_);
+        }
+#endif
+    }
+
+    ChangeNotifier(const ChangeNotifier&) = delete;
+    ChangeNotifier& operator=(const ChangeNotifier&) = delete;
+
+    bool uses_inotify() const { return fd_ >= 0; }
+
+    // Wait up to 'timeout_ms'; returns true if something changed (always true when polling).
+    bool wait(int timeout_ms) {
+#if defined(__linux__)
+        if (fd_ >= 0) {
+            pollfd pfd{fd_, POLLIN, 0};
+            if (poll(&pfd, 1, timeout_ms) <= 0) {
+                return false;
+            }
+            bool new_dirs = false;
+            alignas(inotify_event) char buf[16 * 1024];
+            for (;;) {
+                const ssize_t len = read(fd_, buf, sizeof(buf));
+                if (len <= 0) {
+                    break;
+                }
+                for (char* p = buf; p < buf + len;) {
+                    const auto* ev = reinterpret_cast<const inotify_event*>(p);
+                    new_dirs = new_dirs || ((ev->mask & IN_ISDIR) && (ev->mask & (IN_CREATE | IN_MOVED_TO)));
+                    p += sizeof(inotify_event) + ev->len;
+                }
+            }
+            if (new_dirs) {
+                add_tree(root_); // inotify_add_watch on an already watched directory is a no-op
+            }
+            return true;
+        }
+#endif
+        std::this_thread::sleep_for(std::chrono::milliseconds(timeout_ms));
+        return true;
+    }
+
+private:
+#if defined(__linux__)
+    void add_tree(const fs::path& dir) {
+        const uint32_t mask = IN_CLOSE_WRITE | IN_CREATE | IN_MOVED_TO | IN_MOVED_FROM | IN_DELETE;
+        inotify_add_watch(fd_, dir.c_str(), mask);
+        std::error_code ec;
+        for (auto it = fs::recursive_directory_iterator(dir, fs::directory_options::skip_permission_denied, ec);
+             it != fs::recursive_directory_iterator(); it.increment(ec)) {
+            if (ec) {
+                break;
+            }
+            if (it->is_directory()) {
+                inotify_add_watch(fd_, it->path().c_str(), mask);
+            }
+        }
+    }
+#endif
+
+    fs::path root_;
+    int fd_{-1};
+};
+
+struct SetState {
+    std::string signature;        // as of the last scan
+    Clock::time_point changed;    // when 'signature' last changed
+    std::string stitched;         // signature that was last queued
+    bool busy{false};             // queued or running
+};
+
+struct WatchJob {
+    fs::path input;
+    fs::path output;
+    std::string signature;
+    Clock::time_point queued;
+    Clock::time_point started;
+};
+
+struct FinishedJob {
+    std::string input;
+    int exit_code{0};
+    std::size_t images{0};
+    double wait_ms{0.0};    // queued -> started
+    double stitch_ms{0.0};  // pipeline total
+};
+
+class WatchQueue {
+public:
+    WatchQueue(const fs::path& status_file, const fs::path& root) : status_file_(status_file), root_(root) {}
+
+    void push(WatchJob job) {
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            job.queued = Clock::now();
+            queue_.push_back(std::move(job));
+            write_status_locked();
+        }
+        cv_.notify_one();
+    }
+
+    // Blocks until a job is available; returns false once stop() has been called.
+    bool pop(WatchJob& job) {
+        std::unique_lock<std::mutex> lock(mutex_);
+        cv_.wait(lock, [&]() { return stopping_ || !queue_.empty(); });
+        if (queue_.empty()) {
+            return false;
+        }
+        job = std::move(queue_.front());
+        queue_.pop_front();
+        job.started = Clock::now();
+        running_.push_back(job);
+        write_status_locked();
+        return true;
+    }
+
+    void finish(const WatchJob& job, const PipelineResult& result) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        running_.erase(std::remove_if(running_.begin(), running_.end(),
+                                      [&](const WatchJob& j) { return j.input == job.input; }),
+                       running_.end());
+        FinishedJob done;
+        done.input = job.input.string();
+        done.exit_code = result.exit_code;
+        done.images = result.images;
+        done.wait_ms = ms_between(job.queued, job.started);
+        done.stitch_ms = result.timings.total_ms;
+        recent_.push_back(done);
+        if (recent_.size() > kRecentJobs) {
+            recent_.pop_front();
+        }
+        ++(result.exit_code == 0 ? succeeded_ : failed_);
+        write_status_locked();
+    }
+
+    void stop() {
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            stopping_ = true;
+            queue_.clear(); // sets still waiting are picked up again by the next run
+            write_status_locked();
+        }
+        cv_.notify_all();
+    }
+
+private:
+    static constexpr std::size_t kRecentJobs = 20;
+
+    void write_status_locked() const {
+        const auto now = Clock::now();
+        std::ostringstream json;
+        json << "{\n  \"watching\": " << utils::json_string(root_.string())
+             << ",\n  \"state\": " << (stopping_ ? "\"stopping\"" : "\"running\"")
+             << ",\n  \"queue_depth\": " << queue_.size()
+             << ",\n  \"succeeded\": " << succeeded_
+             << ",\n  \"failed\": " << failed_
+             << ",\n  \"queued\": [";
+        for (std::size_t i = 0; i < queue_.size(); ++i) {
+            json << (i ? ", " : "") << "{\"input\": " << utils::json_string(queue_[i].input.string())
+                 << ", \"waiting_ms\": " << ms_between(queue_[i].queued, now) << "}";
+        }
+        json << "],\n  \"running\": [";
+        for (std::size_t i = 0; i < running_.size(); ++i) {
+            json << (i ? ", " : "") << "{\"input\": " << utils::json_string(running_[i].input.string())
+                 << ", \"elapsed_ms\": " << ms_between(running_[i].started, now) << "}";
+        }
+        json << "],\n  \"recent\": [";
+        double latency_sum = 0.0;
+        for (std::size_t i = 0; i < recent_.size(); ++i) {
+            const FinishedJob& j = recent_[i];
+            json << (i ? "," : "") << "\n    {\"input\": " << utils::json_string(j.input)
+                 << ", \"exit_code\": " << j.exit_code << ", \"images\": " << j.images
+                 << ", \"wait_ms\": " << j.wait_ms << ", \"stitch_ms\": " << j.stitch_ms
+                 << ", \"latency_ms\": " << j.wait_ms + j.stitch_ms << "}";
+            latency_sum += j.wait_ms + j.stitch_ms;
+        }
+        json << "],\n  \"mean_latency_ms\": " << (recent_.empty() ? 0.0 : latency_sum / recent_.size())
+             << "\n}\n";
+
+        // Readers polling the file never see a partial write
+        const fs::path tmp = status_file_.parent_path() / ("tmp_" + status_file_.filename().string());
+        {
+            std::ofstream out(tmp);
+            out << json.str();
+            if (!out) {
+                return;
+            }
+        }
+        std::error_code ec;
+        fs::rename(tmp, status_file_, ec);
+    }
+
+    fs::path status_file_;
+    fs::path root_;
+    mutable std::mutex mutex_;
+    std::condition_variable cv_;
+    std::deque<WatchJob> queue_;
+    std::vector<WatchJob> running_;
+    std::deque<FinishedJob> recent_;
+    std::size_t succeeded_{0};
+    std::size_t failed_{0};
+    bool stopping_{false};
+};
+
+} // namespace
+
+int run_watch(const CLIOptions& opts) {
+    const fs::path root(opts.watch_root);
+    const fs::path outRoot = opts.output_dir.empty() ? fs::path("output") : fs::path(opts.output_dir);
+    if (!fs::exists(root) || !fs::is_directory(root)) {
+        std::cerr << "Watch directory does not exist or is not a directory: " << root << "\n";
+        return 2;
+    }
+    std::error_code ec;
+    fs::create_directories(outRoot, ec);
+    if (ec) {
+        std::cerr << "Failed to create output directory: " << outRoot << " (" << ec.message() << ")\n";
+        return 3;
+    }
+
+    g_stop.store(false);
+    std::signal(SIGINT, on_stop_signal);
+    std::signal(SIGTERM, on_stop_signal);
+
+    const unsigned runnerCount = static_cast<unsigned>(std::max(1, opts.batch_jobs));
+    const auto settle = std::chrono::milliseconds(static_cast<long long>(std::max(0.0, opts.watch_settle_s) * 1000.0));
+    const fs::path statusFile = outRoot / "watch_status.json";
+    WatchQueue queue(statusFile, root);
+    ChangeNotifier notifier(root);
+    std::cout << "Watching " << root << (notifier.uses_inotify() ? " (inotify)" : " (polling)") << ", "
+              << runnerCount << " runner(s), sets settle after " << opts.watch_settle_s
+              << " s. Status: " << statusFile << "\n";
+
+    // Warm resources shared by every job for the life of the process
+    ThreadPool pool(opts.stage_threads.decode);
+    std::mutex logMutex;
+    std::map<fs::path, SetState> sets;
+    std::mutex setsMutex;
+
+    auto runner = [&]() {
+        WatchJob job;
+        while (queue.pop(job)) {
+            std::ostringstream log;
+            PipelineContext ctx;
+            ctx.out = &log;
+            ctx.err = &log;
+            ctx.pool = &pool;
+            PipelineResult result;
+            run_pipeline(opts, job.input, job.output, ctx, &result);
+            queue.finish(job, result);
+            {
+                std::lock_guard<std::mutex> lock(setsMutex);
+                sets[job.input].busy = false;
+            }
+
+            std::lock_guard<std::mutex> lock(logMutex);
+            std::istringstream lines(log.str());
+            std::string line;
+            const std::string tag = "[" + job.input.string() + "] ";
+            while (std::getline(lines, line)) {
+                std::cout << tag << line << "\n";
+            }
+            std::cout << tag << (result.exit_code == 0 ? "done" : "FAILED") << " in "
+                      << result.timings.total_ms << " ms (queued "
+                      << ms_between(job.queued, job.started) << " ms)" << std::endl;
+        }
+    };
+    std::vector<std::thread> runners;
+    for (unsigned r = 0; r < runnerCount; ++r) {
+        runners.emplace_back(runner);
+    }
+
+    const fs::path outCanon = fs::weakly_canonical(outRoot);
+    bool dirty = true; // scan once at start-up
+    while (!g_stop.load()) {
+        bool pending = false;
+        if (dirty) {
+            const auto now = Clock::now();
+            for (const fs::path& dir : find_capture_dirs(root)) {
+                // Never treat our own outputs as capture sets
+                const fs::path rel = fs::weakly_canonical(dir).lexically_relative(outCanon);
+                if (!rel.empty() && *rel.begin() != "..") {
+                    continue;
+                }
+                const std::string signature = set_signature(dir);
+                std::lock_guard<std::mutex> lock(setsMutex);
+                SetState& st = sets[dir];
+                if (st.signature != signature) {
+                    st.signature = signature;
+                    st.changed = now;
+                }
+                if (st.signature == st.stitched) {
+                    continue;
+                }
+                if (st.busy || now - st.changed < settle) {
+                    pending = true; // look again once it has settled or its running job is done
+                    continue;
+                }
+                WatchJob job;
+                job.input = dir;
+                const fs::path relOut = fs::relative(dir, root);
+                job.output = (relOut.empty() || relOut == ".") ? outRoot : outRoot / relOut;
+                job.signature = signature;
+                st.stitched = signature;
+                st.busy = true;
+                queue.push(std::move(job));
+                std::lock_guard<std::mutex> logLock(logMutex);
+                std::cout << "Queued " << dir << std::endl;
+            }
+        }
+        // Keep rescanning while a set is settling; otherwise sleep until something changes
+        const bool changed = notifier.wait(1000);
+        dirty = changed || pending;
+    }
+
+    std::cout << "Stopping: waiting for running jobs" << std::endl;
+    queue.stop();
+    for (auto& t : runners) {
+        t.join();
+    }
+    std::signal(SIGINT, SIG_DFL);
+    std::signal(SIGTERM, SIG_DFL);
+    return 0;
+}